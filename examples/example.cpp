@@ -0,0 +1,71 @@
+/** This example demonstrates the C++ layer of simpleALSA (simpleALSA.hpp).
+ *  Just like example.c it uses libsndfile to play a .wav file.
+ */
+
+/** simpleALSA.hpp includes simpleALSA.h, so SA_IMPLEMENTATION must still be defined at the top of the file */
+#define SA_IMPLEMENTATION
+
+#include <cstring>
+#include <iostream>
+#include <sndfile.h>
+#include <string>
+
+#include "../simpleALSA.hpp"
+
+int main(int argc, char const *argv[]) {
+    if(argc != 2)
+    {
+        std::cout << "Oops you did not provide enough arguments" << std::endl;
+        return 1;
+    }
+
+    SF_INFO sfinfo;
+    SNDFILE *infile = sf_open(argv[1], SFM_READ, &sfinfo);
+    if(!infile || sfinfo.channels != 2)
+    {
+        std::cout << "Failed to open a stereo wav file" << std::endl;
+        return 1;
+    }
+
+    /** The callback is a lambda that receives a typed span - here 32 bit samples with two channels. As the
+     * lambda type is a template argument of the device, the compiler inlines it into the trampoline the C write
+     * loop calls */
+    auto device = sa::make_device<SND_PCM_FORMAT_S32_LE, 2>(
+      [infile](sa::FrameSpan<int32_t, 2> frames) {
+          return (int) sf_readf_int(infile, frames.data(), frames.frames());
+      },
+      [&sfinfo](sa_device_config &config) { config.sample_rate = sfinfo.samplerate; });
+
+    if(!device.ok())
+    {
+        std::cout << "Failed to initialize the device: " << device.init_result() << std::endl;
+        return 1;
+    }
+
+    /** Restart the file when it has been played completely */
+    device.on_end([infile](decltype(device) &device) {
+        sf_seek(infile, 0, SEEK_SET);
+        device.start();
+    });
+
+    std::string input;
+    while(std::getline(std::cin, input))
+    {
+        if(input == "play")
+            device.start();
+        else if(input == "pause")
+            device.pause();
+        else if(input == "stop")
+            device.stop();
+        else if(input == "rewind")
+            sf_seek(infile, 0, SEEK_SET);
+        else if(input == "destroy")
+            break;
+    }
+    /** The device is destroyed when it goes out of scope, before the file is closed */
+    {
+        auto destroyed = std::move(device);
+    }
+    sf_close(infile);
+    return 0;
+}
@@ -52,9 +52,22 @@ DEALINGS IN THE SOFTWARE.
 #define SIMPLEALSA_H
 /*============================== INCLUDES ==============================*/
 #include <alsa/asoundlib.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined __ARM_NEON
+    #include <arm_neon.h>
+#elif defined __SSSE3__
+    #include <tmmintrin.h>
+#elif defined __SSE2__
+    #include <emmintrin.h>
+#endif
 
 /*=============================== MACROS ===============================*/
 #if !defined(DEFAULT_DEVICE)
@@ -82,12 +95,201 @@ DEALINGS IN THE SOFTWARE.
         200000 /** in µS - so 200ms here - right now this value allows for low latency but at the cost of higher CPU load */
 #endif
 
+#if !defined(DEFAULT_START_POLICY)
+    #define DEFAULT_START_POLICY SA_START_WHEN_FULL
+#endif
+
+#if !defined(DEFAULT_BULK_FILL)
+    #define DEFAULT_BULK_FILL false
+#endif
+
+#if !defined(DEFAULT_LOW_LATENCY_TIME)
+    #define DEFAULT_LOW_LATENCY_TIME 40000 /** in µS - fill level of the buffer in low latency mode */
+#endif
+
+#if !defined(DEFAULT_DEEP_WAKEUP_TIME)
+    #define DEFAULT_DEEP_WAKEUP_TIME \
+        500000 /** in µS - audio left in the buffer when the playback thread wakes up in deep buffer mode */
+#endif
+
+#if !defined(DEFAULT_ADAPTIVE_MIN_TIME)
+    #define DEFAULT_ADAPTIVE_MIN_TIME 20000 /** in µS - lowest fill level of the adaptive latency profile */
+#endif
+
+#if !defined(DEFAULT_ADAPTIVE_STABLE_TIME)
+    #define DEFAULT_ADAPTIVE_STABLE_TIME \
+        5000000 /** in µS - playback without xruns after which the adaptive fill level is lowered by a period */
+#endif
+
+#if !defined(DEFAULT_DEADLINE_MARGIN)
+    #define DEFAULT_DEADLINE_MARGIN 0 /** in µS - 0 disables the callback deadline watchdog */
+#endif
+
+#if !defined(DEFAULT_DEADLINE_FALLBACK_TIME)
+    #define DEFAULT_DEADLINE_FALLBACK_TIME 10000 /** in µS - length of one silence or fade-out block */
+#endif
+
+#if !defined(SA_FADE_STEPS)
+    #define SA_FADE_STEPS 16 /** amount of gain steps in a deadline fade-out */
+#endif
+
+#if !defined(SA_DEADLINE_RETRY_US)
+    #define SA_DEADLINE_RETRY_US 1000 /** in µS - shortest wait before the next fallback block when the buffer is full */
+#endif
+
+#if !defined(SA_MAX_FRAME_BYTES)
+    #define SA_MAX_FRAME_BYTES 64 /** the last frame is only kept for the fade-out when it fits in this size */
+#endif
+
+#if !defined(SA_XRUN_BACKOFF_MIN_US)
+    #define SA_XRUN_BACKOFF_MIN_US 1000 /** in µS - first wait when the PCM is still suspended */
+#endif
+
+#if !defined(SA_XRUN_BACKOFF_MAX_US)
+    #define SA_XRUN_BACKOFF_MAX_US 20000 /** in µS - the backoff doubles after every attempt up to this value */
+#endif
+
+#if !defined(SA_XRUN_RESUME_TIMEOUT_US)
+    #define SA_XRUN_RESUME_TIMEOUT_US \
+        500000 /** in µS - when resuming takes longer than this the PCM is prepared from scratch */
+#endif
+
+#if !defined(DEFAULT_PIPELINE_DEPTH)
+    #define DEFAULT_PIPELINE_DEPTH 0 /** periods rendered ahead on a worker thread, 0 runs the callback inline */
+#endif
+
+#if !defined(SA_MAX_PIPELINE_DEPTH)
+    #define SA_MAX_PIPELINE_DEPTH 8 /** highest pipeline_depth */
+#endif
+
+#if !defined(DEFAULT_RECONNECT_INTERVAL)
+    #define DEFAULT_RECONNECT_INTERVAL 500000 /** in µS - time between two attempts to reopen a lost PCM */
+#endif
+
+#if !defined(DEFAULT_SILENCE_TIMEOUT)
+    #define DEFAULT_SILENCE_TIMEOUT 0 /** in µS - digital silence after which the PCM is stopped, 0 disables it */
+#endif
+
+#if !defined(DEFAULT_SILENCE_CHECK_INTERVAL)
+    #define DEFAULT_SILENCE_CHECK_INTERVAL \
+        50000 /** in µS - how often the data callback is asked for audio while the PCM is stopped on silence */
+#endif
+
+#if !defined(SA_SILENCE_SCAN_BLOCK)
+    #define SA_SILENCE_SCAN_BLOCK 4096 /** bytes scanned for silence before the scan can stop early, a multiple of 64 */
+#endif
+
+#if !defined(SA_MAX_POLL_DESCRIPTORS)
+    #define SA_MAX_POLL_DESCRIPTORS 16 /** the pipe plus the ALSA poll descriptors of a single PCM */
+#endif
+
+#if !defined(SA_MEMORY_ALIGNMENT)
+    #define SA_MEMORY_ALIGNMENT 64 /** alignment of the memory block and the regions within it in SA_STATIC_ALLOC mode */
+#endif
+
+#if !defined(SA_MAX_CHANNELS)
+    #define SA_MAX_CHANNELS 8 /** highest channel count for which a software gain can be set */
+#endif
+
+#if !defined(SA_METER_LANES)
+    #define SA_METER_LANES 8 /** frames the level meters accumulate side by side, a multiple of the vector width */
+#endif
+
+#if !defined(SA_MAX_SPECTRUM_SIZE)
+    #define SA_MAX_SPECTRUM_SIZE 8192 /** highest spectrum_size */
+#endif
+
+#if !defined(SA_SPECTRUM_INTERVAL_US)
+    #define SA_SPECTRUM_INTERVAL_US 33333 /** in µS - how often the spectrum worker runs an FFT */
+#endif
+
+#if !defined(SA_TRACE_CAPACITY)
+    #define SA_TRACE_CAPACITY 8192 /** amount of trace events in the ring, must be a power of two */
+#endif
+
+#if !defined(SA_TRACE_FLUSH_INTERVAL_US)
+    #define SA_TRACE_FLUSH_INTERVAL_US 100000 /** in µS - how often the trace ring is written to the file */
+#endif
+
+#if !defined(SA_MAX_MIXER_SOURCES)
+    #define SA_MAX_MIXER_SOURCES 16 /** amount of sources one sa_mixer can hold at the same time */
+#endif
+
+#if !defined(SA_SAMPLER_VOICES)
+    #define SA_SAMPLER_VOICES 32 /** amount of clips an sa_sampler plays at the same time */
+#endif
+
+#if !defined(SA_SAMPLER_MAX_CLIPS)
+    #define SA_SAMPLER_MAX_CLIPS 64 /** amount of clips that can be loaded in one sa_sampler */
+#endif
+
+#if !defined(SA_SAMPLER_TRIGGER_CAPACITY)
+    #define SA_SAMPLER_TRIGGER_CAPACITY 256 /** pending triggers of one sa_sampler, must be a power of two */
+#endif
+
+#if !defined(SA_EVENT_CAPACITY)
+    #define SA_EVENT_CAPACITY 256 /** pending timed events of one sa_device, must be a power of two */
+#endif
+
+#if !defined(SA_BANK_ALIGNMENT)
+    #define SA_BANK_ALIGNMENT 4096 /** alignment of the assets in a sample bank, a page so hints cover whole assets */
+#endif
+
+#define SA_DEVICE_CACHE_MAGIC   "SACACHE"
+#define SA_DEVICE_CACHE_VERSION 2
+
+#define SA_BANK_MAGIC   "SABANK1"
+#define SA_BANK_VERSION 1
+
+#define SA_SHM_MAGIC   "SASHM1"
+#define SA_SHM_VERSION 1
+
+/** memfd flags and seals, not every libc exposes them without _GNU_SOURCE */
+#if !defined(MFD_CLOEXEC)
+    #define MFD_CLOEXEC 0x0001U
+#endif
+#if !defined(MFD_ALLOW_SEALING)
+    #define MFD_ALLOW_SEALING 0x0002U
+#endif
+#if !defined(F_ADD_SEALS)
+    #define F_ADD_SEALS 1033
+#endif
+#if !defined(F_SEAL_SEAL)
+    #define F_SEAL_SEAL   0x0001
+    #define F_SEAL_SHRINK 0x0002
+    #define F_SEAL_GROW   0x0004
+#endif
+
+#if !defined(SA_LOG_CAPACITY)
+    #define SA_LOG_CAPACITY 256 /** amount of messages in the asynchronous log ring, must be a power of two */
+#endif
+
+#if !defined(SA_LOG_MESSAGE_SIZE)
+    #define SA_LOG_MESSAGE_SIZE 128 /** longer messages are truncated */
+#endif
+
+#if !defined(SA_LOG_FLUSH_INTERVAL_US)
+    #define SA_LOG_FLUSH_INTERVAL_US 50000 /** in µS - how often the log thread hands messages to the sink */
+#endif
+
 #if !defined(SA_DEBUG)
     #define SA_NO_DEBUG_LOGS
 #endif
 
-#define SA_LOG_2_ARGS(type, msg0)       sa_log(type, msg0, "")
-#define SA_LOG_3_ARGS(type, msg0, msg1) sa_log(type, msg0, msg1)
+/** Lowest log level that is compiled in - logs below it cost nothing, not even a function call */
+#if !defined(SA_LOG_MIN_LEVEL)
+    #if defined SA_NO_DEBUG_LOGS && defined SA_NO_WARNING_LOGS
+        #define SA_LOG_MIN_LEVEL 2
+    #elif defined SA_NO_DEBUG_LOGS
+        #define SA_LOG_MIN_LEVEL 1
+    #else
+        #define SA_LOG_MIN_LEVEL 0
+    #endif
+#endif
+
+#define SA_LOG_ENABLED(type)            ((int) (type) >= SA_LOG_MIN_LEVEL)
+#define SA_LOG_2_ARGS(type, msg0)       (SA_LOG_ENABLED(type) ? sa_log(type, msg0, "") : (void) 0)
+#define SA_LOG_3_ARGS(type, msg0, msg1) (SA_LOG_ENABLED(type) ? sa_log(type, msg0, msg1) : (void) 0)
 
 #define GET_4TH_ARG(arg1, arg2, arg3, arg4, ...) arg4
 #define SA_LOG_MACRO_CHOOSER(...)                GET_4TH_ARG(__VA_ARGS__, SA_LOG_3_ARGS, SA_LOG_2_ARGS, )
@@ -98,6 +300,16 @@ DEALINGS IN THE SOFTWARE.
     #define SA_LOG(...) SA_LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__)
 #endif
 
+#if defined SA_TRACE
+    #define SA_TRACE_BEGIN(device, type, arg)   sa_trace_record(device, type, 'B', arg)
+    #define SA_TRACE_END(device, type, arg)     sa_trace_record(device, type, 'E', arg)
+    #define SA_TRACE_INSTANT(device, type, arg) sa_trace_record(device, type, 'i', arg)
+#else
+    #define SA_TRACE_BEGIN(device, type, arg)   ((void) 0)
+    #define SA_TRACE_END(device, type, arg)     ((void) 0)
+    #define SA_TRACE_INSTANT(device, type, arg) ((void) 0)
+#endif
+
 /*================================ ENUMS ================================*/
 /**
  * @brief enum used to return function results
@@ -112,6 +324,7 @@ typedef enum sa_result
     SA_STOP          = 2,
     SA_PAUSE         = 3,
     SA_UNPAUSE       = 4,
+    SA_DEVICE_LOST   = 5,
 
 } sa_result;
 
@@ -137,108 +350,390 @@ typedef enum
     SA_LOG_LEVEL_ERROR   = 2
 } sa_log_type;
 
+/**
+ * @brief enum used to choose when the PCM starts playing after it has been (re)started
+ *
+ */
+typedef enum sa_start_policy
+{
+    /** Start when the ALSA buffer is filled with as many periods as fit in it */
+    SA_START_WHEN_FULL    = 0,
+    /** Start as soon as start_threshold frames have been written */
+    SA_START_AFTER_FRAMES = 1,
+    /** Start with the very first write */
+    SA_START_IMMEDIATELY  = 2,
+} sa_start_policy;
+
+/**
+ * @brief enum used to choose between a single fixed buffer configuration, a dual deep/low latency profile or a
+ * fill level that follows the xruns
+ *
+ */
+typedef enum sa_latency_profile
+{
+    /** The buffer is kept full and the thread wakes up every period */
+    SA_LATENCY_PROFILE_FIXED    = 0,
+    /** buffer_time is the deep buffer and period_time the low latency granularity, see sa_latency_mode */
+    SA_LATENCY_PROFILE_DUAL     = 1,
+    /** The fill level doubles after an xrun or missed deadline and drops by a period after adaptive_stable_time
+     * without one, within [adaptive_min_time; adaptive_max_time] */
+    SA_LATENCY_PROFILE_ADAPTIVE = 2,
+} sa_latency_profile;
+
+/**
+ * @brief enum used to select the active mode of a device with the SA_LATENCY_PROFILE_DUAL profile
+ *
+ */
+typedef enum sa_latency_mode
+{
+    /** Fill the whole buffer and only wake up when deep_wakeup_time of audio is left */
+    SA_LATENCY_MODE_DEEP = 0,
+    /** Keep only low_latency_time of audio in the buffer and wake up every period */
+    SA_LATENCY_MODE_LOW  = 1,
+} sa_latency_mode;
+
+/**
+ * @brief enum used to choose what the deadline watchdog writes when the data callback is late
+ *
+ */
+typedef enum sa_deadline_fallback
+{
+    /** Write silence */
+    SA_DEADLINE_FALLBACK_SILENCE = 0,
+    /** Fade the last written frame out to silence, falls back to silence for unsupported formats */
+    SA_DEADLINE_FALLBACK_FADE    = 1,
+} sa_deadline_fallback;
+
+/**
+ * @brief enum used to identify the step of the playback thread a trace event belongs to
+ *
+ */
+typedef enum
+{
+    SA_TRACE_COMMAND  = 0,
+    SA_TRACE_POLL     = 1,
+    SA_TRACE_CALLBACK = 2,
+    SA_TRACE_WRITE    = 3,
+    SA_TRACE_RECOVERY = 4,
+    SA_TRACE_DRAIN    = 5,
+} sa_trace_type;
+
+/**
+ * @brief enum used to walk through the steps of the xrun recovery
+ *
+ */
+typedef enum
+{
+    SA_RECOVERY_RESUME  = 0,
+    SA_RECOVERY_BACKOFF = 1,
+    SA_RECOVERY_PREPARE = 2,
+} sa_recovery_step;
+
+/**
+ * @brief lifecycle of a mixer source slot
+ *
+ */
+typedef enum
+{
+    /** The slot can be claimed by sa_mixer_add_source() */
+    SA_MIXER_SOURCE_FREE = 0,
+    /** The slot is being set up or torn down by an API thread, the playback thread skips it */
+    SA_MIXER_SOURCE_CLAIMED = 1,
+    /** The source is mixed on every period */
+    SA_MIXER_SOURCE_ACTIVE = 2
+} sa_mixer_source_state;
+
+/**
+ * @brief state of a decoded buffer in an sa_cache
+ *
+ */
+typedef enum
+{
+    /** Queued for or being decoded by the cache worker */
+    SA_CACHE_ENTRY_LOADING = 0,
+    /** The frames can be played */
+    SA_CACHE_ENTRY_READY = 1,
+    /** The decoder failed, the entry is dropped once it is no longer referenced */
+    SA_CACHE_ENTRY_FAILED = 2
+} sa_cache_entry_state;
+
+/**
+ * @brief what an sa_event changes
+ *
+ */
+typedef enum
+{
+    /** Sets the software gain of one or every channel, like sa_set_channel_gain() */
+    SA_EVENT_GAIN = 0,
+    /** Pauses the device once the frames before the event have been played, like sa_pause_device() */
+    SA_EVENT_PAUSE = 1,
+    /** Calls a function on the playback thread between two data callbacks, e.g. to switch a source */
+    SA_EVENT_CALLBACK = 2
+} sa_event_type;
+
 /*=============================== STRUCTS ===============================*/
+/**
+ * @brief signature of a log sink, it is called from the log thread when asynchronous logging is started
+ */
+typedef void (*sa_log_sink)(sa_log_type type, const char *message, void *user_data);
+
 typedef struct sa_device sa_device;
 typedef struct sa_device_config sa_device_config;
 typedef struct sa_condition_variable sa_condition_variable;
+typedef struct sa_device_stats sa_device_stats;
+
+#if defined SA_FIXED_POINT
+/** Gains are Q15 with one integer bit, so [-2.0; 2.0[, and mixed samples are Q31 */
+typedef int32_t sa_gain;
+typedef int32_t sa_mix_sample;
+/** Meter peaks are Q31 magnitudes and sums add the squares of the Q15 samples, no float on the playback thread */
+typedef uint32_t sa_meter_peak;
+typedef uint64_t sa_meter_sum;
+    #define SA_GAIN_ONE 32768
+#else
+typedef float sa_gain;
+typedef float sa_mix_sample;
+typedef float sa_meter_peak;
+typedef float sa_meter_sum;
+    #define SA_GAIN_ONE 1.0f
+#endif
+
 /**
- * @brief struct used to encapsulate a simple ALSA device
+ * @brief signature of the format and channel specific functions that apply a per channel gain in place
+ */
+typedef void (*sa_gain_function)(void *buffer, int frames, int channels, const sa_gain *gains);
+
+/**
+ * @brief signature of the format and channel specific level meters, they raise peak and add the squared samples
+ * to sum per channel
+ */
+typedef void (*sa_meter_function)(const void *buffer, int frames, int channels, sa_meter_peak *peak,
+                                  sa_meter_sum *sum);
+
+/**
+ * @brief signature of the format specific functions that average the channels of each frame into the spectrum ring
+ */
+typedef void (*sa_downmix_function)(const void *buffer, int frames, int channels, float *ring, unsigned int mask,
+                                    unsigned int position);
+
+/**
+ * @brief signature of a mixer source callback, it writes up to amount_of_frames interleaved frames (float in
+ * [-1;1], or Q31 with SA_FIXED_POINT) with the channel count of the mixer device and returns the amount of frames it
+ * has written - the rest of the period is silent for this source
+ */
+typedef int (*sa_mixer_callback)(int amount_of_frames, sa_mix_sample *audio_buffer, int channels,
+                                 void *my_custom_data);
+
+typedef struct sa_mixer sa_mixer;
+
+/**
+ * @brief struct used to keep track of the playback statistics of a device
  *
  */
-struct sa_device
+struct sa_device_stats
 {
-    /** State of the device */
-    sa_device_state state;
-
-    /** Mutex to protect the state */
-    pthread_mutex_t stateMutex;
+    /** Amount of underruns since the device was initialized */
+    unsigned long xrun_count;
 
-    /** Pointer to the configuration settings of the device*/
-    sa_device_config *config;
+    /** Amount of times the PCM was suspended since the device was initialized */
+    unsigned long suspend_count;
 
-    /** Pointer to the ALSA PCM handle struct */
-    snd_pcm_t *handle;
+    /** Amount of times a resume attempt had to back off because the PCM was still suspended */
+    unsigned long resume_retries;
 
-    /** Pointer to the ALSA hardware parameters */
-    snd_pcm_hw_params_t *hw_params;
+    /** Total time (in µs) spent recovering, from the detection of the xrun until the buffer is refilled */
+    unsigned long long recovery_time_us;
 
-    /** Pointer to the ALSA hardware parameters */
-    snd_pcm_sw_params_t *sw_params;
+    /** Longest single recovery (in µs) */
+    unsigned long long max_recovery_time_us;
 
-    /** Pointer to the place is memory where audio samples are written right before being send to the ALSA buffer */
-    int *samples;
+    /** Amount of data callbacks that did not return before the deadline */
+    unsigned long deadline_misses;
 
-    /** Indicates support for the hardware to pause the pcm stream */
-    bool supports_pause;
+    /** Amount of silence or fade-out frames written by the deadline watchdog */
+    unsigned long long fallback_frames;
 
-    /** TODO */
-    snd_pcm_sframes_t buffer_size;
+    /** Amount of times the PCM disappeared (unplugged, driver gone) while playing */
+    unsigned long device_losses;
 
-    /** TODO */
-    snd_pcm_sframes_t period_size;
+    /** Amount of times the PCM was reopened after it was lost */
+    unsigned long reconnects;
 
-    /** Refers to the pipe which can cancel poll when playback is canceled*/
-    int pipe_write_end;
+    /** Amount of times the playback thread had to wait for the pipeline worker to render a period */
+    unsigned long pipeline_late_periods;
 
-    /** Reference to the playback thread */
-    pthread_t playback_thread;
+    /** Longest wait (in µs) for the pipeline worker */
+    unsigned long long max_pipeline_wait_us;
 
-    /** A condition variable and mutex used to communicate device stoppage */
-    sa_condition_variable *condition_var;
+    /** Amount of audio (in µs) the write loop currently keeps in the ALSA buffer */
+    unsigned long long latency_us;
 
-    /** The current volume as a percentage between [0;100] */
-    float volume_percentage;
+    /** Amount of times the adaptive latency profile raised or lowered the fill level */
+    unsigned long latency_raises;
+    unsigned long latency_drops;
 
-    /** The current volume as a decibel value between [-100; 0] */
-    float volume_dB;
+    /** Amount of times the PCM was stopped because the output was silent */
+    unsigned long silence_sleeps;
 
-    /** Mixer element for volume control */
-    snd_mixer_elem_t *volume_handle;
+    /** Total time (in µs) the PCM was stopped on silence */
+    unsigned long long silence_sleep_time_us;
 
-    /** Mixer handle */
-    snd_mixer_t *mixer_handle;
+    /** Amount of events that were not posted because the event queue was full */
+    unsigned long dropped_events;
 };
 
 /**
- * @brief struct used to config a simple ALSA devicre
+ * @brief levels of the last period handed to ALSA, after all in-library processing
  *
  */
-struct sa_device_config
+typedef struct
 {
-    /** Rate at which samples are send through the soundcard */
-    unsigned int sample_rate;
-
-    /** Amount of desired audiochannels */
+    /** Amount of valid entries in peak and rms */
     int channels;
+    /** Highest absolute sample value per channel, 1.0 is full scale */
+    float peak[SA_MAX_CHANNELS];
+    /** Root mean square per channel, 1.0 is full scale */
+    float rms[SA_MAX_CHANNELS];
+} sa_levels;
 
-    /** Defines the size (in µs) of the internal ALSA ring buffer */
-    int buffer_time;
-
-    /** Defines the time (in µs) after which ALSA will wake up to check if the buffer is running
-            empty - increasing this time will increase efficiency, but risk the buffer running empty */
-    int period_time;
-
-    /** Format of the frames that are send to the ALSA buffer */
-    snd_pcm_format_t format;
-
-    /** Name of the device - this name indicates ALSA to which physical device it must send
-                     audio - the default devices can be used by assigning this variable to "default" */
-    char *alsa_device_name;
+/**
+ * @brief called on the playback thread by an SA_EVENT_CALLBACK event, it must not block
+ */
+typedef void (*sa_event_callback)(sa_device *device, void *my_custom_data);
 
-    /** Some pointer to custom set data*/
+/**
+ * @brief a control change that is applied at an exact frame of the stream, see sa_post_event()
+ *
+ */
+typedef struct
+{
+    sa_event_type type;
+    /** SA_EVENT_GAIN: index in [0; channels[, or -1 for every channel */
+    int channel;
+    /** SA_EVENT_GAIN: linear gain factor */
+    float gain;
+    /** SA_EVENT_CALLBACK: the function and its argument */
+    sa_event_callback callback;
     void *my_custom_data;
+} sa_event;
 
-    /** Callback function that will be called whenever the internal buffer is running
-                                    empty and new audio samples are required */
-    int (*data_callback)(int amount_of_frames, void *audio_buffer, sa_device *sa_device,
-                         void *my_custom_data);
+/**
+ * @brief level meters and spectrum of the output, the playback thread only publishes and never waits on a reader
+ *
+ */
+typedef struct
+{
+    /** Meter specialized for the format and channel count, NULL when metering is off */
+    sa_meter_function meter;
+    /** Seqlock of levels, odd while the playback thread writes them */
+    unsigned int levels_sequence;
+    sa_levels levels;
+    /** Averages the channels into the ring, NULL when the spectrum is off */
+    sa_downmix_function downmix;
+    /** FFT size in samples, a power of two */
+    int spectrum_size;
+    /** Ring of mono samples, the playback thread overwrites the oldest ones and the worker drops a torn copy */
+    float *ring;
+    /** Capacity of the ring in samples, a power of two */
+    unsigned int ring_size;
+    /** Free running sample counter, only written by the playback thread */
+    unsigned int write_position;
+    /** write_position at the last FFT, owned by the worker */
+    unsigned int analyzed_position;
+    /** Hann window and FFT work buffers of spectrum_size samples, owned by the worker */
+    float *window;
+    float *real;
+    float *imaginary;
+    /** Scales a full scale sine to a magnitude of 1.0 */
+    float magnitude_scale;
+    /** Seqlock of magnitudes, odd while the worker writes them */
+    unsigned int spectrum_sequence;
+    /** spectrum_size / 2 magnitudes */
+    float *magnitudes;
+    /** The spectrum worker, only running when spectrum_size is set */
+    pthread_t thread;
+    /** Set to stop the worker */
+    int quit;
+} sa_analysis;
 
-    /** Callback function that will be called whenever the other callback function fails to provide more samples */
-    void (*eof_callback)(sa_device *sa_device, void *my_custom_data);
+/**
+ * @brief state of the SA_LATENCY_PROFILE_ADAPTIVE profile, owned by the playback thread
+ *
+ */
+typedef struct
+{
+    /** xruns, deadline misses and late pipeline periods when the fill level was last changed */
+    unsigned long events;
+    /** CLOCK_MONOTONIC time in µs of the last change or late wakeup */
+    unsigned long long stable_since_us;
+    /** Lowest fill level seen at a wakeup since then */
+    snd_pcm_sframes_t min_fill;
+} sa_adaptive_latency;
 
-    /** Name that will show in the alsamixer */
-    char *device_name;
-};
+/**
+ * @brief watches the data callback and keeps the PCM fed when it runs past its deadline
+ *
+ */
+typedef struct
+{
+    /** The watchdog thread, only running when deadline_margin is set */
+    pthread_t thread;
+    /** Mutex that protects the fields below. The watchdog only writes to the PCM while a deadline is set, and the
+     * playback thread only writes after it cleared the deadline under this mutex, so the writes never overlap */
+    pthread_mutex_t mutex;
+    /** Signals a new deadline or shutdown */
+    pthread_cond_t cond;
+    /** Absolute CLOCK_MONOTONIC time in µs at which the fallback is written, 0 when the callback is not running */
+    unsigned long long deadline_us;
+    /** Set when the fallback was written during the current callback */
+    bool missed;
+    /** Set to stop the thread */
+    bool quit;
+    /** Buffer with room for fallback_frames frames */
+    void *fallback_samples;
+    /** Size of one fallback block in frames */
+    snd_pcm_sframes_t fallback_frames;
+    /** Copy of the last frame handed to ALSA, used as the start of the fade-out */
+    uint8_t last_frame[SA_MAX_FRAME_BYTES];
+} sa_deadline_watchdog;
+
+/**
+ * @brief runs the data callback on a worker thread a few periods ahead of playback, the rendered periods are
+ * handed over in preallocated slots
+ *
+ */
+typedef struct
+{
+    /** The worker thread, only running when pipeline_depth is set */
+    pthread_t thread;
+    /** Mutex that protects the fields below, the slot contents are owned by whoever holds the slot */
+    pthread_mutex_t mutex;
+    /** Signals the worker that a slot was freed, playback (re)started or it has to quit */
+    pthread_cond_t worker_cond;
+    /** Signals the playback thread that a slot was rendered or the worker went idle */
+    pthread_cond_t ready_cond;
+    /** depth slots of period_frames frames each */
+    void *slots;
+    /** Size of one slot in frames, the period size at initialization */
+    int period_frames;
+    /** Amount of slots */
+    int depth;
+    /** Frames rendered in each slot */
+    int slot_frames[SA_MAX_PIPELINE_DEPTH];
+    /** Free running slot counters, the worker owns write_index and the playback thread read_index */
+    unsigned int write_index;
+    unsigned int read_index;
+    /** Frames of the slot at read_index that were already copied */
+    int read_offset;
+    /** Set while the device plays, the worker only renders when it is set */
+    bool running;
+    /** Set while the worker is inside the data callback */
+    bool busy;
+    /** Set when the data callback returned 0 */
+    bool end;
+    /** Set to stop the thread */
+    bool quit;
+} sa_pipeline;
 
 /**
  * @brief a struct used to indicate wether the devices has stopped in a thread safe way
@@ -255,1244 +750,7409 @@ struct sa_condition_variable
 };
 
 /**
- * @brief holds everything related to polling
+ * @brief holds everything related to polling, it lives as long as the device so starting does not allocate
  */
 typedef struct
 {
     /** An array of file descriptors to poll, ufds[0] is the read end of the pipe */
-    struct pollfd *ufds;
+    struct pollfd ufds[SA_MAX_POLL_DESCRIPTORS];
     /** The amount of file descriptors to poll */
     int count;
 } sa_poll_management;
 
+#if defined SA_TRACE
 /**
- * @brief a struct with data to be passed to the playback thread
+ * @brief one entry of the trace ring
  */
 typedef struct
 {
-    /** An array of file descriptors to poll, ufds[0] is the read end of the pipe */
-    sa_device *device;
-    /** The read end of the pipe */
-    struct pollfd *pipe_read_end_fd;
-} sa_thread_data;
+    /** CLOCK_MONOTONIC time in µs */
+    unsigned long long timestamp_us;
+    /** ALSA avail and delay at the time of the event, -1 when unknown */
+    int avail;
+    int delay;
+    /** Event specific argument: frames, result or command */
+    int arg;
+    /** sa_trace_type */
+    uint8_t type;
+    /** Chrome trace phase: 'B'egin, 'E'nd or 'i'nstant */
+    char phase;
+} sa_trace_event;
 
-/*************************************************************************************************************************************************************/
-/*************************************************************************************************************************************************************/
-/*****************************************************************DECLARATIONS/DEFINITIONS*********************************************************************/
-/*************************************************************************************************************************************************************/
-/*************************************************************************************************************************************************************/
-
-/** Prevent parsers from greying out the following */
-#if defined(__INTELLISENSE__) || defined(Q_CREATOR_RUN)
-    #define SA_IMPLEMENTATION
+/**
+ * @brief a preallocated single producer, single consumer ring of trace events
+ * The playback thread produces, the flush thread consumes and writes Chrome trace-event JSON
+ */
+typedef struct
+{
+    sa_trace_event events[SA_TRACE_CAPACITY];
+    /** Written by the playback thread */
+    unsigned int head;
+    /** Written by the flush thread */
+    unsigned int tail;
+    /** Non zero while tracing */
+    int active;
+    /** Events lost because the ring was full */
+    unsigned long dropped;
+    /** The flush thread and its output */
+    pthread_t flush_thread;
+    FILE *file;
+    bool first_event;
+} sa_trace;
 #endif
 
-#if defined SA_IMPLEMENTATION
-/*=========================== API DECLARATIONS ===========================*/
 /**
- * @brief creates an sa_device_config struct and sets it to default values
- * @param device - empty pointer into which the config struct is set
- * @return sa_return_status
+ * @brief a posted event, queued by any thread and picked up by the playback thread
+ *
  */
-extern sa_result sa_init_device_config(sa_device_config **config);
+typedef struct
+{
+    /** Slot sequence number of the bounded multi producer queue */
+    unsigned int sequence;
+    sa_event event;
+    /** Stream position of the event, or its CLOCK_MONOTONIC time in ns when by_time is set */
+    unsigned long long timestamp;
+    bool by_time;
+} sa_event_entry;
 
 /**
- * @brief initializes a new audio device
- * @param config - configuration used to initialize the device
- * @param device - pointer to the initialized audio device
- * @return sa_return_status
+ * @brief timed events of one device, everything but the queue is owned by the playback thread
+ *
  */
-extern sa_result sa_init_device(sa_device_config *config, sa_device **device);
+typedef struct
+{
+    /** Events posted since the last period */
+    sa_event_entry queue[SA_EVENT_CAPACITY];
+    unsigned int enqueue_position;
+    unsigned int dequeue_position;
 
-/**
- * @brief starts the simple ALSA device - which starts the callback loop
- * This function will block untill the device is actually stopped.
+    /** Dequeued events with their stream position as timestamp, sorted so the next one is last */
+    sa_event_entry pending[SA_EVENT_CAPACITY];
+    int pending_count;
 
- * @param device - device to start
- * @return sa_return_status
- */
-extern sa_result sa_start_device(sa_device *device);
+    /** Amount of frames rendered since the device was initialized, the clock of the events */
+    unsigned long long position;
+
+    /** Set by an SA_EVENT_PAUSE, nothing is rendered until the playback thread has paused */
+    bool pause_pending;
+
+    /** Events lost because the queue was full */
+    unsigned long dropped;
+} sa_event_queue;
 
 /**
- * @brief pauses the simple ALSA device - which pauses the callback loop
+ * @brief struct used to encapsulate a simple ALSA device
  *
- * @param device - device to pause
- * @return sa_return_status
  */
-extern sa_result sa_pause_device(sa_device *device);
+struct sa_device
+{
+    /** State of the device */
+    sa_device_state state;
 
-    #ifdef SA_ASYNC_API
+    /** Mutex to protect the state */
+    pthread_mutex_t stateMutex;
+
+    /** Pointer to the configuration settings of the device*/
+    sa_device_config *config;
+
+    /** Pointer to the ALSA PCM handle struct */
+    snd_pcm_t *handle;
+
+    /** Pointer to the ALSA hardware parameters */
+    snd_pcm_hw_params_t *hw_params;
+
+    /** Pointer to the ALSA hardware parameters */
+    snd_pcm_sw_params_t *sw_params;
+
+    /** Pointer to the place is memory where audio samples are written right before being send to the ALSA buffer,
+     * it is large enough to hold buffer_size frames */
+    int *samples;
+
+    /** Amount of frames the samples buffer holds, a reopened PCM may not negotiate a larger buffer */
+    snd_pcm_sframes_t sample_capacity;
+
+    /** Indicates support for the hardware to pause the pcm stream */
+    bool supports_pause;
+
+    /** TODO */
+    snd_pcm_sframes_t buffer_size;
+
+    /** TODO */
+    snd_pcm_sframes_t period_size;
+
+    /** Refers to the pipe which can cancel poll when playback is canceled*/
+    int pipe_write_end;
+
+    /** Reference to the playback thread */
+    pthread_t playback_thread;
+
+    /** A condition variable and mutex used to communicate device stoppage */
+    sa_condition_variable condition_var;
+
+    /** The poll descriptors of the pipe and the PCM, ufds[0] is also used by the idle playback thread */
+    sa_poll_management poll_manager;
+
+    /** The user supplied memory block when the device was created with sa_init_device_static(), NULL otherwise */
+    void *static_memory;
+
+    /** Size of the user supplied memory block */
+    size_t static_memory_size;
+
+    /** The current volume as a percentage between [0;100] */
+    float volume_percentage;
+
+    /** The current volume as a decibel value between [-100; 0] */
+    float volume_dB;
+
+    /** Mixer element for volume control */
+    snd_mixer_elem_t *volume_handle;
+
+    /** Mixer handle */
+    snd_mixer_t *mixer_handle;
+
+    /** Size of one frame in bytes: channels * physical sample width */
+    int frame_bytes;
+
+    /** Gain function specialized for the format and channel count, NULL when the format is not supported */
+    sa_gain_function apply_gain;
+
+    /** Software gain per channel, written by the API and read by the playback thread */
+    sa_gain channel_gain[SA_MAX_CHANNELS];
+
+    /** Non zero when at least one channel gain differs from 1.0 */
+    int gain_active;
+
+    /** Amount of frames the write loop keeps in the ALSA buffer */
+    snd_pcm_sframes_t target_fill;
+
+    /** The latency mode that is currently applied by the playback thread */
+    sa_latency_mode latency_mode;
+
+    /** The latency mode requested through sa_set_latency_mode(), picked up by the playback thread */
+    int requested_latency_mode;
+
+    /** Fill level bookkeeping of the adaptive latency profile */
+    sa_adaptive_latency adaptive;
+
+    /** Watchdog that covers for a late data callback */
+    sa_deadline_watchdog watchdog;
+
+    /** Worker that renders periods ahead of playback */
+    sa_pipeline pipeline;
+
+    /** Level meters and spectrum of the output */
+    sa_analysis analysis;
+
+    /** Non zero when silence_timeout is set and the silence of the format can be scanned for */
+    int detect_silence;
+
+    /** snd_pcm_format_silence_64() of the format */
+    uint64_t silence_pattern;
+
+    /** Amount of consecutive silent frames handed to ALSA */
+    snd_pcm_sframes_t silent_frames;
+
+    /** Control changes that apply at an exact frame */
+    sa_event_queue events;
+
+#if defined SA_SIMULATE_DEVICE_LOSS
+    /** Non zero when the next write must fail as if the PCM was unplugged */
+    int simulated_loss;
+
+    /** Amount of reopen attempts that still have to fail */
+    int simulated_reopen_failures;
+#endif
+
+#if defined SA_TRACE
+    /** Timeline of the playback thread */
+    sa_trace trace;
+#endif
+
+    /** Playback statistics */
+    sa_device_stats stats;
+
+    /** Mutex to protect the statistics */
+    pthread_mutex_t statsMutex;
+};
 
 /**
- * @brief stops a simple ALSA device - same as pause but in addition, all buffer data is dropped
- * This function will return directly which means there is no guarantee about the state after a call to this function
+ * @brief one input of an sa_mixer, it is fed by either a callback or a ring that another thread writes to
  *
- * @param device - device to stop
- * @return sa_return_status
  */
-extern sa_result sa_stop_device_async(sa_device *device);
+typedef struct
+{
+    /** sa_mixer_source_state, only changed with atomic operations */
+    int state;
+
+    /** Pull style source, NULL for ring sources */
+    sa_mixer_callback callback;
+
+    /** Passed to the callback */
+    void *my_custom_data;
+
+    /** Push style source: single producer single consumer ring of interleaved frames */
+    sa_mix_sample *ring;
+
+    /** Capacity of the ring in frames, a power of two */
+    unsigned int ring_frames;
+
+    /** Free running frame counters of the ring, the playback thread owns read_position */
+    unsigned int read_position;
+    unsigned int write_position;
+
+    /** Non zero while sa_mixer_write() copies into the ring, removal waits for it before freeing the ring */
+    int writing;
+
+    /** Gain per side after panning, index 0 is used for every channel unless the mixer is stereo */
+    sa_gain gains[2];
+} sa_mixer_source;
 
 /**
- * @brief starts the simple ALSA device - which starts the callback loop
- * This function will return directly which means there is no guarantee about the state after a call to this function
- * @param device - device to start
- * @return sa_return_status
+ * @brief sums several sources into the period buffer of one sa_device
+ *
  */
-extern sa_result sa_start_device_async(sa_device *device);
+struct sa_mixer
+{
+    /** The device the mix is played on, the mixer owns it */
+    sa_device *device;
 
-    #endif
+    /** Channel count of the device, every source delivers this layout */
+    int channels;
+
+    /** Sources that are mixed, added and removed without locks */
+    sa_mixer_source sources[SA_MAX_MIXER_SOURCES];
+
+    /** Accumulator of buffer_size frames */
+    sa_mix_sample *mix_buffer;
+
+    /** Scratch space a source renders into before it is added to the mix */
+    sa_mix_sample *source_buffer;
+
+    /** Incremented before and after every mix, odd while the playback thread reads the sources */
+    unsigned int mix_sequence;
+};
 
 /**
- * @brief stops a simple ALSA device - same sa_stop_device, but blocks until the devices has actually stopped
- * This function will block untill the device is actually stopped.
+ * @brief a clip that is loaded in a sampler, converted to the mix layout once so playing it costs no conversion
  *
- * @param device - device to stop
- * @return sa_return_status
  */
-extern sa_result sa_stop_device(sa_device *device);
+typedef struct
+{
+    /** Interleaved frames with the channel count of the mixer, NULL while the slot is not loaded */
+    sa_mix_sample *frames;
+
+    /** Length of the clip */
+    int amount_of_frames;
+} sa_sampler_clip;
 
 /**
- * @brief destroys the device - device pointer is set to NULL
+ * @brief a request to play a clip, queued by any thread and picked up by the playback thread
  *
- * @param device - the device to destroy
- * @return sa_return_status
  */
-extern sa_result sa_destroy_device(sa_device *device);
+typedef struct
+{
+    /** Slot sequence number of the bounded multi producer queue */
+    unsigned int sequence;
+    int clip_id;
+    sa_gain gains[2];
+    /** Sampler time at which the first frame plays, 0 plays as soon as possible */
+    unsigned long long at_frame;
+} sa_sampler_trigger_entry;
 
 /**
- * @brief function used to retrieve the device state in a thread safe manner
+ * @brief one playing clip, owned by the playback thread
  *
- * @param device
- * @return sa_device_state
  */
-extern sa_device_state sa_get_device_state(sa_device *device);
+typedef struct
+{
+    /** The clip that is playing, -1 when the voice is idle */
+    int clip_id;
 
-/*=========================== LOG DECLARATIONS ===========================*/
-static void sa_log(sa_log_type type, const char msg0[], const char msg1[]);
+    /** Next frame of the clip */
+    int position;
+
+    /** Sampler time of the first frame */
+    unsigned long long start_frame;
+
+    /** Increases with every started voice, the lowest one is stolen first */
+    unsigned long long serial;
+
+    sa_gain gains[2];
+} sa_sampler_voice;
 
-/*======================== ALSA FUNC DECLARATIONS ========================*/
 /**
- * @brief Initialized an ALSA device and store some settings in de sa_device
+ * @brief plays preloaded clips on a fixed pool of voices as one source of an sa_mixer
  *
- * @return sa_result
  */
-static sa_result init_alsa_device(sa_device *device);
+typedef struct
+{
+    /** The mixer the sampler is a source of */
+    sa_mixer *mixer;
+
+    /** The mixer source id of the sampler */
+    int source_id;
+
+    /** Loaded clips, a slot is published by storing its frames pointer */
+    sa_sampler_clip clips[SA_SAMPLER_MAX_CLIPS];
+
+    /** Amount of claimed clip slots */
+    int clip_count;
+
+    /** The voice pool */
+    sa_sampler_voice voices[SA_SAMPLER_VOICES];
+
+    /** Triggers waiting for the next period */
+    sa_sampler_trigger_entry triggers[SA_SAMPLER_TRIGGER_CAPACITY];
+    unsigned int enqueue_position;
+    unsigned int dequeue_position;
+
+    /** Amount of frames rendered so far, the sampler clock */
+    unsigned long long frame_time;
+
+    /** Serial of the last started voice */
+    unsigned long long voice_serial;
+
+    /** Triggers lost because the queue was full */
+    unsigned long dropped_triggers;
+
+    /** Voices that were cut off to start a new clip */
+    unsigned long stolen_voices;
+} sa_sampler;
 
 /**
- * @brief Sets the ALSA hardware parameters
- *
- * @param device
- * @param access
- * @return sa_result
+ * @brief decodes an asset to PCM in the requested format and channel count, called on the cache worker thread.
+ * The frames must be allocated with malloc(), the cache frees them.
  */
-static sa_result set_hardware_parameters(sa_device *device, snd_pcm_access_t access);
+typedef sa_result (*sa_cache_decoder)(const char *name, snd_pcm_format_t format, int channels, void **frames,
+                                      int *amount_of_frames, void *my_custom_data);
+
+typedef struct sa_cache_entry sa_cache_entry;
 
 /**
- * @brief Sets the ALSA software parameters
+ * @brief one decoded asset, shared by every device that plays it
  *
- * @param device
- * @return sa_result
  */
-static sa_result set_software_parameters(sa_device *device);
+struct sa_cache_entry
+{
+    /** Key of the entry: the asset name plus the format it was converted to */
+    char *name;
+    snd_pcm_format_t format;
+    int channels;
+
+    /** sa_cache_entry_state, written by the worker and read without a lock by the playback threads */
+    int state;
+
+    /** Decoded frames, constant once the entry is ready */
+    void *frames;
+    int amount_of_frames;
+    size_t bytes;
+
+    /** Amount of users, an entry is only evicted when this is 0 */
+    int references;
+
+    /** Position in the LRU list, the head is the most recently used entry */
+    sa_cache_entry *previous;
+    sa_cache_entry *next;
+
+    /** Next entry in the queue of the worker */
+    sa_cache_entry *next_pending;
+};
 
 /**
- * @brief Prepares and starts the playback thread and creates a communication pipe
+ * @brief process wide cache of decoded, format converted PCM buffers with a memory budget
  *
- * @param device
- * @return sa_result
  */
-static sa_result prepare_playback_thread(sa_device *device);
+typedef struct
+{
+    /** Protects everything but the state and frames of ready entries */
+    pthread_mutex_t mutex;
+
+    /** Wakes the worker */
+    pthread_cond_t work_cond;
+
+    /** Signalled when an entry finished loading */
+    pthread_cond_t loaded_cond;
+
+    pthread_t worker;
+    bool quit;
+
+    sa_cache_decoder decoder;
+    void *my_custom_data;
+
+    /** Unreferenced entries are evicted when more than this many bytes are decoded */
+    size_t memory_budget;
+    size_t memory_used;
+
+    /** LRU list */
+    sa_cache_entry *head;
+    sa_cache_entry *tail;
+
+    /** Queue of entries to decode */
+    sa_cache_entry *pending_head;
+    sa_cache_entry *pending_tail;
+} sa_cache;
 
 /**
- * @brief Starts the ALSA write and wait loop
+ * @brief plays one cached asset, pass it as my_custom_data together with sa_cache_source_callback
  *
- * @param device
- * @return sa_result
  */
-static sa_result start_alsa_device(sa_device *device);
+typedef struct
+{
+    sa_cache *cache;
+
+    /** The entry, referenced as long as the source is open */
+    sa_cache_entry *entry;
+
+    /** Next frame that is played */
+    int position;
+
+    /** Size of one frame in bytes */
+    int frame_bytes;
+} sa_cache_source;
 
 /**
- * @brief Waits until the transfer loop starts
+ * @brief capabilities of one playback PCM, found by sa_probe_device() or sa_enumerate_devices() - the layout is also
+ * the record format of the on-disk device cache
  *
- * @param device
- * @return sa_result
  */
-static sa_result wait_for_start_alsa_device(sa_device *device);
+typedef struct
+{
+    /** ALSA name of the PCM, e.g. "hw:CARD=PCH,DEV=0" */
+    char name[128];
+
+    /** Human readable description from the device hints */
+    char description[128];
+
+    /** ID of the card the PCM belongs to, empty for virtual PCMs without a card */
+    char card_id[32];
+
+    /** Non zero when the fields below are valid, a busy device cannot be probed */
+    int32_t probed;
+
+    /** Non zero when the PCM supports snd_pcm_pause() */
+    int32_t supports_pause;
+
+    /** Bit n is set when snd_pcm_format_t n is supported */
+    uint64_t formats;
+
+    uint32_t min_rate;
+    uint32_t max_rate;
+    uint32_t min_channels;
+    uint32_t max_channels;
+
+    /** Period and buffer size ranges in frames */
+    uint64_t min_period_size;
+    uint64_t max_period_size;
+    uint64_t min_buffer_size;
+    uint64_t max_buffer_size;
+
+    /** Sizes the last init with a device cache negotiated, 0 until then - an init that requests the same format,
+     * channels, rate and times sets them directly instead of searching for the nearest match */
+    uint64_t negotiated_buffer_size;
+    uint64_t negotiated_period_size;
+    int32_t negotiated_format;
+    uint32_t negotiated_rate;
+    uint32_t negotiated_channels;
+    uint32_t requested_buffer_time;
+    uint32_t requested_period_time;
+} sa_device_info;
 
 /**
- * @brief Sends out a message to the transfer loop to pause audio output
+ * @brief first bytes of a sample bank file, all fields are little endian
  *
- * @param device
- * @return sa_result
  */
-static sa_result pause_alsa_device(sa_device *device);
+typedef struct
+{
+    /** SA_BANK_MAGIC, zero padded */
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    /** File offset of the index, a multiple of SA_MEMORY_ALIGNMENT */
+    uint64_t index_offset;
+    uint64_t reserved[5];
+} sa_bank_header;
 
 /**
- * @brief Sends out a message to the transfer loop to unpause audio output
+ * @brief one asset in the index of a sample bank
  *
- * @param device
- * @return sa_result
  */
-static sa_result unpause_alsa_device(sa_device *device);
+typedef struct
+{
+    /** Zero terminated name of the asset */
+    char name[96];
+    /** File offset of the frames, a multiple of SA_BANK_ALIGNMENT */
+    uint64_t offset;
+    uint64_t amount_of_frames;
+    uint32_t sample_rate;
+    uint32_t channels;
+    /** snd_pcm_format_t of the frames */
+    int32_t format;
+    uint32_t reserved;
+} sa_bank_entry;
 
 /**
- * @brief Sends out a message to stop the transfer loop
+ * @brief a sample bank file mapped in memory, pages are only read when an asset is played or hinted
  *
- * @param device
- * @return sa_result
  */
-static sa_result stop_alsa_device(sa_device *device);
+typedef struct
+{
+    /** The whole file */
+    const char *memory;
+    size_t size;
+
+    const sa_bank_header *header;
+    const sa_bank_entry *entries;
+} sa_bank;
 
 /**
- * @brief Waits until the transfer loop stops
+ * @brief plays one asset of a sample bank, pass it as my_custom_data together with sa_bank_source_callback
  *
- * @param device
- * @return sa_result
  */
-static sa_result wait_for_stop_alsa_device(sa_device *device);
+typedef struct
+{
+    const sa_bank_entry *entry;
+
+    /** First frame of the asset in the mapping */
+    const char *frames;
+
+    /** Next frame that is played */
+    int position;
+
+    /** Size of one frame in bytes */
+    int frame_bytes;
+} sa_bank_source;
 
 /**
- * @brief Drops the samples of the internal ALSA buffer and stop the ALSA pcm handle
+ * @brief start of the shared memory of an sa_shm_source, the ring of frames follows at data_offset - the fields
+ * written by the producer and by the consumer each have their own cache line
  *
- * @param device
- * @return sa_result
  */
-static sa_result drop_alsa_device(sa_device *device);
+typedef struct
+{
+    /** SA_SHM_MAGIC, zero padded */
+    char magic[8];
+    uint32_t version;
+    /** Offset of the ring from the start of the memory */
+    uint32_t data_offset;
+    uint32_t sample_rate;
+    uint32_t channels;
+    /** snd_pcm_format_t of the frames */
+    int32_t format;
+    uint32_t frame_bytes;
+    /** Size of the ring in frames, a power of two */
+    uint32_t capacity_frames;
+    uint32_t reserved[7];
+
+    /** Free running frame counter, only written by the producer */
+    uint32_t write_position;
+    /** Set by the producer after its last frame, the source returns 0 once the ring is empty */
+    uint32_t closed;
+    uint32_t producer_padding[14];
+
+    /** Free running frame counter, only written by the playback thread */
+    uint32_t read_position;
+    /** Set by a producer that sleeps on the eventfd until there is room */
+    uint32_t producer_waiting;
+    /** Frames of silence played because the ring was empty */
+    uint64_t underrun_frames;
+    uint32_t consumer_padding[12];
+} sa_shm_header;
 
 /**
- * @brief Drains the samples of the internal ALSA buffer and stops the ALSA pcm handle
+ * @brief a ring of frames in a memfd that another process writes to, pass it as my_custom_data together with
+ * sa_shm_source_callback - the fds are handed to the producer (inherited or sent over a unix socket)
  *
- * @param device
- * @return sa_result
  */
-static sa_result drain_alsa_device(sa_device *device);
+typedef struct
+{
+    /** The memfd, sealed against resizing so a producer cannot make the mapping fault */
+    int memfd;
+
+    /** Signalled by the playback thread when it freed room for a waiting producer */
+    int eventfd;
+
+    sa_shm_header *header;
+    char *frames;
+    size_t size;
+
+    /** Copies of the header fields, the shared header is writable by the producer and is not trusted */
+    uint32_t capacity_frames;
+    int frame_bytes;
+    snd_pcm_format_t format;
+    int channels;
+} sa_shm_source;
 
 /**
- * @brief Initializes the polling filedescriptors for ALSA and links it to the communication pipe
+ * @brief the producer side of an sa_shm_source, used in the process that renders the audio
  *
- * @param device
- * @param poll_manager, nullpointer to initialize
- * @param pipe_read_end_fd
- * @return sa_result
  */
-static sa_result init_poll_management(sa_device *device, sa_poll_management **poll_manager,
-                                      struct pollfd *pipe_read_end_fd);
+typedef struct
+{
+    int eventfd;
+
+    sa_shm_header *header;
+    char *frames;
+    size_t size;
+
+    uint32_t capacity_frames;
+    int frame_bytes;
+} sa_shm_writer;
 
 /**
- * @brief Starts the audio playback thread by running the write and poll loop
+ * @brief struct used to config a simple ALSA devicre
  *
- * @param data: a sa_thread_data packet
+ */
+struct sa_device_config
+{
+    /** Rate at which samples are send through the soundcard */
+    unsigned int sample_rate;
+
+    /** Amount of desired audiochannels */
+    int channels;
+
+    /** Defines the size (in µs) of the internal ALSA ring buffer */
+    int buffer_time;
+
+    /** Defines the time (in µs) after which ALSA will wake up to check if the buffer is running
+            empty - increasing this time will increase efficiency, but risk the buffer running empty */
+    int period_time;
+
+    /** Format of the frames that are send to the ALSA buffer */
+    snd_pcm_format_t format;
+
+    /** Name of the device - this name indicates ALSA to which physical device it must send
+                     audio - the default devices can be used by assigning this variable to "default" */
+    char *alsa_device_name;
+
+    /** Some pointer to custom set data*/
+    void *my_custom_data;
+
+    /** Callback function that will be called whenever the internal buffer is running
+                                    empty and new audio samples are required */
+    int (*data_callback)(int amount_of_frames, void *audio_buffer, sa_device *sa_device,
+                         void *my_custom_data);
+
+    /** Callback function that will be called whenever the other callback function fails to provide more samples */
+    void (*eof_callback)(sa_device *sa_device, void *my_custom_data);
+
+    /** Name that will show in the alsamixer */
+    char *device_name;
+
+    /** Defines when the PCM starts playing - the buffer is always prefilled in one callback before this point */
+    sa_start_policy start_policy;
+
+    /** Amount of frames after which the PCM starts when start_policy is SA_START_AFTER_FRAMES */
+    int start_threshold;
+
+    /** When true the data callback is asked for all writable frames (up to the buffer size) on every wakeup
+     * instead of exactly one period - this catches up in one call after a late wakeup */
+    bool bulk_fill;
+
+    /** Fixed buffering, a dual deep buffer / low latency profile that can be switched at runtime, or a fill level
+     * that adapts to the xruns */
+    sa_latency_profile latency_profile;
+
+    /** The mode a SA_LATENCY_PROFILE_DUAL device starts in */
+    sa_latency_mode latency_mode;
+
+    /** Defines the amount of audio (in µs) kept in the buffer in SA_LATENCY_MODE_LOW, never less than two periods so
+     * a period can be written while the previous one plays */
+    int low_latency_time;
+
+    /** Defines the amount of audio (in µs) left in the buffer when the thread wakes up in SA_LATENCY_MODE_DEEP */
+    int deep_wakeup_time;
+
+    /** Defines the lowest amount of audio (in µs) the adaptive profile keeps in the buffer, never less than two
+     * periods so a period can be written while the previous one plays */
+    int adaptive_min_time;
+
+    /** Defines the highest amount of audio (in µs) the adaptive profile keeps in the buffer, 0 allows the whole
+     * buffer - playback starts at this level */
+    int adaptive_max_time;
+
+    /** Defines how long (in µs) playback must run without xruns or missed deadlines before the adaptive fill level
+     * is lowered by one period */
+    int adaptive_stable_time;
+
+    /** Optional callback that is called when frames that were already rendered are taken back from the ALSA
+     * buffer (on a switch to SA_LATENCY_MODE_LOW), the source must seek back by amount_of_frames so they are
+     * rendered again - without it nothing is rewound and the switch takes effect as the deep buffer drains */
+    void (*rewind_callback)(int amount_of_frames, sa_device *sa_device, void *my_custom_data);
+
+    /** When non zero, the data callback must return this many µs before the ALSA buffer runs empty (measured
+     * with snd_pcm_avail_delay()) - otherwise a fallback block is written so the PCM keeps running */
+    int deadline_margin;
+
+    /** What is written when the data callback misses its deadline */
+    sa_deadline_fallback deadline_fallback;
+
+    /** Defines the length (in µs) of one fallback block */
+    int deadline_fallback_time;
+
+    /** Directory of the device capability cache, NULL disables it - with a cache the configuration is checked
+     * against the known capabilities of the card before any parameter is negotiated, and the buffer and period
+     * sizes found by the first init are set directly by later ones */
+    char *device_cache_dir;
+
+    /** Optional device that is opened when alsa_device_name is lost and cannot be reopened, NULL only retries
+     * alsa_device_name - the fallback must support the same format, rate and channel count */
+    char *fallback_device_name;
+
+    /** Defines the time (in µs) between two attempts to reopen a lost PCM */
+    int reconnect_interval;
+
+    /** When non zero the data callback runs on a worker thread up to this many periods ahead of playback (2 for
+     * double, 3 for triple buffering) and the playback thread only copies rendered periods - a slow callback is
+     * absorbed by the periods rendered ahead, at the cost of that much extra latency */
+    int pipeline_depth;
+
+    /** When set, the peak and RMS of every period are published for sa_get_levels() - supported formats:
+     * S16_LE, S24_3LE, S32_LE and FLOAT_LE */
+    bool metering;
+
+    /** When non zero (a power of two up to SA_MAX_SPECTRUM_SIZE) the output is copied to a worker thread that
+     * computes a spectrum of this many samples for sa_get_spectrum(), 0 disables it - not available for devices
+     * initialized with sa_init_device_static() */
+    int spectrum_size;
+
+    /** When non zero, the PCM is stopped once the data callback returned this long (in µs) - and at least a whole
+     * buffer - of digital silence, so the CPU and codec can sleep. The callback is then asked for
+     * silence_check_interval worth of audio every silence_check_interval, silent audio is discarded and the PCM
+     * restarts on the first frames that are not silent */
+    int silence_timeout;
+
+    /** Defines how often (in µs) the data callback is checked while the PCM is stopped on silence, this bounds
+     * the extra start latency of a live source */
+    int silence_check_interval;
+};
+
+/*************************************************************************************************************************************************************/
+/*************************************************************************************************************************************************************/
+/*****************************************************************DECLARATIONS/DEFINITIONS*********************************************************************/
+/*************************************************************************************************************************************************************/
+/*************************************************************************************************************************************************************/
+
+/** Prevent parsers from greying out the following */
+#if defined(__INTELLISENSE__) || defined(Q_CREATOR_RUN)
+    #define SA_IMPLEMENTATION
+#endif
+
+#if defined SA_IMPLEMENTATION
+/*=========================== API DECLARATIONS ===========================*/
+/**
+ * @brief creates an sa_device_config struct and sets it to default values
+ * @param device - empty pointer into which the config struct is set
+ * @return sa_return_status
+ */
+extern sa_result sa_init_device_config(sa_device_config **config);
+
+/**
+ * @brief initializes a new audio device
+ * @param config - configuration used to initialize the device
+ * @param device - pointer to the initialized audio device
+ * @return sa_return_status
+ */
+extern sa_result sa_init_device(sa_device_config *config, sa_device **device);
+
+/**
+ * @brief starts the simple ALSA device - which starts the callback loop
+ * This function will block untill the device is actually stopped.
+
+ * @param device - device to start
+ * @return sa_return_status
+ */
+extern sa_result sa_start_device(sa_device *device);
+
+/**
+ * @brief pauses the simple ALSA device - which pauses the callback loop
  *
+ * @param device - device to pause
+ * @return sa_return_status
  */
-static void *init_playback_thread(void *data);
+extern sa_result sa_pause_device(sa_device *device);
+
+    #ifdef SA_ASYNC_API
 
 /**
- * @brief Attempts to join the playback thread
+ * @brief stops a simple ALSA device - same as pause but in addition, all buffer data is dropped
+ * This function will return directly which means there is no guarantee about the state after a call to this function
  *
- * @param device
- * @return sa_result
+ * @param device - device to stop
+ * @return sa_return_status
  */
-static sa_result close_playback_thread(sa_device *device);
+extern sa_result sa_stop_device_async(sa_device *device);
 
 /**
- * @brief Prepares and starts write_and_poll_loop
+ * @brief starts the simple ALSA device - which starts the callback loop
+ * This function will return directly which means there is no guarantee about the state after a call to this function
+ * @param device - device to start
+ * @return sa_return_status
+ */
+extern sa_result sa_start_device_async(sa_device *device);
+
+    #endif
+
+    #ifdef SA_STATIC_ALLOC
+
+/**
+ * @brief fills a user supplied sa_device_config struct with the default values, without allocating
+ * @param config - the struct to fill
+ * @return sa_return_status
+ */
+extern sa_result sa_default_device_config(sa_device_config *config);
+
+/**
+ * @brief returns the size of the memory block needed by sa_init_device_static() for the given configuration
+ * The ALSA buffer size is only known after negotiation, so room is reserved for the requested buffer time
+ * rounded up to the next power of two in frames
+ * @param config
+ * @return size_t - amount of bytes
+ */
+extern size_t sa_get_static_memory_size(sa_device_config *config);
+
+/**
+ * @brief initializes a new audio device inside a user supplied memory block - the device, a copy of the
+ * configuration and the sample buffer all live in this block and the library never frees it
+ * @param config - configuration used to initialize the device, it is copied so it may live on the stack
+ * @param memory - block aligned to SA_MEMORY_ALIGNMENT that outlives the device
+ * @param memory_size - size of the block, see sa_get_static_memory_size()
+ * @param device - pointer to the initialized audio device
+ * @return sa_return_status
+ */
+extern sa_result sa_init_device_static(sa_device_config *config, void *memory, size_t memory_size,
+                                       sa_device **device);
+
+    #endif
+
+/**
+ * @brief stops a simple ALSA device - same sa_stop_device, but blocks until the devices has actually stopped
+ * This function will block untill the device is actually stopped.
  *
- * @param device
- * @param pipe_read_end_fd
- * @return sa_result
+ * @param device - device to stop
+ * @return sa_return_status
  */
-static sa_result start_write_and_poll_loop(sa_device *device, struct pollfd *pipe_read_end_fd);
+extern sa_result sa_stop_device(sa_device *device);
 
 /**
- * @brief Plays audio by repeatedly calling the callback function for framas
+ * @brief destroys the device - device pointer is set to NULL
  *
- * @param device
- * @param poll_manager
- * @return sa_result
+ * @param device - the device to destroy
+ * @return sa_return_status
  */
-static sa_result write_and_poll_loop(sa_device *device, sa_poll_management *poll_manager);
+extern sa_result sa_destroy_device(sa_device *device);
 
 /**
- * @brief Waits on poll and checks pipe
+ * @brief function used to retrieve the device state in a thread safe manner
  *
- * @param handle
- * @param poll_manager
- * @return int
+ * @param device
+ * @return sa_device_state
  */
-static int wait_for_poll(sa_device *device, sa_poll_management *poll_manager);
+extern sa_device_state sa_get_device_state(sa_device *device);
 
 /**
- * @brief Try to recover from errors during playback
+ * @brief function used to retrieve a copy of the playback statistics in a thread safe manner
  *
- * @param handle
- * @param err
+ * @param device
+ * @param stats - struct into which the statistics are copied
  * @return sa_result
  */
-static sa_result xrun_recovery(snd_pcm_t *handle, int err);
+extern sa_result sa_get_device_stats(sa_device *device, sa_device_stats *stats);
 
 /**
- * @brief reclaims sa_device
+ * @brief sets the same software gain on every channel - the gain is applied to the frames returned by the data
+ * callback, 1.0 leaves them untouched. Supported formats: S16_LE, S24_3LE, S32_LE and FLOAT_LE
  *
  * @param device
+ * @param gain - linear gain factor
  * @return sa_result
  */
-static sa_result cleanup_device(sa_device *device);
+extern sa_result sa_set_software_gain(sa_device *device, float gain);
 
 /**
- * @brief Messages a char to the playback thread via a pipe
+ * @brief sets the software gain of a single channel
  *
  * @param device
- * @param toSend
+ * @param channel - index in [0; channels[
+ * @param gain - linear gain factor
  * @return sa_result
  */
-static sa_result message_pipe(sa_device *device, char toSend);
+extern sa_result sa_set_channel_gain(sa_device *device, int channel, float gain);
 
 /**
- * @brief Pauses the callback loop, this function will pause the PCM handle by calling pause_PCM_handle().
- * After that it will block and wait for further commands from the message pipe.
+ * @brief switches a device with the SA_LATENCY_PROFILE_DUAL profile between deep buffering and low latency
+ * while it keeps playing - switching to low latency rewinds the frames beyond the low latency fill level
  *
- * @param poll_manager
- * @param handle
+ * @param device
+ * @param mode
  * @return sa_result
  */
-static sa_result pause_callback_loop(sa_poll_management *poll_manager, sa_device *device);
+extern sa_result sa_set_latency_mode(sa_device *device, sa_latency_mode mode);
 
 /**
- * @brief Saves the device state and signals if it has stopped
+ * @brief Applies an event at an exact frame: the playback thread splits the period at that frame, so automation
+ * is not rounded to periods. This is lock-free and can be called from any thread, also while the device is stopped.
+ * Events at the same frame are applied in the order they were posted. With pipeline_depth set the data callback
+ * runs ahead on the worker, so SA_EVENT_CALLBACK changes to what it renders land that many periods late
  *
  * @param device
- * @param new_state
- * @return void
+ * @param event - copied, it can be reused right away
+ * @param frame - stream position (see sa_get_stream_position()) of the first frame the event applies to, a
+ * position that was already rendered applies the event before the next frame
+ * @return sa_result - SA_ERROR when the event is invalid or the queue is full
  */
-static void save_device_state(sa_device *device, sa_device_state new_state);
+extern sa_result sa_post_event(sa_device *device, const sa_event *event, unsigned long long frame);
+
 /**
- * @brief Checks whether the hardware support pausing, if so it pauses using snd_pcm_pause(). If the hw does
- * not support pausing it uses snd_pcm_drop() and prepares the the device using snd_pcm_prepare().
+ * @brief Same as sa_post_event(), but the event applies to the frame that is audible at a CLOCK_MONOTONIC time.
+ * The frame is estimated from the ALSA delay when the playback thread picks the event up
  *
  * @param device
+ * @param event
+ * @param time - CLOCK_MONOTONIC time
  * @return sa_result
  */
-static sa_result pause_PCM_handle(sa_device *device);
+extern sa_result sa_post_event_at_time(sa_device *device, const sa_event *event, const struct timespec *time);
 
 /**
- * @brief Checks whether the pcm was paused using snd_pcm_pause() or not and resume the pcm accordingly.
+ * @brief Returns the stream position: the amount of frames rendered since the device was initialized. Frames are
+ * rendered ahead of playback, the frame that is audible right now is the position minus the ALSA delay
  *
  * @param device
- * @return sa_result
+ * @return unsigned long long
  */
-static sa_result unpause_PCM_handle(sa_device *device);
+extern unsigned long long sa_get_stream_position(sa_device *device);
 
 /**
- * @brief Prepares the ALSA device so it is ready for a restart
+ * @brief Opens a PCM and reports its formats, rates, channel counts, period and buffer ranges and pause support
  *
- * @param device
+ * @param alsa_device_name
+ * @param info - the capabilities are returned here
  * @return sa_result
  */
-static sa_result prepare_alsa_device(sa_device *device);
+extern sa_result sa_probe_device(const char *alsa_device_name, sa_device_info *info);
 
 /**
- * @brief Destroys the ALSA device, closes threads and frees all allocated memory
+ * @brief Lists every playback PCM from the ALSA device hints together with its capabilities
  *
- * @param device
+ * @param cache_dir - directory of the device cache, PCMs of a known card are not opened again, NULL always probes
+ * @param devices - an array that must be freed with free() is returned here
+ * @param count - the amount of devices is returned here
  * @return sa_result
  */
-static sa_result destroy_alsa_device(sa_device *device);
+extern sa_result sa_enumerate_devices(const char *cache_dir, sa_device_info **devices, int *count);
 
 /**
- * @brief Function used to set the device state - thread safe
+ * @brief Checks a format against the probed capabilities
  *
- * @param device
- * @param state
+ * @param info
+ * @param format
+ * @return bool
  */
-static void sa_set_device_state(sa_device *device, sa_device_state state);
-
-/*========================= API DEFINITIONS ==========================*/
-extern sa_result sa_init_device_config(sa_device_config **config) {
-    sa_device_config *config_temp = (sa_device_config *) malloc(sizeof(sa_device_config));
-    if(!config_temp)
-        return SA_ERROR;
+extern bool sa_device_supports_format(const sa_device_info *info, snd_pcm_format_t format);
 
-    config_temp->sample_rate      = DEFAULT_SAMPLE_RATE;
-    config_temp->channels         = DEFAULT_NUMBER_OF_CHANNELS;
-    config_temp->buffer_time      = DEFAULT_BUFFER_TIME;
-    config_temp->period_time      = DEFAULT_PERIOD_TIME;
-    config_temp->format           = DEFAULT_AUDIO_FORMAT;
-    config_temp->alsa_device_name = (char *) "default";
-    config_temp->data_callback    = NULL;
-    config_temp->device_name      = (char *) "simpleALSA";
-    *config                       = config_temp;
-    return SA_SUCCESS;
-}
+/**
+ * @brief Creates a mixer that owns one sa_device, sources are summed into its period buffer - the data_callback,
+ * eof_callback and my_custom_data fields of config are taken over by the mixer
+ *
+ * @param config - describes the device, the format must be S16_LE, S24_3LE, S32_LE or FLOAT_LE
+ * @param mixer - the mixer is returned here
+ * @return sa_result
+ */
+extern sa_result sa_init_mixer(sa_device_config *config, sa_mixer **mixer);
 
-extern sa_result sa_init_device(sa_device_config *config, sa_device **device) {
-    sa_device *device_temp = (sa_device *) malloc(sizeof(sa_device));
-    if(!device_temp)
-        return SA_ERROR;
+/**
+ * @brief Returns the device of the mixer, it is started, paused and stopped with the regular device API
+ *
+ * @param mixer
+ * @return sa_device*
+ */
+extern sa_device *sa_get_mixer_device(sa_mixer *mixer);
 
-    device_temp->config = config;
-    device_temp->state  = SA_DEVICE_STOPPED;
-    *device             = device_temp;
+/**
+ * @brief Destroys the device of the mixer and frees every source
+ *
+ * @param mixer
+ * @return sa_result
+ */
+extern sa_result sa_destroy_mixer(sa_mixer *mixer);
+
+/**
+ * @brief Adds a callback source, this is lock-free and can be done while the device plays
+ *
+ * @param mixer
+ * @param callback - called on the playback thread for every period
+ * @param my_custom_data - passed to the callback
+ * @param source_id - identifies the source in the other mixer functions
+ * @return sa_result
+ */
+extern sa_result sa_mixer_add_source(sa_mixer *mixer, sa_mixer_callback callback, void *my_custom_data,
+                                     int *source_id);
+
+/**
+ * @brief Adds a ring source that is fed with sa_mixer_write() from one producer thread
+ *
+ * @param mixer
+ * @param ring_frames - capacity of the ring, rounded up to a power of two
+ * @param source_id - identifies the source in the other mixer functions
+ * @return sa_result
+ */
+extern sa_result sa_mixer_add_ring_source(sa_mixer *mixer, int ring_frames, int *source_id);
+
+/**
+ * @brief Copies interleaved frames into the ring of a source, it never blocks. It is safe to call while the source
+ * is being removed, the frames are dropped then.
+ *
+ * @param mixer
+ * @param source_id
+ * @param frames
+ * @param amount_of_frames
+ * @return int - the amount of frames that fit in the ring, -1 when source_id is not an active ring source
+ */
+extern int sa_mixer_write(sa_mixer *mixer, int source_id, const sa_mix_sample *frames, int amount_of_frames);
+
+/**
+ * @brief Removes a source - when this returns the playback thread no longer touches it, so its custom data may be
+ * freed. This waits for at most one period when the source is being mixed right now, and for a sa_mixer_write()
+ * that is copying into the ring.
+ *
+ * @param mixer
+ * @param source_id
+ * @return sa_result
+ */
+extern sa_result sa_mixer_remove_source(sa_mixer *mixer, int source_id);
+
+/**
+ * @brief Sets the gain and pan of a source
+ *
+ * @param mixer
+ * @param source_id
+ * @param gain - linear gain
+ * @param pan - between [-1;1] from left to right, only used by stereo mixers
+ * @return sa_result
+ */
+extern sa_result sa_mixer_set_source_gain(sa_mixer *mixer, int source_id, float gain, float pan);
+
+/**
+ * @brief Creates a sampler and adds it as a source to the mixer
+ *
+ * @param mixer
+ * @param sampler - the sampler is returned here
+ * @return sa_result
+ */
+extern sa_result sa_init_sampler(sa_mixer *mixer, sa_sampler **sampler);
+
+/**
+ * @brief Removes the sampler from its mixer and frees every clip
+ *
+ * @param sampler
+ * @return sa_result
+ */
+extern sa_result sa_destroy_sampler(sa_sampler *sampler);
+
+/**
+ * @brief Copies a clip into the sampler, this allocates and must not be called from the playback thread
+ *
+ * @param sampler
+ * @param frames - interleaved frames (float in [-1;1], or Q31 with SA_FIXED_POINT) with the channel count of the
+ * mixer
+ * @param amount_of_frames
+ * @param clip_id - identifies the clip in sa_sampler_trigger()
+ * @return sa_result
+ */
+extern sa_result sa_sampler_load_clip(sa_sampler *sampler, const sa_mix_sample *frames, int amount_of_frames,
+                                      int *clip_id);
+
+/**
+ * @brief Plays a clip, this is lock-free and can be called from any thread - when every voice is busy the oldest
+ * one is stolen
+ *
+ * @param sampler
+ * @param clip_id
+ * @param gain - linear gain
+ * @param pan - between [-1;1] from left to right, only used by stereo mixers
+ * @param at_frame - sampler time (see sa_sampler_get_frame_time()) of the first frame, 0 or a time in the past
+ * plays at the start of the next period
+ * @return sa_result - SA_ERROR when the trigger queue is full
+ */
+extern sa_result sa_sampler_trigger(sa_sampler *sampler, int clip_id, float gain, float pan,
+                                    unsigned long long at_frame);
+
+/**
+ * @brief Returns the sampler clock: the amount of frames that have been rendered
+ *
+ * @param sampler
+ * @return unsigned long long
+ */
+extern unsigned long long sa_sampler_get_frame_time(sa_sampler *sampler);
+
+/**
+ * @brief Creates a cache and starts its worker thread, one cache is meant to be shared by every device
+ *
+ * @param memory_budget - in bytes, unreferenced buffers are evicted least recently used first beyond this
+ * @param decoder - decodes an asset, e.g. with libsndfile
+ * @param my_custom_data - passed to the decoder
+ * @param cache - the cache is returned here
+ * @return sa_result
+ */
+extern sa_result sa_init_cache(size_t memory_budget, sa_cache_decoder decoder, void *my_custom_data,
+                               sa_cache **cache);
+
+/**
+ * @brief Stops the worker and frees every buffer, no entry may be referenced anymore
+ *
+ * @param cache
+ * @return sa_result
+ */
+extern sa_result sa_destroy_cache(sa_cache *cache);
+
+/**
+ * @brief Queues an asset for decoding on the worker without referencing it
+ *
+ * @param cache
+ * @param name
+ * @param format
+ * @param channels
+ * @return sa_result
+ */
+extern sa_result sa_cache_prefetch(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels);
+
+/**
+ * @brief Returns a referenced entry for an asset, it is decoded on the worker when it is not cached yet
+ *
+ * @param cache
+ * @param name
+ * @param format
+ * @param channels
+ * @param wait - block until the entry is decoded
+ * @param entry - the entry is returned here, release it with sa_cache_release()
+ * @return sa_result - SA_ERROR when wait is set and decoding failed, no reference is held then and the next acquire
+ * decodes the asset again
+ */
+extern sa_result sa_cache_acquire(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels,
+                                  bool wait, sa_cache_entry **entry);
+
+/**
+ * @brief Drops a reference, the entry stays cached until it is evicted - an entry that failed to decode is dropped
+ * with its last reference so the next acquire retries it
+ *
+ * @param cache
+ * @param entry
+ */
+extern void sa_cache_release(sa_cache *cache, sa_cache_entry *entry);
+
+/**
+ * @brief Opens a source that plays a cached asset without decoding or copying it again - until the asset is
+ * decoded the source plays silence
+ *
+ * @param cache
+ * @param name
+ * @param format - must match the device
+ * @param channels - must match the device
+ * @param source
+ * @return sa_result
+ */
+extern sa_result sa_open_cache_source(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels,
+                                      sa_cache_source *source);
+
+/**
+ * @brief Releases the entry of the source
+ *
+ * @param source
+ */
+extern void sa_close_cache_source(sa_cache_source *source);
+
+/**
+ * @brief A data_callback that plays an sa_cache_source passed as my_custom_data, it returns 0 at the end of the
+ * asset so the eof_callback fires - reset source->position to play it again
+ *
+ * @param amount_of_frames
+ * @param audio_buffer
+ * @param device
+ * @param my_custom_data - the sa_cache_source
+ * @return int
+ */
+extern int sa_cache_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                    void *my_custom_data);
+
+/**
+ * @brief Maps a sample bank file written by tools/sa_bank_pack.c, the assets are paged in lazily when they are played
+ *
+ * @param path
+ * @param bank - the bank is returned here
+ * @return sa_result
+ */
+extern sa_result sa_open_bank(const char *path, sa_bank **bank);
+
+/**
+ * @brief Unmaps the bank, no source of it may be playing anymore
+ *
+ * @param bank
+ */
+extern void sa_close_bank(sa_bank *bank);
+
+/**
+ * @brief Looks up an asset by name
+ *
+ * @param bank
+ * @param name
+ * @return const sa_bank_entry* - NULL when the bank has no such asset
+ */
+extern const sa_bank_entry *sa_bank_find(sa_bank *bank, const char *name);
+
+/**
+ * @brief Hints the kernel to read an asset ahead (MADV_WILLNEED) so it does not fault when it starts playing
+ *
+ * @param bank
+ * @param entry
+ * @return sa_result
+ */
+extern sa_result sa_bank_will_need(sa_bank *bank, const sa_bank_entry *entry);
+
+/**
+ * @brief Opens a source that plays an asset straight from the mapping, the asset is hinted with
+ * sa_bank_will_need()
+ *
+ * @param bank
+ * @param name
+ * @param source
+ * @return sa_result
+ */
+extern sa_result sa_open_bank_source(sa_bank *bank, const char *name, sa_bank_source *source);
+
+/**
+ * @brief A data_callback that plays an sa_bank_source passed as my_custom_data, it returns 0 at the end of the
+ * asset so the eof_callback fires - reset source->position to play it again
+ *
+ * @param amount_of_frames
+ * @param audio_buffer
+ * @param device
+ * @param my_custom_data - the sa_bank_source
+ * @return int
+ */
+extern int sa_bank_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                   void *my_custom_data);
+
+/**
+ * @brief Creates a ring in a sealed memfd that another process fills through an sa_shm_writer, the format is
+ * stored in the header so the producer can check it
+ *
+ * @param format
+ * @param channels
+ * @param sample_rate
+ * @param capacity_frames - size of the ring, a power of two
+ * @param source - the source is returned here
+ * @return sa_result
+ */
+extern sa_result sa_create_shm_source(snd_pcm_format_t format, int channels, unsigned int sample_rate,
+                                      int capacity_frames, sa_shm_source **source);
+
+/**
+ * @brief Unmaps the ring and closes the fds, the device may not be playing the source anymore
+ *
+ * @param source
+ */
+extern void sa_destroy_shm_source(sa_shm_source *source);
+
+/**
+ * @brief A data_callback that plays an sa_shm_source passed as my_custom_data - an empty ring plays silence and is
+ * counted as an underrun, once the producer closed the ring and it ran empty 0 is returned so the eof_callback fires
+ *
+ * @param amount_of_frames
+ * @param audio_buffer
+ * @param device
+ * @param my_custom_data - the sa_shm_source
+ * @return int
+ */
+extern int sa_shm_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                  void *my_custom_data);
+
+/**
+ * @brief Returns the amount of silent frames played because the producer did not keep up
+ *
+ * @param source
+ * @return unsigned long long
+ */
+extern unsigned long long sa_shm_source_underruns(sa_shm_source *source);
+
+/**
+ * @brief Maps the ring of an sa_shm_source in the producer process and validates its header
+ *
+ * @param memfd
+ * @param eventfd
+ * @param writer - the writer is returned here
+ * @return sa_result
+ */
+extern sa_result sa_open_shm_writer(int memfd, int eventfd, sa_shm_writer **writer);
+
+/**
+ * @brief Unmaps the ring, with end_of_stream the source plays what is left and then reports the end
+ *
+ * @param writer
+ * @param end_of_stream
+ */
+extern void sa_close_shm_writer(sa_shm_writer *writer, bool end_of_stream);
+
+/**
+ * @brief Returns the contiguous free part of the ring, the producer renders into it directly and publishes the
+ * frames with sa_shm_commit_write()
+ *
+ * @param writer
+ * @param region - start of the free part
+ * @return int - amount of free frames in the region, 0 when the ring is full
+ */
+extern int sa_shm_begin_write(sa_shm_writer *writer, void **region);
+
+/**
+ * @brief Makes frames rendered into the region of sa_shm_begin_write() visible to the playback thread
+ *
+ * @param writer
+ * @param amount_of_frames
+ */
+extern void sa_shm_commit_write(sa_shm_writer *writer, int amount_of_frames);
+
+/**
+ * @brief Copies frames into the ring without blocking
+ *
+ * @param writer
+ * @param frames
+ * @param amount_of_frames
+ * @return int - amount of frames copied
+ */
+extern int sa_shm_write(sa_shm_writer *writer, const void *frames, int amount_of_frames);
+
+/**
+ * @brief Sleeps on the eventfd until the playback thread freed room in the ring
+ *
+ * @param writer
+ * @param timeout_ms - -1 waits forever
+ * @return sa_result - SA_SUCCESS when there is room, SA_ERROR on a timeout
+ */
+extern sa_result sa_shm_wait_writable(sa_shm_writer *writer, int timeout_ms);
+
+/**
+ * @brief copies the peak and RMS per channel of the last period that was written, needs metering in the config
+ *
+ * @param device
+ * @param levels - the levels are returned here
+ * @return sa_result
+ */
+extern sa_result sa_get_levels(sa_device *device, sa_levels *levels);
+
+/**
+ * @brief copies the latest magnitude spectrum of the output, bin k is centered on k * sample_rate / spectrum_size Hz
+ * and a full scale sine reads 1.0 - needs spectrum_size in the config
+ *
+ * @param device
+ * @param magnitudes - receives up to amount_of_bins magnitudes
+ * @param amount_of_bins - at most spectrum_size / 2 bins are copied
+ * @return int - amount of bins copied, 0 when the spectrum is off
+ */
+extern int sa_get_spectrum(sa_device *device, float *magnitudes, int amount_of_bins);
+
+    #ifdef SA_SIMULATE_DEVICE_LOSS
+
+/**
+ * @brief makes the next write of the playback thread fail as if the PCM was unplugged, so the device loss
+ * recovery can be tested without hardware
+ *
+ * @param device
+ * @param failed_reopens - amount of reopen attempts that fail before the PCM comes back
+ * @return sa_result
+ */
+extern sa_result sa_simulate_device_loss(sa_device *device, int failed_reopens);
+
+    #endif
+
+    #ifdef SA_TRACE
+
+/**
+ * @brief starts recording a timeline of the playback thread, a background thread writes it as Chrome
+ * trace-event JSON (chrome://tracing or ui.perfetto.dev) to the given path
+ *
+ * @param device
+ * @param path - file to write
+ * @return sa_result
+ */
+extern sa_result sa_start_trace(sa_device *device, const char *path);
+
+/**
+ * @brief stops recording, writes the remaining events and closes the file
+ *
+ * @param device
+ * @return sa_result
+ */
+extern sa_result sa_stop_trace(sa_device *device);
+
+/*========================== TRACE DECLARATIONS ==========================*/
+/**
+ * @brief Stores one event in the trace ring, only called from the playback thread
+ *
+ * @param device
+ * @param type
+ * @param phase - 'B', 'E' or 'i'
+ * @param arg
+ */
+static void sa_trace_record(sa_device *device, sa_trace_type type, char phase, int arg);
+
+/**
+ * @brief Writes all events in the ring to the trace file
+ *
+ * @param device
+ */
+static void sa_trace_drain(sa_device *device);
+
+/**
+ * @brief The flush thread, drains the ring every SA_TRACE_FLUSH_INTERVAL_US
+ *
+ * @param data: the sa_device
+ */
+static void *sa_trace_flush_thread(void *data);
+
+    #endif
+
+/**
+ * @brief moves logging off the calling threads: messages are copied into a preallocated lock-free ring and a
+ * background thread hands them to the sink, so logging from the playback thread never blocks on stdout
+ *
+ * @param sink - called for every message, NULL uses the default colored stdout output
+ * @param user_data - passed to the sink
+ * @return sa_result
+ */
+extern sa_result sa_start_async_logging(sa_log_sink sink, void *user_data);
+
+/**
+ * @brief stops the log thread after handing the remaining messages to the sink, logging is synchronous again
+ *
+ * @return sa_result
+ */
+extern sa_result sa_stop_async_logging(void);
+
+/*=========================== LOG DECLARATIONS ===========================*/
+/**
+ * @brief one message in the asynchronous log ring
+ */
+typedef struct
+{
+    /** Slot sequence number of the bounded multi producer queue */
+    unsigned int sequence;
+    sa_log_type type;
+    char message[SA_LOG_MESSAGE_SIZE];
+} sa_log_entry;
+
+/**
+ * @brief the process wide asynchronous log ring, any thread may produce, the log thread consumes
+ */
+typedef struct
+{
+    sa_log_entry entries[SA_LOG_CAPACITY];
+    unsigned int enqueue_position;
+    unsigned int dequeue_position;
+    /** Non zero while the log thread runs */
+    int active;
+    /** Messages lost because the ring was full */
+    unsigned long dropped;
+    pthread_t thread;
+    sa_log_sink sink;
+    void *user_data;
+} sa_log_queue;
+
+static sa_log_queue sa_async_log;
+
+static void sa_log(sa_log_type type, const char msg0[], const char msg1[]);
+
+/**
+ * @brief Joins msg0 and msg1 into a bounded buffer without formatting
+ *
+ * @param buffer - SA_LOG_MESSAGE_SIZE bytes
+ * @param msg0
+ * @param msg1
+ */
+static void sa_log_compose(char *buffer, const char msg0[], const char msg1[]);
+
+/**
+ * @brief The default sink, prints a colored line to stdout
+ *
+ * @param type
+ * @param message
+ * @param user_data
+ */
+static void sa_log_print(sa_log_type type, const char *message, void *user_data);
+
+/**
+ * @brief Hands all queued messages to the sink
+ */
+static void sa_log_drain(void);
+
+/**
+ * @brief The log thread
+ *
+ * @param data: unused
+ */
+static void *sa_log_thread(void *data);
+
+/*======================== ALSA FUNC DECLARATIONS ========================*/
+/**
+ * @brief Fills a config struct with the default values
+ *
+ * @param config
+ */
+static void set_default_config(sa_device_config *config);
+
+/**
+ * @brief Sets the fields of a freshly created sa_device
+ *
+ * @param device
+ * @param config
+ */
+static void init_device_fields(sa_device *device, sa_device_config *config);
+
+/**
+ * @brief Rounds a size up to a multiple of SA_MEMORY_ALIGNMENT
+ *
+ * @param size
+ * @return size_t
+ */
+static size_t sa_align_size(size_t size);
+
+/**
+ * @brief Points device->samples to a buffer that can hold buffer_size frames, either inside the static
+ * memory block or on the heap
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result allocate_sample_buffer(sa_device *device);
+
+/**
+ * @brief Initialized an ALSA device and store some settings in de sa_device
+ *
+ * @return sa_result
+ */
+static sa_result init_alsa_device(sa_device *device);
+
+/**
+ * @brief Closes the PCM and frees the samples after init_alsa_device() failed
+ *
+ * @param device
+ * @return sa_result - always SA_ERROR
+ */
+static sa_result abort_init_alsa_device(sa_device *device);
+
+/**
+ * @brief Checks the configuration against the cached capabilities of the card, the PCM is probed and cached
+ * when its card is not known yet
+ *
+ * @param device
+ * @param info - the capabilities are returned here, card_id is empty and probed 0 when they are unknown
+ * @return sa_result
+ */
+static sa_result check_device_capabilities(sa_device *device, sa_device_info *info);
+
+/**
+ * @brief Sets the buffer and period size a previous init negotiated for the same request, with one refinement per
+ * parameter and no near-search
+ *
+ * @param device
+ * @param access
+ * @param info - the cached capabilities of the PCM
+ * @return sa_result - SA_ERROR when nothing matching is cached or the PCM refuses the sizes, the caller negotiates
+ * then
+ */
+static sa_result set_cached_hardware_parameters(sa_device *device, snd_pcm_access_t access,
+                                                const sa_device_info *info);
+
+/**
+ * @brief Stores the sizes set_hardware_parameters() negotiated in the cache record of the PCM
+ *
+ * @param device
+ * @param info - the cached capabilities of the PCM
+ * @param buffer_time - requested buffer time, before the negotiation rounded it
+ * @param period_time - requested period time, before the negotiation rounded it
+ */
+static void remember_hardware_parameters(sa_device *device, sa_device_info *info, unsigned int buffer_time,
+                                         unsigned int period_time);
+
+/**
+ * @brief Fills in the capabilities of an open PCM
+ *
+ * @param handle
+ * @param info
+ * @return sa_result
+ */
+static sa_result probe_pcm_handle(snd_pcm_t *handle, sa_device_info *info);
+
+/**
+ * @brief Finds the card ID of a PCM, from the CARD= argument of its name or else from the open handle
+ *
+ * @param name
+ * @param handle - may be NULL
+ * @param card_id - 32 bytes
+ * @return bool - false for PCMs without a card
+ */
+static bool get_pcm_card_id(const char *name, snd_pcm_t *handle, char *card_id);
+
+/**
+ * @brief Reads the cached PCMs of a card, the cache is ignored when it was written for another card with the
+ * same ID
+ *
+ * @param cache_dir
+ * @param card_id
+ * @param infos - an array that must be freed with free() is returned here
+ * @param count
+ * @return sa_result - SA_ERROR when there is no valid cache for the card
+ */
+static sa_result load_device_cache(const char *cache_dir, const char *card_id, sa_device_info **infos,
+                                   int *count);
+
+/**
+ * @brief Looks up one PCM in the cache
+ *
+ * @param cache_dir
+ * @param info - name and card_id must be set, the capabilities are filled in
+ * @return sa_result - SA_ERROR on a cache miss
+ */
+static sa_result lookup_device_cache(const char *cache_dir, sa_device_info *info);
+
+/**
+ * @brief Adds or replaces one PCM in the cache file of its card, the file is replaced atomically
+ *
+ * @param cache_dir
+ * @param info
+ * @return sa_result
+ */
+static sa_result update_device_cache(const char *cache_dir, const sa_device_info *info);
+
+/**
+ * @brief Builds the path of a cache file
+ *
+ * @param cache_dir
+ * @param card_id
+ * @param suffix - appended to the file name
+ * @param path - PATH_MAX bytes
+ */
+static void get_device_cache_path(const char *cache_dir, const char *card_id, const char *suffix, char *path);
+
+/**
+ * @brief Returns the long name of a card, it identifies the hardware behind a card ID
+ *
+ * @param card_id
+ * @param longname - 80 bytes
+ * @return sa_result
+ */
+static sa_result get_card_longname(const char *card_id, char *longname);
+
+/**
+ * @brief Sets the ALSA hardware parameters
+ *
+ * @param device
+ * @param access
+ * @return sa_result
+ */
+static sa_result set_hardware_parameters(sa_device *device, snd_pcm_access_t access);
+
+/**
+ * @brief Sets the ALSA software parameters
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result set_software_parameters(sa_device *device);
+
+/**
+ * @brief Translates the configured start policy into an ALSA start threshold
+ *
+ * @param device
+ * @return snd_pcm_uframes_t
+ */
+static snd_pcm_uframes_t get_start_threshold(sa_device *device);
+
+/**
+ * @brief Prepares and starts the playback thread and creates a communication pipe
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result prepare_playback_thread(sa_device *device);
+
+/**
+ * @brief Starts the ALSA write and wait loop
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result start_alsa_device(sa_device *device);
+
+/**
+ * @brief Waits until the transfer loop starts
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result wait_for_start_alsa_device(sa_device *device);
+
+/**
+ * @brief Sends out a message to the transfer loop to pause audio output
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result pause_alsa_device(sa_device *device);
+
+/**
+ * @brief Sends out a message to the transfer loop to unpause audio output
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result unpause_alsa_device(sa_device *device);
+
+/**
+ * @brief Sends out a message to stop the transfer loop
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result stop_alsa_device(sa_device *device);
+
+/**
+ * @brief Waits until the transfer loop stops
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result wait_for_stop_alsa_device(sa_device *device);
+
+/**
+ * @brief Drops the samples of the internal ALSA buffer and stop the ALSA pcm handle, accepts a running, paused,
+ * prepared or underrun PCM
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result drop_alsa_device(sa_device *device);
+
+/**
+ * @brief Plays the samples left in the internal ALSA buffer and stops the ALSA pcm handle, the drain runs in
+ * non-blocking mode so the playback thread keeps serving the pipe
+ *
+ * @param device
+ * @return sa_result - SA_AT_END once the last frame was played, SA_STOP when a stop command cut the drain short
+ */
+static sa_result drain_alsa_device(sa_device *device);
+
+/**
+ * @brief Sleeps until snd_pcm_delay() says the last frame was played or a command arrives, until the PCM
+ * leaves the draining state. A draining PCM can not be paused, so a pause is deferred: the device reports
+ * started until the drain ends and then holds the end of the stream until it is resumed or stopped
+ *
+ * @param device
+ * @return sa_result - SA_AT_END once the last frame was played and the stream was not stopped, SA_STOP when a
+ * stop command ended the drain or the deferred pause
+ */
+static sa_result wait_for_drain(sa_device *device);
+
+/**
+ * @brief Initializes the polling filedescriptors for ALSA and links it to the communication pipe
+ *
+ * @param device
+ * @param pipe_read_end - read end of the communication pipe, stored in ufds[0]
+ * @return sa_result
+ */
+static sa_result init_poll_management(sa_device *device, int pipe_read_end);
+
+/**
+ * @brief Starts the audio playback thread by running the write and poll loop
+ *
+ * @param data: the sa_device
+ *
+ */
+static void *init_playback_thread(void *data);
+
+/**
+ * @brief Attempts to join the playback thread
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result close_playback_thread(sa_device *device);
+
+/**
+ * @brief Prepares and starts write_and_poll_loop
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result start_write_and_poll_loop(sa_device *device);
+
+/**
+ * @brief Plays audio by repeatedly calling the callback function for framas
+ *
+ * @param device
+ * @param poll_manager
+ * @return sa_result
+ */
+static sa_result write_and_poll_loop(sa_device *device, sa_poll_management *poll_manager);
+
+/**
+ * @brief Determines how many frames the data callback is asked for after a wakeup
+ *
+ * @param device
+ * @return snd_pcm_sframes_t - the amount of frames or a negative ALSA error code
+ */
+static snd_pcm_sframes_t get_frames_to_request(sa_device *device);
+
+/**
+ * @brief Applies a latency mode: sets the target fill level and avail_min, and rewinds the excess frames when
+ * the device switches from deep buffering to low latency while playing
+ *
+ * @param device
+ * @param mode
+ * @param running - whether the PCM holds frames that may be rewound
+ * @return sa_result
+ */
+static sa_result apply_latency_mode(sa_device *device, sa_latency_mode mode, bool running);
+
+/**
+ * @brief Returns the latency mode that was last requested through sa_set_latency_mode()
+ *
+ * @param device
+ * @return sa_latency_mode
+ */
+static sa_latency_mode get_requested_latency_mode(sa_device *device);
+
+/**
+ * @brief Sets the fill level of the adaptive latency profile, clamped to its bounds, and the matching wakeup
+ *
+ * @param device
+ * @param target_fill - in frames
+ * @return sa_result
+ */
+static sa_result set_adaptive_fill(sa_device *device, snd_pcm_sframes_t target_fill);
+
+/**
+ * @brief Raises the adaptive fill level after an xrun or missed deadline, or lowers it after a stable interval
+ * - called by the playback thread after every period
+ *
+ * @param device
+ */
+static void adapt_latency(sa_device *device);
+
+/**
+ * @brief Takes back the frames beyond the target fill level and lets the source render them again
+ *
+ * @param device
+ * @param target_fill
+ */
+static void rewind_excess_frames(sa_device *device, snd_pcm_sframes_t target_fill);
+
+/**
+ * @brief Changes avail_min of a running PCM
+ *
+ * @param device
+ * @param avail_min
+ * @return sa_result
+ */
+static sa_result set_avail_min(sa_device *device, snd_pcm_uframes_t avail_min);
+
+/**
+ * @brief Converts a time in µs to frames at the sample rate of the device
+ *
+ * @param device
+ * @param time_us
+ * @return snd_pcm_sframes_t
+ */
+static snd_pcm_sframes_t sa_us_to_frames(sa_device *device, int time_us);
+
+/**
+ * @brief Starts the deadline watchdog thread when a deadline margin is configured
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result init_deadline_watchdog(sa_device *device);
+
+/**
+ * @brief Stops and joins the deadline watchdog thread
+ *
+ * @param device
+ */
+static void close_deadline_watchdog(sa_device *device);
+
+/**
+ * @brief The deadline watchdog thread, writes fallback blocks while the data callback is past its deadline
+ *
+ * @param data: the sa_device
+ */
+static void *run_deadline_watchdog(void *data);
+
+/**
+ * @brief Sets the deadline of the data callback that is about to run, based on the current ALSA delay
+ *
+ * @param device
+ */
+static void arm_deadline_watchdog(sa_device *device);
+
+/**
+ * @brief Clears the deadline after the data callback returned and records a miss
+ *
+ * @param device
+ * @param buffer - frames returned by the callback, the last one is kept for a later fade-out
+ * @param frames
+ */
+static void disarm_deadline_watchdog(sa_device *device, void *buffer, int frames);
+
+/**
+ * @brief Renders and writes one block of silence or fade-out, called with the watchdog mutex held. The block is
+ * limited to the free space of the buffer so the write does not block and disarming is never held up
+ *
+ * @param device
+ */
+static void write_deadline_fallback(sa_device *device);
+
+/**
+ * @brief Asks the data callback for frames, or copies them from the pipeline when pipeline_depth is set
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ * @return int - frames rendered, 0 at the end of the stream
+ */
+static int render_frames(sa_device *device, void *buffer, int frames);
+
+/**
+ * @brief Renders and processes a period in pieces that end at the frames of pending events, every event is applied
+ * in between. Rendering stops early at an SA_EVENT_PAUSE
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ * @return int - frames rendered, 0 at the end of the stream or when a pause is pending
+ */
+static int render_period(sa_device *device, void *buffer, int frames);
+
+/**
+ * @brief Starts the pipeline worker thread when pipeline_depth is set
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result init_pipeline(sa_device *device);
+
+/**
+ * @brief Stops and joins the pipeline worker thread
+ *
+ * @param device
+ */
+static void close_pipeline(sa_device *device);
+
+/**
+ * @brief The pipeline worker thread, calls the data callback for every free slot while the device plays
+ *
+ * @param data: the sa_device
+ */
+static void *run_pipeline(void *data);
+
+/**
+ * @brief Empties the slots and lets the worker render ahead, called when playback (re)starts
+ *
+ * @param device
+ */
+static void start_pipeline(sa_device *device);
+
+/**
+ * @brief Stops rendering ahead and waits until the worker has left the data callback
+ *
+ * @param device
+ */
+static void stop_pipeline(sa_device *device);
+
+/**
+ * @brief Copies frames from the rendered slots, waits for the worker when they are not ready yet
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ * @return int - frames copied, less than requested only at the end of the stream
+ */
+static int read_pipeline(sa_device *device, void *buffer, int frames);
+
+/**
+ * @brief Stops the PCM after sustained silence and only checks the data callback every silence_check_interval,
+ * until it returns audio or a command ends playback
+ *
+ * @param device
+ * @param poll_manager
+ * @return sa_result - SA_SUCCESS when the PCM plays again, SA_STOP, SA_AT_END, SA_DEVICE_LOST or SA_ERROR
+ */
+static sa_result sleep_on_silence(sa_device *device, sa_poll_management *poll_manager);
+
+/**
+ * @brief Writes the first frames after a silence sleep, starts the PCM once two periods are queued and tops the
+ * buffer up to the fill level one period at a time
+ *
+ * @param device
+ * @param frames - frames in device->samples
+ * @return sa_result
+ */
+static sa_result wake_from_silence(sa_device *device, int frames);
+
+/**
+ * @brief Handles an SA_EVENT_PAUSE: plays the frames before the event, then waits for an unpause like a paused
+ * device and refills the buffer
+ *
+ * @param device
+ * @param poll_manager
+ * @return sa_result - SA_STOP when stopped, SA_DEVICE_LOST when the PCM disappeared
+ */
+static sa_result pause_on_event(sa_device *device, sa_poll_management *poll_manager);
+
+/**
+ * @brief Waits on poll and checks pipe
+ *
+ * @param handle
+ * @param poll_manager
+ * @return int
+ */
+static int wait_for_poll(sa_device *device, sa_poll_management *poll_manager);
+
+/**
+ * @brief Try to recover from errors during playback - a suspended PCM is resumed with a short, bounded backoff
+ * and is prepared again when resuming is not possible
+ *
+ * @param device
+ * @param err
+ * @return sa_result
+ */
+static sa_result xrun_recovery(sa_device *device, int err);
+
+/**
+ * @brief Recovers from an xrun, suspend or lost PCM, refills the complete ALSA buffer and stores the recovery time
+ *
+ * @param device
+ * @param err - -EPIPE, -ESTRPIPE or an error for which is_device_lost() holds
+ * @return sa_result - SA_AT_END when the callback ran out of frames during the refill
+ */
+static sa_result recover_alsa_device(sa_device *device, int err);
+
+/**
+ * @brief Recovers the PCM handle after poll reported an error
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result recover_from_poll_error(sa_device *device);
+
+/**
+ * @brief Checks whether an error means that the PCM is gone (unplugged or its driver was removed)
+ *
+ * @param device
+ * @param err - negative error code of an ALSA call
+ * @return bool
+ */
+static bool is_device_lost(sa_device *device, int err);
+
+/**
+ * @brief Closes a lost PCM and reopens it without leaving the playback thread, the source continues where
+ * it was so only the frames that were in the lost buffer are skipped
+ *
+ * @param device
+ * @return sa_result - SA_STOP when the device was stopped before the PCM came back
+ */
+static sa_result recover_lost_device(sa_device *device);
+
+/**
+ * @brief Retries to open the PCM every reconnect_interval until it succeeds or a stop command arrives, the
+ * buffer is prefilled afterwards
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result reconnect_alsa_device(sa_device *device);
+
+/**
+ * @brief Opens alsa_device_name, or fallback_device_name when that fails, and negotiates the same
+ * configuration as before
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result reopen_alsa_device(sa_device *device);
+
+/**
+ * @brief Opens one PCM and applies the hardware and software parameters, the latency mode and the poll
+ * descriptors of the device to it
+ *
+ * @param device
+ * @param alsa_device_name
+ * @return sa_result
+ */
+static sa_result open_playback_handle(sa_device *device, const char *alsa_device_name);
+
+/**
+ * @brief Closes the PCM handle of the device, if any
+ *
+ * @param device
+ */
+static void close_playback_handle(sa_device *device);
+
+/**
+ * @brief Waits reconnect_interval for the next reopen attempt while the pipe is still served - a pause
+ * command holds the attempts until the device is unpaused
+ *
+ * @param device
+ * @return sa_result - SA_SUCCESS to try again, SA_STOP on a stop command
+ */
+static sa_result wait_for_reconnect(sa_device *device);
+
+/**
+ * @brief Writes interleaved frames to the PCM of the device
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ * @return snd_pcm_sframes_t - frames written or a negative error code
+ */
+static snd_pcm_sframes_t write_alsa_frames(sa_device *device, const void *buffer, snd_pcm_uframes_t frames);
+
+/**
+ * @brief Fills all the available space of the ALSA buffer with a single call to the data callback, the PCM is
+ * started afterwards if the start threshold did not do so already
+ *
+ * @param device
+ * @return sa_result - SA_AT_END when the callback ran out of frames, SA_DEVICE_LOST when the PCM is gone
+ */
+static sa_result prefill_alsa_buffer(sa_device *device);
+
+/**
+ * @brief Starts a prepared PCM once the frames of the start policy are queued, or the fill level of the latency
+ * profile when that is lower than the start threshold
+ *
+ * @param device
+ * @return int - 0 or a negative ALSA error
+ */
+static int start_if_threshold_reached(sa_device *device);
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in µs
+ *
+ * @return unsigned long long
+ */
+static unsigned long long sa_get_time_us(void);
+
+/**
+ * @brief reclaims sa_device
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result cleanup_device(sa_device *device);
+
+/**
+ * @brief Messages a char to the playback thread via a pipe
+ *
+ * @param device
+ * @param toSend
+ * @return sa_result
+ */
+static sa_result message_pipe(sa_device *device, char toSend);
+
+/**
+ * @brief Pauses the callback loop, this function will pause the PCM handle by calling pause_PCM_handle().
+ * After that it will block and wait for further commands from the message pipe.
+ *
+ * @param poll_manager
+ * @param handle
+ * @return sa_result
+ */
+static sa_result pause_callback_loop(sa_poll_management *poll_manager, sa_device *device);
+
+/**
+ * @brief Saves the device state and signals if it has stopped
+ *
+ * @param device
+ * @param new_state
+ * @return void
+ */
+static void save_device_state(sa_device *device, sa_device_state new_state);
+/**
+ * @brief Checks whether the hardware support pausing, if so it pauses using snd_pcm_pause(). If the hw does
+ * not support pausing it uses snd_pcm_drop() and prepares the the device using snd_pcm_prepare().
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result pause_PCM_handle(sa_device *device);
+
+/**
+ * @brief Checks whether the pcm was paused using snd_pcm_pause() or not and resume the pcm accordingly.
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result unpause_PCM_handle(sa_device *device);
+
+/**
+ * @brief Prepares the ALSA device so it is ready for a restart
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result prepare_alsa_device(sa_device *device);
+
+/**
+ * @brief Destroys the ALSA device, closes threads and frees all allocated memory
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result destroy_alsa_device(sa_device *device);
+
+/**
+ * @brief Function used to set the device state - thread safe
+ *
+ * @param device
+ * @param state
+ */
+static void sa_set_device_state(sa_device *device, sa_device_state state);
+
+/*=================== SAMPLE PROCESSING DECLARATIONS ===================*/
+/**
+ * @brief Converts a linear gain from the API to the representation the playback thread multiplies with
+ *
+ * @param gain
+ * @return sa_gain - Q15 limited to [-2.0; 2.0[ with SA_FIXED_POINT, the gain itself otherwise
+ */
+static inline sa_gain sa_to_gain(float gain);
+
+/**
+ * @brief Selects the gain function matching the format and channel count of the device
+ *
+ * @param device
+ * @return sa_gain_function - NULL when the format is not supported
+ */
+static sa_gain_function select_gain_function(sa_device *device);
+
+/**
+ * @brief Applies all in-library processing to frames returned by the data callback
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ */
+static void process_samples(sa_device *device, void *buffer, int frames);
+
+/**
+ * @brief Selects the level meter matching the format and channel count of the device
+ *
+ * @param device
+ * @return sa_meter_function - NULL when the format is not supported
+ */
+static sa_meter_function select_meter_function(sa_device *device);
+
+/**
+ * @brief Selects the downmix into the spectrum ring matching the format of the device
+ *
+ * @param device
+ * @return sa_downmix_function - NULL when the format is not supported
+ */
+static sa_downmix_function select_downmix_function(sa_device *device);
+
+/**
+ * @brief Publishes the levels of the frames that are about to be written and copies them to the spectrum ring
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ */
+static void analyze_samples(sa_device *device, const void *buffer, int frames);
+
+/**
+ * @brief Checks whether frames only hold the silence pattern of the format
+ *
+ * @param device
+ * @param buffer
+ * @param frames
+ * @return true when every sample is digital silence
+ */
+static bool is_silent(sa_device *device, const void *buffer, int frames);
+
+/*======================= ANALYSIS DECLARATIONS ======================*/
+/**
+ * @brief Allocates the spectrum buffers and starts the spectrum worker when spectrum_size is set
+ *
+ * @param device
+ * @return sa_result
+ */
+static sa_result init_analysis(sa_device *device);
+
+/**
+ * @brief Stops and joins the spectrum worker and frees its buffers
+ *
+ * @param device
+ */
+static void close_analysis(sa_device *device);
+
+/**
+ * @brief The spectrum worker thread, runs an FFT over the newest samples of the ring every SA_SPECTRUM_INTERVAL_US
+ *
+ * @param data: the sa_device
+ */
+static void *run_spectrum_worker(void *data);
+
+/**
+ * @brief Windows the newest spectrum_size samples of the ring, transforms them and publishes the magnitudes
+ *
+ * @param device
+ */
+static void compute_spectrum(sa_device *device);
+
+/**
+ * @brief In place iterative radix-2 FFT
+ *
+ * @param real
+ * @param imaginary
+ * @param size - a power of two
+ */
+static void sa_fft(float *real, float *imaginary, int size);
+
+/*======================== MIXER DECLARATIONS ========================*/
+/**
+ * @brief The data callback of the mixer device
+ *
+ * @param amount_of_frames
+ * @param audio_buffer
+ * @param device
+ * @param my_custom_data - the sa_mixer
+ * @return int
+ */
+static int mixer_data_callback(int amount_of_frames, void *audio_buffer, sa_device *device, void *my_custom_data);
+
+/**
+ * @brief Claims a free source slot
+ *
+ * @param mixer
+ * @return int - the slot, -1 when every slot is in use
+ */
+static int claim_mixer_source(sa_mixer *mixer);
+
+/**
+ * @brief Reads up to amount_of_frames from the ring of a source
+ *
+ * @param source
+ * @param buffer
+ * @param amount_of_frames
+ * @param channels
+ * @return int - the amount of frames read
+ */
+static int read_mixer_ring(sa_mixer_source *source, sa_mix_sample *buffer, int amount_of_frames, int channels);
+
+/**
+ * @brief Adds frames to the mix with the gains of one source
+ *
+ * @param mix
+ * @param source
+ * @param frames
+ * @param channels
+ * @param gains - left and right gain, only gains[0] is used when channels is not 2
+ */
+static void sa_mix_add(sa_mix_sample *mix, const sa_mix_sample *source, int frames, int channels,
+                       const sa_gain *gains);
+
+/**
+ * @brief Converts the mix to the device format, samples outside [-1;1] saturate
+ *
+ * @param mix
+ * @param buffer
+ * @param samples - frames * channels
+ * @param format
+ */
+static void sa_mix_convert(const sa_mix_sample *mix, void *buffer, int samples, snd_pcm_format_t format);
+
+/**
+ * @brief Computes the left and right gain of a source with the balance pan law
+ *
+ * @param channels - pan is ignored when this is not 2
+ * @param gain
+ * @param pan
+ * @param gains - the left and right gain are returned here
+ */
+static void sa_pan_gains(int channels, float gain, float pan, sa_gain *gains);
+
+/*======================= SAMPLER DECLARATIONS =======================*/
+/**
+ * @brief The mixer callback of the sampler, it starts triggered voices and mixes every playing voice
+ *
+ * @param amount_of_frames
+ * @param audio_buffer
+ * @param channels
+ * @param my_custom_data - the sa_sampler
+ * @return int
+ */
+static int sampler_callback(int amount_of_frames, sa_mix_sample *audio_buffer, int channels, void *my_custom_data);
+
+/**
+ * @brief Moves queued triggers to voices
+ *
+ * @param sampler
+ */
+static void start_sampler_voices(sa_sampler *sampler);
+
+/**
+ * @brief Returns an idle voice, or steals the oldest one
+ *
+ * @param sampler
+ * @return sa_sampler_voice*
+ */
+static sa_sampler_voice *allocate_sampler_voice(sa_sampler *sampler);
+
+/*======================== CACHE DECLARATIONS ========================*/
+/**
+ * @brief Looks up an entry and creates and queues it when it does not exist, called with the cache mutex held
+ *
+ * @param cache
+ * @param name
+ * @param format
+ * @param channels
+ * @return sa_cache_entry* - NULL when allocation failed
+ */
+static sa_cache_entry *find_cache_entry(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels);
+
+/**
+ * @brief Moves an entry to the head of the LRU list, called with the cache mutex held
+ *
+ * @param cache
+ * @param entry
+ */
+static void touch_cache_entry(sa_cache *cache, sa_cache_entry *entry);
+
+/**
+ * @brief Unlinks an entry from the LRU list, called with the cache mutex held
+ *
+ * @param cache
+ * @param entry
+ */
+static void unlink_cache_entry(sa_cache *cache, sa_cache_entry *entry);
+
+/**
+ * @brief Frees unreferenced entries from the tail of the LRU list until the budget is met, and every unreferenced
+ * entry that failed to decode - called with the cache mutex held
+ *
+ * @param cache
+ */
+static void evict_cache_entries(sa_cache *cache);
+
+/**
+ * @brief Frees one entry
+ *
+ * @param entry
+ */
+static void free_cache_entry(sa_cache_entry *entry);
+
+/**
+ * @brief The cache worker, decodes queued entries
+ *
+ * @param data: the sa_cache
+ */
+static void *cache_worker(void *data);
+
+/*========================= SHM DECLARATIONS =========================*/
+/**
+ * @brief Releases a half created sa_shm_source
+ *
+ * @param source
+ * @return sa_result - always SA_ERROR
+ */
+static sa_result abort_create_shm_source(sa_shm_source *source);
+
+/*======================== EVENT DECLARATIONS ========================*/
+/**
+ * @brief Validates an event and adds it to the lock-free queue of the device
+ *
+ * @param device
+ * @param event
+ * @param timestamp - stream position, or CLOCK_MONOTONIC time in ns
+ * @param by_time - true when the timestamp is a time
+ * @return sa_result - SA_ERROR when the event is invalid or the queue is full
+ */
+static sa_result post_event(sa_device *device, const sa_event *event, unsigned long long timestamp, bool by_time);
+
+/**
+ * @brief Moves the queued events to the sorted pending list, times are converted to stream positions
+ *
+ * @param device
+ */
+static void collect_events(sa_device *device);
+
+/**
+ * @brief Applies one event on the playback thread
+ *
+ * @param device
+ * @param event
+ */
+static void apply_event(sa_device *device, const sa_event *event);
+
+/*========================= API DEFINITIONS ==========================*/
+extern sa_result sa_init_device_config(sa_device_config **config) {
+    sa_device_config *config_temp = (sa_device_config *) malloc(sizeof(sa_device_config));
+    if(!config_temp)
+        return SA_ERROR;
+
+    set_default_config(config_temp);
+    *config = config_temp;
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_init_device(sa_device_config *config, sa_device **device) {
+    sa_device *device_temp = (sa_device *) malloc(sizeof(sa_device));
+    if(!device_temp)
+        return SA_ERROR;
+
+    init_device_fields(device_temp, config);
+    if(init_alsa_device(device_temp) != SA_SUCCESS)
+    {
+        free(device_temp);
+        return SA_ERROR;
+    }
+    *device = device_temp;
+    return SA_SUCCESS;
+}
+
+    #ifdef SA_STATIC_ALLOC
+
+extern sa_result sa_default_device_config(sa_device_config *config) {
+    if(!config)
+        return SA_ERROR;
+    set_default_config(config);
+    return SA_SUCCESS;
+}
+
+extern size_t sa_get_static_memory_size(sa_device_config *config) {
+    unsigned long long frames =
+      ((unsigned long long) config->buffer_time * config->sample_rate + 999999) / 1000000;
+    unsigned long long rounded_frames = 1;
+    while(rounded_frames < frames)
+        rounded_frames <<= 1;
+    if(config->deadline_margin > 0)
+        rounded_frames +=
+          ((unsigned long long) config->deadline_fallback_time * config->sample_rate) / 1000000 + 1;
+    if(config->pipeline_depth > 0)
+    {
+        unsigned long long period_frames =
+          ((unsigned long long) config->period_time * config->sample_rate + 999999) / 1000000;
+        unsigned long long rounded_period = 1;
+        while(rounded_period < period_frames)
+            rounded_period <<= 1;
+        int depth = config->pipeline_depth < SA_MAX_PIPELINE_DEPTH ? config->pipeline_depth : SA_MAX_PIPELINE_DEPTH;
+        rounded_frames += depth * rounded_period;
+    }
+    size_t sample_bytes =
+      (rounded_frames * config->channels * snd_pcm_format_physical_width(config->format)) / 8 +
+      2 * SA_MEMORY_ALIGNMENT;
+    return sa_align_size(sizeof(sa_device)) + sa_align_size(sizeof(sa_device_config)) +
+           sa_align_size(sample_bytes);
+}
+
+extern sa_result sa_init_device_static(sa_device_config *config, void *memory, size_t memory_size,
+                                       sa_device **device) {
+    size_t header_size = sa_align_size(sizeof(sa_device)) + sa_align_size(sizeof(sa_device_config));
+    if(!config || !memory || ((uintptr_t) memory % SA_MEMORY_ALIGNMENT) != 0 || memory_size < header_size)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Static memory block is not aligned or too small");
+        return SA_ERROR;
+    }
+    sa_device *device_temp        = (sa_device *) memory;
+    sa_device_config *config_copy = (sa_device_config *) ((char *) memory + sa_align_size(sizeof(sa_device)));
+    *config_copy                  = *config;
+
+    init_device_fields(device_temp, config_copy);
+    device_temp->static_memory      = memory;
+    device_temp->static_memory_size = memory_size;
+    *device                         = device_temp;
     if(init_alsa_device(*device) != SA_SUCCESS)
     { return SA_ERROR; }
     return SA_SUCCESS;
 }
 
-    #ifdef SA_ASYNC_API
+    #endif
+
+    #ifdef SA_ASYNC_API
+
+static sa_result sa_start_device_async(sa_device *device) {
+    if(sa_get_device_state(device) != SA_DEVICE_STARTED)
+    {
+        return start_alsa_device(device);
+    } else
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to start the device, the device is already started");
+        return SA_INVALID_STATE;
+    }
+}
+
+static sa_result sa_stop_device_async(sa_device *device) {
+    if(sa_get_device_state(device) != SA_DEVICE_STOPPED)
+        return stop_alsa_device(device);
+    else
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to stop the device, the device is already stopped");
+        return SA_INVALID_STATE;
+    }
+}
+
+    #endif
+
+extern sa_result sa_start_device(sa_device *device) {
+    pthread_mutex_lock(&(device->condition_var.mutex));
+    if(sa_get_device_state(device) != SA_DEVICE_STARTED)
+        if(start_alsa_device(device) == SA_SUCCESS)
+        {
+            sa_result result = wait_for_start_alsa_device(device);
+            pthread_mutex_unlock(&(device->condition_var.mutex));
+            return result;
+        }
+    pthread_mutex_unlock(&(device->condition_var.mutex));
+    return SA_INVALID_STATE;
+}
+
+extern sa_result sa_stop_device(sa_device *device) {
+    pthread_mutex_lock(&(device->condition_var.mutex));
+    if(sa_get_device_state(device) != SA_DEVICE_STOPPED)
+    {
+        if(stop_alsa_device(device) == SA_SUCCESS)
+        {
+            sa_result result = wait_for_stop_alsa_device(device);
+            pthread_mutex_unlock(&(device->condition_var.mutex));
+            return result;
+        }
+    }
+    pthread_mutex_unlock(&(device->condition_var.mutex));
+    return SA_INVALID_STATE;
+}
+
+extern sa_result sa_pause_device(sa_device *device) {
+    if(sa_get_device_state(device) == SA_DEVICE_STARTED)
+        return pause_alsa_device(device);
+    else
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to pause the device, the device is already ");
+        return SA_INVALID_STATE;
+    }
+}
+
+extern sa_result sa_destroy_device(sa_device *device) {
+    return destroy_alsa_device(device);
+}
+
+extern sa_device_state sa_get_device_state(sa_device *device) {
+    pthread_mutex_lock(&(device->stateMutex));
+    sa_device_state result = device->state;
+    pthread_mutex_unlock(&(device->stateMutex));
+    return result;
+}
+
+extern sa_result sa_get_device_stats(sa_device *device, sa_device_stats *stats) {
+    if(!device || !stats)
+        return SA_ERROR;
+    pthread_mutex_lock(&(device->statsMutex));
+    *stats = device->stats;
+    pthread_mutex_unlock(&(device->statsMutex));
+    /** Posting never takes the mutex, so the counter lives in the queue */
+    stats->dropped_events = __atomic_load_n(&(device->events.dropped), __ATOMIC_RELAXED);
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_get_levels(sa_device *device, sa_levels *levels) {
+    if(!device || !levels || !device->analysis.meter)
+        return SA_ERROR;
+    sa_analysis *analysis = &(device->analysis);
+    unsigned int before, after;
+    do
+    {
+        before = __atomic_load_n(&(analysis->levels_sequence), __ATOMIC_ACQUIRE);
+        for(int channel = 0; channel < device->config->channels; channel++)
+        {
+            __atomic_load(&(analysis->levels.peak[channel]), &(levels->peak[channel]), __ATOMIC_RELAXED);
+            __atomic_load(&(analysis->levels.rms[channel]), &(levels->rms[channel]), __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(analysis->levels_sequence), __ATOMIC_RELAXED);
+    } while((before & 1) != 0 || before != after);
+    levels->channels = device->config->channels;
+    return SA_SUCCESS;
+}
+
+extern int sa_get_spectrum(sa_device *device, float *magnitudes, int amount_of_bins) {
+    if(!device || !magnitudes || !device->analysis.magnitudes)
+        return 0;
+    sa_analysis *analysis = &(device->analysis);
+    int bins              = analysis->spectrum_size / 2 < amount_of_bins ? analysis->spectrum_size / 2 : amount_of_bins;
+    unsigned int before, after;
+    do
+    {
+        before = __atomic_load_n(&(analysis->spectrum_sequence), __ATOMIC_ACQUIRE);
+        for(int bin = 0; bin < bins; bin++)
+            __atomic_load(&(analysis->magnitudes[bin]), &magnitudes[bin], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(analysis->spectrum_sequence), __ATOMIC_RELAXED);
+    } while((before & 1) != 0 || before != after);
+    return bins > 0 ? bins : 0;
+}
+
+    #ifdef SA_SIMULATE_DEVICE_LOSS
+extern sa_result sa_simulate_device_loss(sa_device *device, int failed_reopens) {
+    if(!device || failed_reopens < 0)
+        return SA_ERROR;
+    __atomic_store_n(&(device->simulated_reopen_failures), failed_reopens, __ATOMIC_RELAXED);
+    __atomic_store_n(&(device->simulated_loss), 1, __ATOMIC_RELEASE);
+    return SA_SUCCESS;
+}
+    #endif
+
+extern sa_result sa_set_software_gain(sa_device *device, float gain) {
+    sa_result result = SA_SUCCESS;
+    for(int channel = 0; channel < device->config->channels && result == SA_SUCCESS; channel++)
+        result = sa_set_channel_gain(device, channel, gain);
+    return result;
+}
+
+extern sa_result sa_set_channel_gain(sa_device *device, int channel, float gain) {
+    if(!device->apply_gain)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Software gain is not supported for format",
+               snd_pcm_format_name(device->config->format));
+        return SA_ERROR;
+    }
+    if(channel < 0 || channel >= device->config->channels || channel >= SA_MAX_CHANNELS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Invalid channel for software gain");
+        return SA_ERROR;
+    }
+    sa_gain value = sa_to_gain(gain);
+    __atomic_store(&(device->channel_gain[channel]), &value, __ATOMIC_RELAXED);
+
+    int active = 0;
+    for(int i = 0; i < device->config->channels && i < SA_MAX_CHANNELS; i++)
+    {
+        sa_gain current;
+        __atomic_load(&(device->channel_gain[i]), &current, __ATOMIC_RELAXED);
+        active |= current != SA_GAIN_ONE;
+    }
+    __atomic_store_n(&(device->gain_active), active, __ATOMIC_RELEASE);
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_set_latency_mode(sa_device *device, sa_latency_mode mode) {
+    if(device->config->latency_profile != SA_LATENCY_PROFILE_DUAL)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Latency mode can only be switched with the dual latency profile");
+        return SA_INVALID_STATE;
+    }
+    __atomic_store_n(&(device->requested_latency_mode), (int) mode, __ATOMIC_RELEASE);
+    /** A stopped or paused thread picks up the mode when playback (re)starts */
+    if(sa_get_device_state(device) == SA_DEVICE_STARTED)
+        return message_pipe(device, 'm');
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_post_event(sa_device *device, const sa_event *event, unsigned long long frame) {
+    return post_event(device, event, frame, false);
+}
+
+extern sa_result sa_post_event_at_time(sa_device *device, const sa_event *event, const struct timespec *time) {
+    if(!time || time->tv_sec < 0)
+        return SA_ERROR;
+    return post_event(device, event, (unsigned long long) time->tv_sec * 1000000000ULL + time->tv_nsec, true);
+}
+
+extern unsigned long long sa_get_stream_position(sa_device *device) {
+    return __atomic_load_n(&(device->events.position), __ATOMIC_ACQUIRE);
+}
+
+extern sa_result sa_probe_device(const char *alsa_device_name, sa_device_info *info) {
+    memset(info, 0, sizeof(sa_device_info));
+    snprintf(info->name, sizeof(info->name), "%s", alsa_device_name);
+    snd_pcm_t *handle;
+    /** Non blocking so a busy device fails instead of hanging the probe */
+    int err = snd_pcm_open(&handle, alsa_device_name, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA: cannot open for probing:", alsa_device_name);
+        get_pcm_card_id(info->name, NULL, info->card_id);
+        return SA_ERROR;
+    }
+    get_pcm_card_id(info->name, handle, info->card_id);
+    sa_result result = probe_pcm_handle(handle, info);
+    snd_pcm_close(handle);
+    return result;
+}
+
+extern sa_result sa_enumerate_devices(const char *cache_dir, sa_device_info **devices, int *count) {
+    void **hints;
+    int err = snd_device_name_hint(-1, "pcm", &hints);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: cannot get the device hints:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    int capacity = 0;
+    while(hints[capacity])
+        capacity++;
+    sa_device_info *infos = (sa_device_info *) calloc(capacity > 0 ? capacity : 1, sizeof(sa_device_info));
+    if(!infos)
+    {
+        snd_device_name_free_hint(hints);
+        return SA_ERROR;
+    }
+
+    int found = 0;
+    for(int i = 0; i < capacity; i++)
+    {
+        char *name        = snd_device_name_get_hint(hints[i], "NAME");
+        char *description = snd_device_name_get_hint(hints[i], "DESC");
+        char *direction   = snd_device_name_get_hint(hints[i], "IOID");
+        /** A missing IOID means the PCM does both playback and capture */
+        if(name && (!direction || strcmp(direction, "Output") == 0))
+        {
+            sa_device_info *info = &infos[found++];
+            bool cached          = false;
+            snprintf(info->name, sizeof(info->name), "%s", name);
+            if(cache_dir && get_pcm_card_id(info->name, NULL, info->card_id))
+                cached = lookup_device_cache(cache_dir, info) == SA_SUCCESS;
+            if(!cached && sa_probe_device(name, info) == SA_SUCCESS && cache_dir && info->card_id[0] != '\0')
+                update_device_cache(cache_dir, info);
+            if(description)
+            {
+                snprintf(info->description, sizeof(info->description), "%s", description);
+                for(char *c = info->description; *c; c++)
+                    *c = *c == '\n' ? ' ' : *c;
+            }
+        }
+        free(name);
+        free(description);
+        free(direction);
+    }
+    snd_device_name_free_hint(hints);
+    *devices = infos;
+    *count   = found;
+    return SA_SUCCESS;
+}
+
+extern bool sa_device_supports_format(const sa_device_info *info, snd_pcm_format_t format) {
+    return format >= 0 && format < 64 && (info->formats >> format) & 1;
+}
+
+    #ifdef SA_TRACE
+
+extern sa_result sa_start_trace(sa_device *device, const char *path) {
+    sa_trace *trace = &(device->trace);
+    if(__atomic_load_n(&(trace->active), __ATOMIC_ACQUIRE))
+        return SA_INVALID_STATE;
+    trace->file = fopen(path, "w");
+    if(!trace->file)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not open the trace file", path);
+        return SA_ERROR;
+    }
+    fprintf(trace->file, "{\"traceEvents\":[\n");
+    trace->first_event = true;
+    trace->dropped     = 0;
+    __atomic_store_n(&(trace->tail), __atomic_load_n(&(trace->head), __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    __atomic_store_n(&(trace->active), 1, __ATOMIC_RELEASE);
+    if(pthread_create(&(trace->flush_thread), NULL, &sa_trace_flush_thread, (void *) device) != 0)
+    {
+        __atomic_store_n(&(trace->active), 0, __ATOMIC_RELEASE);
+        fclose(trace->file);
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_stop_trace(sa_device *device) {
+    sa_trace *trace = &(device->trace);
+    if(!__atomic_load_n(&(trace->active), __ATOMIC_ACQUIRE))
+        return SA_INVALID_STATE;
+    __atomic_store_n(&(trace->active), 0, __ATOMIC_RELEASE);
+    pthread_join(trace->flush_thread, NULL);
+    sa_trace_drain(device);
+    fprintf(trace->file, "\n],\"otherData\":{\"dropped_events\":\"%lu\"}}\n",
+            __atomic_load_n(&(trace->dropped), __ATOMIC_RELAXED));
+    fclose(trace->file);
+    trace->file = NULL;
+    return SA_SUCCESS;
+}
+
+/*========================== TRACE DEFINITIONS ==========================*/
+static void sa_trace_record(sa_device *device, sa_trace_type type, char phase, int arg) {
+    sa_trace *trace = &(device->trace);
+    if(!__atomic_load_n(&(trace->active), __ATOMIC_RELAXED))
+        return;
+
+    unsigned int head = trace->head;
+    if(head - __atomic_load_n(&(trace->tail), __ATOMIC_ACQUIRE) >= SA_TRACE_CAPACITY)
+    {
+        __atomic_add_fetch(&(trace->dropped), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    sa_trace_event *event = &(trace->events[head & (SA_TRACE_CAPACITY - 1)]);
+    /** The handle is NULL while a lost device is reconnected, those events carry no queue state */
+    snd_pcm_sframes_t avail = -1, delay = -1;
+    if(device->handle && snd_pcm_avail_delay(device->handle, &avail, &delay) < 0)
+        avail = delay = -1;
+    event->timestamp_us = sa_get_time_us();
+    event->avail        = avail;
+    event->delay        = delay;
+    event->arg          = arg;
+    event->type         = (uint8_t) type;
+    event->phase        = phase;
+    __atomic_store_n(&(trace->head), head + 1, __ATOMIC_RELEASE);
+}
+
+static void sa_trace_drain(sa_device *device) {
+    static const char *names[] = {"command", "poll", "data_callback", "snd_pcm_writei", "xrun_recovery", "drain"};
+    sa_trace *trace            = &(device->trace);
+    unsigned int head          = __atomic_load_n(&(trace->head), __ATOMIC_ACQUIRE);
+    unsigned int tail          = trace->tail;
+
+    for(; tail != head; tail++)
+    {
+        sa_trace_event *event = &(trace->events[tail & (SA_TRACE_CAPACITY - 1)]);
+        fprintf(trace->file,
+                "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":1,%s"
+                "\"args\":{\"avail\":%d,\"delay\":%d,\"arg\":%d}}",
+                trace->first_event ? "" : ",\n", names[event->type], event->phase, event->timestamp_us,
+                (int) getpid(), event->phase == 'i' ? "\"s\":\"t\"," : "", event->avail, event->delay,
+                event->arg);
+        trace->first_event = false;
+    }
+    __atomic_store_n(&(trace->tail), tail, __ATOMIC_RELEASE);
+    fflush(trace->file);
+}
+
+static void *sa_trace_flush_thread(void *data) {
+    sa_device *device = (sa_device *) data;
+    while(__atomic_load_n(&(device->trace.active), __ATOMIC_ACQUIRE))
+    {
+        sa_trace_drain(device);
+        usleep(SA_TRACE_FLUSH_INTERVAL_US);
+    }
+    return NULL;
+}
+
+    #endif
+
+extern sa_result sa_start_async_logging(sa_log_sink sink, void *user_data) {
+    if(__atomic_load_n(&(sa_async_log.active), __ATOMIC_ACQUIRE))
+        return SA_INVALID_STATE;
+    for(unsigned int i = 0; i < SA_LOG_CAPACITY; i++)
+        sa_async_log.entries[i].sequence = i;
+    sa_async_log.enqueue_position = 0;
+    sa_async_log.dequeue_position = 0;
+    sa_async_log.dropped          = 0;
+    sa_async_log.sink             = sink ? sink : &sa_log_print;
+    sa_async_log.user_data        = user_data;
+    __atomic_store_n(&(sa_async_log.active), 1, __ATOMIC_RELEASE);
+    if(pthread_create(&(sa_async_log.thread), NULL, &sa_log_thread, NULL) != 0)
+    {
+        __atomic_store_n(&(sa_async_log.active), 0, __ATOMIC_RELEASE);
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_stop_async_logging(void) {
+    if(!__atomic_load_n(&(sa_async_log.active), __ATOMIC_ACQUIRE))
+        return SA_INVALID_STATE;
+    __atomic_store_n(&(sa_async_log.active), 0, __ATOMIC_RELEASE);
+    pthread_join(sa_async_log.thread, NULL);
+    /** Messages that were queued while the thread stopped */
+    sa_log_drain();
+    unsigned long dropped = __atomic_load_n(&(sa_async_log.dropped), __ATOMIC_RELAXED);
+    if(dropped > 0)
+    {
+        char count[32];
+        snprintf(count, sizeof(count), "%lu", dropped);
+        SA_LOG(SA_LOG_LEVEL_WARNING, "Log messages dropped because the ring was full:", count);
+    }
+    return SA_SUCCESS;
+}
+
+/*========================= LOG DEFINITIONS ==========================*/
+static void sa_log(sa_log_type type, const char msg0[], const char msg1[]) {
+    if(!__atomic_load_n(&(sa_async_log.active), __ATOMIC_ACQUIRE))
+    {
+        char message[SA_LOG_MESSAGE_SIZE];
+        sa_log_compose(message, msg0, msg1);
+        sa_log_print(type, message, NULL);
+        return;
+    }
+
+    /** Claim a slot, a full ring drops the message instead of blocking */
+    unsigned int position = __atomic_load_n(&(sa_async_log.enqueue_position), __ATOMIC_RELAXED);
+    sa_log_entry *entry;
+    while(1)
+    {
+        entry             = &(sa_async_log.entries[position & (SA_LOG_CAPACITY - 1)]);
+        unsigned int seq  = __atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE);
+        int difference    = (int) (seq - position);
+        if(difference == 0)
+        {
+            if(__atomic_compare_exchange_n(&(sa_async_log.enqueue_position), &position, position + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(difference < 0)
+        {
+            __atomic_add_fetch(&(sa_async_log.dropped), 1, __ATOMIC_RELAXED);
+            return;
+        } else
+        { position = __atomic_load_n(&(sa_async_log.enqueue_position), __ATOMIC_RELAXED); }
+    }
+    entry->type = type;
+    sa_log_compose(entry->message, msg0, msg1);
+    __atomic_store_n(&(entry->sequence), position + 1, __ATOMIC_RELEASE);
+}
+
+static void sa_log_compose(char *buffer, const char msg0[], const char msg1[]) {
+    size_t length = 0;
+    for(; msg0 && *msg0 && length < SA_LOG_MESSAGE_SIZE - 1; msg0++)
+        buffer[length++] = *msg0;
+    if(msg1 && *msg1 && length < SA_LOG_MESSAGE_SIZE - 1)
+        buffer[length++] = ' ';
+    for(; msg1 && *msg1 && length < SA_LOG_MESSAGE_SIZE - 1; msg1++)
+        buffer[length++] = *msg1;
+    buffer[length] = '\0';
+}
+
+static void sa_log_print(sa_log_type type, const char *message, void *user_data) {
+    switch(type)
+    {
+    #ifndef SA_NO_ERROR_LOGS
+    case SA_LOG_LEVEL_ERROR:
+        printf("\e[1;31m[  SA ERROR   ] \e[0m %s\n", message);
+        break;
+    #endif
+    #ifndef SA_NO_WARNING_LOGS
+    case SA_LOG_LEVEL_WARNING:
+        printf("\e[1;33m[  SA WARNING ] \e[0m %s\n", message);
+        break;
+    #endif
+    #ifndef SA_NO_DEBUG_LOGS
+    case SA_LOG_LEVEL_DEBUG:
+        printf("\e[1;35m[  SA DEBUG   ] \e[0m %s\n", message);
+        break;
+    #endif
+    default:
+        break;
+    }
+    fflush(stdout);
+}
+
+static void sa_log_drain(void) {
+    unsigned int position = sa_async_log.dequeue_position;
+    while(1)
+    {
+        sa_log_entry *entry = &(sa_async_log.entries[position & (SA_LOG_CAPACITY - 1)]);
+        if((int) (__atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE) - (position + 1)) < 0)
+            break;
+        sa_async_log.sink(entry->type, entry->message, sa_async_log.user_data);
+        /** Hand the slot back to the producers for the next lap */
+        __atomic_store_n(&(entry->sequence), position + SA_LOG_CAPACITY, __ATOMIC_RELEASE);
+        position++;
+    }
+    sa_async_log.dequeue_position = position;
+}
+
+static void *sa_log_thread(void *data) {
+    while(__atomic_load_n(&(sa_async_log.active), __ATOMIC_ACQUIRE))
+    {
+        sa_log_drain();
+        usleep(SA_LOG_FLUSH_INTERVAL_US);
+    }
+    return NULL;
+}
+
+/*======================= ALSA FUNC DEFINITIONS ======================*/
+static void set_default_config(sa_device_config *config) {
+    config->sample_rate            = DEFAULT_SAMPLE_RATE;
+    config->channels               = DEFAULT_NUMBER_OF_CHANNELS;
+    config->buffer_time            = DEFAULT_BUFFER_TIME;
+    config->period_time            = DEFAULT_PERIOD_TIME;
+    config->format                 = DEFAULT_AUDIO_FORMAT;
+    config->alsa_device_name       = (char *) "default";
+    config->my_custom_data         = NULL;
+    config->data_callback          = NULL;
+    config->eof_callback           = NULL;
+    config->device_name            = (char *) "simpleALSA";
+    config->start_policy           = DEFAULT_START_POLICY;
+    config->start_threshold        = 0;
+    config->bulk_fill              = DEFAULT_BULK_FILL;
+    config->latency_profile        = SA_LATENCY_PROFILE_FIXED;
+    config->latency_mode           = SA_LATENCY_MODE_DEEP;
+    config->low_latency_time       = DEFAULT_LOW_LATENCY_TIME;
+    config->deep_wakeup_time       = DEFAULT_DEEP_WAKEUP_TIME;
+    config->adaptive_min_time      = DEFAULT_ADAPTIVE_MIN_TIME;
+    config->adaptive_max_time      = 0;
+    config->adaptive_stable_time   = DEFAULT_ADAPTIVE_STABLE_TIME;
+    config->rewind_callback        = NULL;
+    config->deadline_margin        = DEFAULT_DEADLINE_MARGIN;
+    config->deadline_fallback      = SA_DEADLINE_FALLBACK_SILENCE;
+    config->deadline_fallback_time = DEFAULT_DEADLINE_FALLBACK_TIME;
+    config->device_cache_dir       = NULL;
+    config->fallback_device_name   = NULL;
+    config->reconnect_interval     = DEFAULT_RECONNECT_INTERVAL;
+    config->pipeline_depth         = DEFAULT_PIPELINE_DEPTH;
+    config->metering               = false;
+    config->spectrum_size          = 0;
+    config->silence_timeout        = DEFAULT_SILENCE_TIMEOUT;
+    config->silence_check_interval = DEFAULT_SILENCE_CHECK_INTERVAL;
+}
+
+static void init_device_fields(sa_device *device, sa_device_config *config) {
+    memset(device, 0, sizeof(sa_device));
+    device->config = config;
+    device->state  = SA_DEVICE_STOPPED;
+    for(int i = 0; i < SA_MAX_CHANNELS; i++)
+        device->channel_gain[i] = SA_GAIN_ONE;
+    for(unsigned int i = 0; i < SA_EVENT_CAPACITY; i++)
+        device->events.queue[i].sequence = i;
+}
+
+static size_t sa_align_size(size_t size) {
+    return (size + SA_MEMORY_ALIGNMENT - 1) & ~((size_t) SA_MEMORY_ALIGNMENT - 1);
+}
+
+static sa_result allocate_sample_buffer(sa_device *device) {
+    /** The fallback block of the deadline watchdog is placed right behind the samples */
+    size_t sample_bytes   = sa_align_size(device->buffer_size * device->frame_bytes);
+    size_t fallback_bytes = sa_align_size(device->watchdog.fallback_frames * device->frame_bytes);
+    /** followed by the slots of the pipeline */
+    size_t pipeline_bytes = (size_t) device->pipeline.depth * device->pipeline.period_frames * device->frame_bytes;
+    if(device->static_memory)
+    {
+        size_t offset = sa_align_size(sizeof(sa_device)) + sa_align_size(sizeof(sa_device_config));
+        if(offset + sample_bytes + fallback_bytes + pipeline_bytes > device->static_memory_size)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Static memory block is too small for the negotiated ALSA buffer");
+            return SA_ERROR;
+        }
+        device->samples = (int *) ((char *) device->static_memory + offset);
+    } else
+    {
+        device->samples = (int *) malloc(sample_bytes + fallback_bytes + pipeline_bytes);
+        if(!device->samples)
+            return SA_ERROR;
+    }
+    device->watchdog.fallback_samples = fallback_bytes ? (char *) device->samples + sample_bytes : NULL;
+    device->pipeline.slots = pipeline_bytes ? (char *) device->samples + sample_bytes + fallback_bytes : NULL;
+    device->sample_capacity           = device->buffer_size;
+    return SA_SUCCESS;
+}
+
+static sa_result init_alsa_device(sa_device *device) {
+    int err;
+    snd_pcm_hw_params_alloca(&(device->hw_params));
+    snd_pcm_sw_params_alloca(&(device->sw_params));
+
+    if((err = snd_pcm_open(&(device->handle), device->config->alsa_device_name, SND_PCM_STREAM_PLAYBACK, 0)) <
+       0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: playback open error:", snd_strerror(err));
+        device->handle = NULL;
+        return SA_ERROR;
+    }
+    /** With a cache an unsupported configuration is rejected before anything is negotiated */
+    sa_device_info info;
+    memset(&info, 0, sizeof(info));
+    bool cached = device->config->device_cache_dir != NULL;
+    if(cached && check_device_capabilities(device, &info) != SA_SUCCESS)
+        return abort_init_alsa_device(device);
+    cached = cached && info.probed && info.card_id[0] != '\0';
+
+    /** The negotiation rounds the requested times in place */
+    unsigned int buffer_time = device->config->buffer_time;
+    unsigned int period_time = device->config->period_time;
+    if(!cached || set_cached_hardware_parameters(device, SND_PCM_ACCESS_RW_INTERLEAVED, &info) != SA_SUCCESS)
+    {
+        if((err = set_hardware_parameters(device, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: setting hardware parameters failed:", snd_strerror(err));
+            return abort_init_alsa_device(device);
+        }
+        if(cached)
+            remember_hardware_parameters(device, &info, buffer_time, period_time);
+    }
+    if((err = set_software_parameters(device)) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: setting software parameters failed:", snd_strerror(err));
+        return abort_init_alsa_device(device);
+    }
+
+    device->frame_bytes = device->config->channels * snd_pcm_format_physical_width(device->config->format) / 8;
+    device->target_fill            = device->buffer_size;
+    device->stats.latency_us       = (unsigned long long) device->buffer_size * 1000000 / device->config->sample_rate;
+    device->latency_mode           = device->config->latency_mode;
+    device->requested_latency_mode = device->config->latency_mode;
+    if(device->config->deadline_margin > 0)
+    {
+        device->watchdog.fallback_frames = sa_us_to_frames(device, device->config->deadline_fallback_time);
+        if(device->watchdog.fallback_frames < 1)
+            device->watchdog.fallback_frames = 1;
+    }
+    device->apply_gain  = select_gain_function(device);
+    if(device->config->metering && !(device->analysis.meter = select_meter_function(device)))
+        SA_LOG(SA_LOG_LEVEL_WARNING, "Metering is not supported for format",
+               snd_pcm_format_name(device->config->format));
+    if(device->config->silence_timeout > 0)
+    {
+        /** The pattern repeats every 8 bytes, except for 3 byte samples whose silence is not 0 */
+        int width                = snd_pcm_format_physical_width(device->config->format);
+        device->silence_pattern  = snd_pcm_format_silence_64(device->config->format);
+        device->detect_silence   = width != 24 || device->silence_pattern == 0;
+        if(!device->detect_silence)
+            SA_LOG(SA_LOG_LEVEL_WARNING, "Silence detection is not supported for format",
+                   snd_pcm_format_name(device->config->format));
+    }
+    if(device->config->spectrum_size > 0)
+    {
+        int size = device->config->spectrum_size;
+        if(size < 2 || size > SA_MAX_SPECTRUM_SIZE || (size & (size - 1)) != 0)
+            SA_LOG(SA_LOG_LEVEL_WARNING, "spectrum_size must be a power of two up to SA_MAX_SPECTRUM_SIZE");
+        else if(device->static_memory)
+            SA_LOG(SA_LOG_LEVEL_WARNING, "The spectrum is not available for static devices");
+        else if(!(device->analysis.downmix = select_downmix_function(device)))
+            SA_LOG(SA_LOG_LEVEL_WARNING, "The spectrum is not supported for format",
+                   snd_pcm_format_name(device->config->format));
+        else
+            device->analysis.spectrum_size = size;
+    }
+    if(device->config->pipeline_depth > 0)
+    {
+        device->pipeline.depth         = device->config->pipeline_depth;
+        device->pipeline.period_frames = device->period_size;
+        if(device->pipeline.depth > SA_MAX_PIPELINE_DEPTH)
+        {
+            SA_LOG(SA_LOG_LEVEL_WARNING, "pipeline_depth is limited to SA_MAX_PIPELINE_DEPTH");
+            device->pipeline.depth = SA_MAX_PIPELINE_DEPTH;
+        }
+    }
+
+    if(allocate_sample_buffer(device) != SA_SUCCESS)
+    { return abort_init_alsa_device(device); }
+
+    device->supports_pause = snd_pcm_hw_params_can_pause(device->hw_params);
+    if(device->supports_pause)
+    {
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "Device supports snd_pcm_pause()");
+    } else
+    { SA_LOG(SA_LOG_LEVEL_DEBUG, "Device does not support snd_pcm_pause()"); }
+
+    if(prepare_playback_thread(device) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to prepare the playback thread");
+        return abort_init_alsa_device(device);
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result abort_init_alsa_device(sa_device *device) {
+    if(device->samples && !device->static_memory)
+        free(device->samples);
+    device->samples = NULL;
+    snd_pcm_close(device->handle);
+    device->handle = NULL;
+    return SA_ERROR;
+}
+
+static sa_result check_device_capabilities(sa_device *device, sa_device_info *info) {
+    memset(info, 0, sizeof(*info));
+    snprintf(info->name, sizeof(info->name), "%s", device->config->alsa_device_name);
+    /** Virtual PCMs without a card are negotiated as usual */
+    if(!get_pcm_card_id(info->name, device->handle, info->card_id))
+        return SA_SUCCESS;
+
+    if(lookup_device_cache(device->config->device_cache_dir, info) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "Device cache miss, probing", info->name);
+        if(probe_pcm_handle(device->handle, info) != SA_SUCCESS)
+            return SA_SUCCESS;
+        update_device_cache(device->config->device_cache_dir, info);
+    }
+
+    if(!sa_device_supports_format(info, device->config->format))
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Device does not support format", snd_pcm_format_name(device->config->format));
+        return SA_ERROR;
+    }
+    if((unsigned int) device->config->channels < info->min_channels ||
+       (unsigned int) device->config->channels > info->max_channels)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Device does not support the channel count of the configuration");
+        return SA_ERROR;
+    }
+    if(device->config->sample_rate < info->min_rate || device->config->sample_rate > info->max_rate)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Device does not support the sample rate of the configuration");
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result set_cached_hardware_parameters(sa_device *device, snd_pcm_access_t access,
+                                                const sa_device_info *info) {
+    const sa_device_config *config = device->config;
+    if(info->negotiated_buffer_size == 0 || info->negotiated_format != (int32_t) config->format ||
+       info->negotiated_rate != config->sample_rate || info->negotiated_channels != (uint32_t) config->channels ||
+       info->requested_buffer_time != (uint32_t) config->buffer_time ||
+       info->requested_period_time != (uint32_t) config->period_time)
+        return SA_ERROR;
+
+    snd_pcm_uframes_t buffer_size = (snd_pcm_uframes_t) info->negotiated_buffer_size;
+    snd_pcm_uframes_t period_size = (snd_pcm_uframes_t) info->negotiated_period_size;
+    snd_pcm_t *handle             = device->handle;
+    if(snd_pcm_hw_params_any(handle, device->hw_params) < 0 ||
+       snd_pcm_hw_params_set_rate_resample(handle, device->hw_params, 1) < 0 ||
+       snd_pcm_hw_params_set_access(handle, device->hw_params, access) < 0 ||
+       snd_pcm_hw_params_set_format(handle, device->hw_params, config->format) < 0 ||
+       snd_pcm_hw_params_set_channels(handle, device->hw_params, config->channels) < 0 ||
+       snd_pcm_hw_params_set_rate(handle, device->hw_params, config->sample_rate, 0) < 0 ||
+       snd_pcm_hw_params_set_buffer_size(handle, device->hw_params, buffer_size) < 0 ||
+       snd_pcm_hw_params_set_period_size(handle, device->hw_params, period_size, 0) < 0 ||
+       snd_pcm_hw_params(handle, device->hw_params) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA: the cached sizes were refused, negotiating", info->name);
+        return SA_ERROR;
+    }
+    device->buffer_size = buffer_size;
+    device->period_size = period_size;
+    /** Report the times like the negotiation does */
+    int dir = 0;
+    snd_pcm_hw_params_get_buffer_time(device->hw_params, (unsigned int *) &(device->config->buffer_time), &dir);
+    snd_pcm_hw_params_get_period_time(device->hw_params, (unsigned int *) &(device->config->period_time), &dir);
+    return SA_SUCCESS;
+}
+
+static void remember_hardware_parameters(sa_device *device, sa_device_info *info, unsigned int buffer_time,
+                                         unsigned int period_time) {
+    info->negotiated_buffer_size = device->buffer_size;
+    info->negotiated_period_size = device->period_size;
+    info->negotiated_format      = (int32_t) device->config->format;
+    info->negotiated_rate        = device->config->sample_rate;
+    info->negotiated_channels    = (uint32_t) device->config->channels;
+    info->requested_buffer_time  = buffer_time;
+    info->requested_period_time  = period_time;
+    update_device_cache(device->config->device_cache_dir, info);
+}
+
+static sa_result probe_pcm_handle(snd_pcm_t *handle, sa_device_info *info) {
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca(&hw_params);
+    int err = snd_pcm_hw_params_any(handle, hw_params);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: cannot probe", info->name);
+        return SA_ERROR;
+    }
+    info->formats = 0;
+    for(int format = 0; format <= SND_PCM_FORMAT_LAST && format < 64; format++)
+    {
+        if(snd_pcm_hw_params_test_format(handle, hw_params, (snd_pcm_format_t) format) == 0)
+            info->formats |= (uint64_t) 1 << format;
+    }
+    unsigned int value;
+    snd_pcm_uframes_t frames;
+    int dir = 0;
+    snd_pcm_hw_params_get_rate_min(hw_params, &value, &dir);
+    info->min_rate = value;
+    snd_pcm_hw_params_get_rate_max(hw_params, &value, &dir);
+    info->max_rate = value;
+    snd_pcm_hw_params_get_channels_min(hw_params, &value);
+    info->min_channels = value;
+    snd_pcm_hw_params_get_channels_max(hw_params, &value);
+    info->max_channels = value;
+    snd_pcm_hw_params_get_period_size_min(hw_params, &frames, &dir);
+    info->min_period_size = frames;
+    snd_pcm_hw_params_get_period_size_max(hw_params, &frames, &dir);
+    info->max_period_size = frames;
+    snd_pcm_hw_params_get_buffer_size_min(hw_params, &frames);
+    info->min_buffer_size = frames;
+    snd_pcm_hw_params_get_buffer_size_max(hw_params, &frames);
+    info->max_buffer_size = frames;
+    info->supports_pause  = snd_pcm_hw_params_can_pause(hw_params);
+    info->probed          = 1;
+    return SA_SUCCESS;
+}
+
+static bool get_pcm_card_id(const char *name, snd_pcm_t *handle, char *card_id) {
+    card_id[0]           = '\0';
+    const char *argument = strstr(name, "CARD=");
+    if(argument)
+    {
+        argument += strlen("CARD=");
+        size_t length = strcspn(argument, ",");
+        if(length == 0 || length >= 32)
+            return false;
+        memcpy(card_id, argument, length);
+        card_id[length] = '\0';
+        return true;
+    }
+    if(!handle)
+        return false;
+
+    snd_pcm_info_t *pcm_info;
+    snd_pcm_info_alloca(&pcm_info);
+    if(snd_pcm_info(handle, pcm_info) < 0 || snd_pcm_info_get_card(pcm_info) < 0)
+        return false;
+    char control_name[32];
+    snprintf(control_name, sizeof(control_name), "hw:%d", snd_pcm_info_get_card(pcm_info));
+    snd_ctl_t *control;
+    if(snd_ctl_open(&control, control_name, 0) < 0)
+        return false;
+    snd_ctl_card_info_t *card_info;
+    snd_ctl_card_info_alloca(&card_info);
+    bool found = snd_ctl_card_info(control, card_info) == 0;
+    if(found)
+        snprintf(card_id, 32, "%s", snd_ctl_card_info_get_id(card_info));
+    snd_ctl_close(control);
+    return found && card_id[0] != '\0';
+}
+
+/**
+ * @brief header of a device cache file, followed by count sa_device_info records
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    /** Long name of the card the cache was written for */
+    char card_longname[80];
+} sa_device_cache_header;
+
+static sa_result load_device_cache(const char *cache_dir, const char *card_id, sa_device_info **infos,
+                                   int *count) {
+    char path[PATH_MAX];
+    char longname[80];
+    get_device_cache_path(cache_dir, card_id, "", path);
+    if(get_card_longname(card_id, longname) != SA_SUCCESS)
+        return SA_ERROR;
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return SA_ERROR;
+
+    sa_device_cache_header header;
+    sa_device_info *records = NULL;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, SA_DEVICE_CACHE_MAGIC, sizeof(SA_DEVICE_CACHE_MAGIC)) == 0 &&
+                 header.version == SA_DEVICE_CACHE_VERSION && header.count < 1024 &&
+                 strncmp(header.card_longname, longname, sizeof(longname)) == 0;
+    if(valid && header.count > 0)
+    {
+        records = (sa_device_info *) malloc(header.count * sizeof(sa_device_info));
+        valid   = records && fread(records, sizeof(sa_device_info), header.count, file) == header.count;
+    }
+    fclose(file);
+    if(!valid)
+    {
+        free(records);
+        return SA_ERROR;
+    }
+    *infos = records;
+    *count = (int) header.count;
+    return SA_SUCCESS;
+}
+
+static sa_result lookup_device_cache(const char *cache_dir, sa_device_info *info) {
+    sa_device_info *infos = NULL;
+    int count             = 0;
+    if(load_device_cache(cache_dir, info->card_id, &infos, &count) != SA_SUCCESS)
+        return SA_ERROR;
+    sa_result result = SA_ERROR;
+    for(int i = 0; i < count && result != SA_SUCCESS; i++)
+    {
+        if(strncmp(infos[i].name, info->name, sizeof(info->name)) == 0 && infos[i].probed)
+        {
+            char description[sizeof(info->description)];
+            memcpy(description, info->description, sizeof(description));
+            *info = infos[i];
+            /** The hint description is more recent than the cached one */
+            if(description[0] != '\0')
+                memcpy(info->description, description, sizeof(description));
+            result = SA_SUCCESS;
+        }
+    }
+    free(infos);
+    return result;
+}
+
+static sa_result update_device_cache(const char *cache_dir, const sa_device_info *info) {
+    sa_device_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SA_DEVICE_CACHE_MAGIC, sizeof(SA_DEVICE_CACHE_MAGIC));
+    header.version = SA_DEVICE_CACHE_VERSION;
+    if(get_card_longname(info->card_id, header.card_longname) != SA_SUCCESS)
+        return SA_ERROR;
+
+    sa_device_info *infos = NULL;
+    int count             = 0;
+    if(load_device_cache(cache_dir, info->card_id, &infos, &count) != SA_SUCCESS)
+        count = 0;
+    int slot = 0;
+    while(slot < count && strncmp(infos[slot].name, info->name, sizeof(info->name)) != 0)
+        slot++;
+    if(slot == count)
+    {
+        sa_device_info *grown = (sa_device_info *) realloc(infos, (count + 1) * sizeof(sa_device_info));
+        if(!grown)
+        {
+            free(infos);
+            return SA_ERROR;
+        }
+        infos = grown;
+        count++;
+    }
+    infos[slot]  = *info;
+    header.count = (uint32_t) count;
+
+    /** Written next to the cache and renamed, so readers never see a half written file */
+    char path[PATH_MAX];
+    char temporary_path[PATH_MAX];
+    get_device_cache_path(cache_dir, info->card_id, "", path);
+    get_device_cache_path(cache_dir, info->card_id, ".tmp", temporary_path);
+    FILE *file = fopen(temporary_path, "wb");
+    bool valid = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(infos, sizeof(sa_device_info), count, file) == (size_t) count;
+    if(file && fclose(file) != 0)
+        valid = false;
+    free(infos);
+    if(!valid || rename(temporary_path, path) != 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "Failed to write the device cache", path);
+        unlink(temporary_path);
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static void get_device_cache_path(const char *cache_dir, const char *card_id, const char *suffix, char *path) {
+    snprintf(path, PATH_MAX, "%s/simpleALSA-%s.cache%s", cache_dir, card_id, suffix);
+}
+
+static sa_result get_card_longname(const char *card_id, char *longname) {
+    int card = snd_card_get_index(card_id);
+    char *name;
+    if(card < 0 || snd_card_get_longname(card, &name) < 0)
+        return SA_ERROR;
+    memset(longname, 0, 80);
+    snprintf(longname, 80, "%s", name);
+    free(name);
+    return SA_SUCCESS;
+}
+
+static sa_result set_hardware_parameters(sa_device *device, snd_pcm_access_t access) {
+    unsigned int rrate;
+    snd_pcm_uframes_t size;
+    int err, dir;
+
+    err = snd_pcm_hw_params_any(device->handle, device->hw_params);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR,
+               "ALSA: broken configuration for playback: no configurations available:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /** Set the sample_rate */
+    err = snd_pcm_hw_params_set_rate_resample(device->handle, device->hw_params, 1);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: resampling setup failed for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Set the interleaved read/write format */
+    err = snd_pcm_hw_params_set_access(device->handle, device->hw_params, access);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: access type not available for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Set the sample format */
+    err = snd_pcm_hw_params_set_format(device->handle, device->hw_params, device->config->format);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample format not available for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Set the count of channels */
+    err = snd_pcm_hw_params_set_channels(device->handle, device->hw_params, device->config->channels);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: channels count not available for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Set the stream rate */
+    rrate = device->config->sample_rate;
+    err   = snd_pcm_hw_params_set_rate_near(device->handle, device->hw_params, &rrate, 0);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample_rate not available for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    if(rrate != device->config->sample_rate)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample rate does not match the requested rate");
+        return SA_ERROR;
+    }
+    /* Set the buffer time */
+    err = snd_pcm_hw_params_set_buffer_time_near(device->handle, device->hw_params,
+                                                 (unsigned int *) &(device->config->buffer_time), &dir);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set the buffer time for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    err = snd_pcm_hw_params_get_buffer_size(device->hw_params, &size);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to get the buffer size for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    device->buffer_size = size;
+    /* Set the period time */
+    err                 = snd_pcm_hw_params_set_period_time_near(device->handle, device->hw_params,
+                                                                 (unsigned int *) &(device->config->period_time), &dir);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set the period time for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    err = snd_pcm_hw_params_get_period_size(device->hw_params, &size, &dir);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to get period size for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    device->period_size = size;
+    /* Write the parameters to device */
+    err                 = snd_pcm_hw_params(device->handle, device->hw_params);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR,
+               "ALSA: unable to set hardware parameters for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result set_software_parameters(sa_device *device) {
+    int err;
+
+    /* Get the current sw_params */
+    err = snd_pcm_sw_params_current(device->handle, device->sw_params);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR,
+               "ALSA: unable to determine current software parameters for playback:", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Start the transfer according to the configured start policy */
+    err = snd_pcm_sw_params_set_start_threshold(device->handle, device->sw_params,
+                                                get_start_threshold(device));
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to start set threshold mode for playback",
+               snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Allow the transfer when at least period_size samples can be processed */
+    /* or disable this mechanism when period event is enabled (aka interrupt like style processing) */
+    err = snd_pcm_sw_params_set_avail_min(device->handle, device->sw_params,
+                                          0 ? device->buffer_size : device->period_size);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set available minimum for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    /* Enable period events when requested */
+    if(0)
+    {
+        err = snd_pcm_sw_params_set_period_event(device->handle, device->sw_params, 1);
+        if(err < 0)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set period event", snd_strerror(err));
+            return SA_ERROR;
+        }
+    }
+    /* Write the parameters to the playback device */
+    err = snd_pcm_sw_params(device->handle, device->sw_params);
+    if(err < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set software parameters for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static snd_pcm_uframes_t get_start_threshold(sa_device *device) {
+    switch(device->config->start_policy)
+    {
+    case SA_START_IMMEDIATELY:
+        return 1;
+    case SA_START_AFTER_FRAMES:
+        if(device->config->start_threshold < 1)
+            return 1;
+        if(device->config->start_threshold > device->buffer_size)
+            return device->buffer_size;
+        return device->config->start_threshold;
+    case SA_START_WHEN_FULL:
+    default:
+        /* Start the transfer when the buffer is almost full: (buffer_size / avail_min) * avail_min */
+        return (device->buffer_size / device->period_size) * device->period_size;
+    }
+}
+
+static sa_result prepare_playback_thread(sa_device *device) {
+    /** Prepare communication pipe */
+    int pipe_fds[2];
+    if(pipe(pipe_fds) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Cannot create poll_pipe");
+        return SA_ERROR;
+    }
+    /** Makes read end nonblocking */
+    if(fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to make pipe non-blocking");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    /** Store the write end */
+    device->pipe_write_end = pipe_fds[1];
+    /** Prepare the poll descriptors once, they are reused for every start */
+    if(init_poll_management(device, pipe_fds[0]) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not initialize the poll manager");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    /** Prepare the condition variable*/
+    pthread_mutex_init(&(device->condition_var.mutex), NULL);
+    pthread_cond_init(&(device->condition_var.cond), NULL);
+    device->condition_var.is_stopped = true;
+    /** Prepare stateMutex and statsMutex */
+    pthread_mutex_init(&(device->stateMutex), NULL);
+    pthread_mutex_init(&(device->statsMutex), NULL);
+    /** Startup the deadline watchdog (if configured) and the playback thread */
+    if(init_deadline_watchdog(device) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the deadline watchdog thread");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    if(init_pipeline(device) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the pipeline worker thread");
+        close_deadline_watchdog(device);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    if(init_analysis(device) != SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the spectrum worker thread");
+        close_pipeline(device);
+        close_deadline_watchdog(device);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    if(pthread_create(&device->playback_thread, NULL, &init_playback_thread, (void *) device) != 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the playback thread");
+        close_analysis(device);
+        close_pipeline(device);
+        close_deadline_watchdog(device);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result start_alsa_device(sa_device *device) {
+    return unpause_alsa_device(device);
+}
+
+static void *init_playback_thread(void *data) {
+    char command;
+    sa_device *device               = (sa_device *) data;
+    struct pollfd *pipe_read_end_fd = &(device->poll_manager.ufds[0]);
+
+    /** Actual playback loop, lives and dies with the device */
+    while(1)
+    {
+        /** Poll on read end, wait for initial play command */
+        poll(pipe_read_end_fd, 1, -1);
+
+        if(pipe_read_end_fd->revents & POLLIN)
+        {
+            if(read(pipe_read_end_fd->fd, &command, 1) != 1)
+            {
+                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+            } else
+            {
+                SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+                switch(command)
+                {
+                /** Play command */
+                case 'u':
+                    {
+                        /** Save state */
+                        save_device_state(device, SA_DEVICE_STARTED);
+                        /** Start playback */
+                        sa_result res = start_write_and_poll_loop(device);
+                        /** The write and poll loop can end in three ways: error, a stop command is sent, or
+                         * no more audio is send to the audio buffer */
+                        if(res == SA_ERROR)
+                        {
+                            save_device_state(device, SA_DEVICE_STOPPED);
+                            break;
+                        } else if(res == SA_STOP)
+                        {
+                            /** There is no handle when the device was stopped while the PCM was lost */
+                            if(device->handle)
+                            {
+                                drop_alsa_device(device);
+                                prepare_alsa_device(device);
+                            }
+                            save_device_state(device, SA_DEVICE_STOPPED);
+
+                        } else if(res == SA_AT_END)
+                        {
+                            /** Received no frames anymore from the callback so we stop and prepare the alsa device again */
+                            res = drain_alsa_device(device);
+                            prepare_alsa_device(device);
+                            save_device_state(device, SA_DEVICE_STOPPED);
+                            /** Signal eof once the last frame was played, not when a stop cut the drain short */
+                            if(res != SA_STOP)
+                            {
+                                void (*eof_callback)(sa_device * sa_device, void *my_custom_data) =
+                                  (void (*)(sa_device *, void *my_custom_data)) device->config->eof_callback;
+                                eof_callback(device, device->config->my_custom_data);
+                            }
+                        }
+                        continue;
+                    }
+                /** Destroy command, no continue; break out of while */
+                case 'd':
+                    break;
+                default:
+                    SA_LOG(SA_LOG_LEVEL_DEBUG, "Command sent to the pipe is ignored");
+                    continue;
+                }
+                SA_LOG(SA_LOG_LEVEL_DEBUG, "Attempting to destroy the device");
+                break;
+            }
+        }
+    }
+    close(pipe_read_end_fd->fd);
+    return NULL;
+}
+
+static sa_result start_write_and_poll_loop(sa_device *device) {
+    sa_result res = SA_SUCCESS;
+    start_pipeline(device);
+    /** The PCM was lost and not yet reopened when the device was stopped, continue trying */
+    if(!device->handle)
+        res = reconnect_alsa_device(device);
+    else if(apply_latency_mode(device, get_requested_latency_mode(device), false) != SA_SUCCESS)
+        res = SA_ERROR;
+    if(res == SA_SUCCESS)
+        res = write_and_poll_loop(device, &(device->poll_manager));
+    /** The data callback is not called while the device is stopped, also not by the pipeline worker */
+    stop_pipeline(device);
+    return res;
+}
+
+static sa_result init_poll_management(sa_device *device, int pipe_read_end) {
+    sa_poll_management *poll_manager = &(device->poll_manager);
+    int err;
+
+    poll_manager->count = 1 + snd_pcm_poll_descriptors_count(device->handle);
+    /** There must be at least one alsa descriptor */
+    if(poll_manager->count <= 1)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Invalid poll descriptor count");
+        return SA_ERROR;
+    }
+    if(poll_manager->count > SA_MAX_POLL_DESCRIPTORS)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Too many poll descriptors, increase SA_MAX_POLL_DESCRIPTORS");
+        return SA_ERROR;
+    }
+    /** Store read end of pipe in the array */
+    poll_manager->ufds[0].fd     = pipe_read_end;
+    poll_manager->ufds[0].events = POLLIN;
+
+    /** Don't give ALSA the first poll descriptor */
+    if((err = snd_pcm_poll_descriptors(device->handle, poll_manager->ufds + 1, poll_manager->count - 1)) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to obtain poll descriptors for playback", snd_strerror(err));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result close_playback_thread(sa_device *device) {
+    if(pthread_join(device->playback_thread, NULL) != 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not join playback thread");
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result write_and_poll_loop(sa_device *device, sa_poll_management *poll_manager) {
+    char *ptr;
+    int err, cptr, readcount;
+    sa_result res;
+    device->silent_frames = 0;
+    /** Fill the whole buffer in one go so the PCM starts without waiting for a poll per period */
+    if((res = prefill_alsa_buffer(device)) == SA_DEVICE_LOST)
+        res = recover_lost_device(device);
+    if(res != SA_SUCCESS)
+        return res;
+    while(1)
+    {
+        /** The frames before a pause event have been written, they are played before the PCM stops */
+        if(device->events.pause_pending)
+        {
+            if((res = pause_on_event(device, poll_manager)) == SA_DEVICE_LOST)
+                res = recover_lost_device(device);
+            if(res != SA_SUCCESS)
+                return res;
+            continue;
+        }
+        err = wait_for_poll(device, poll_manager);
+
+        if(err < 0)
+        {
+            /** The buffer is refilled completely by the recovery, so go back to polling */
+            if((res = recover_from_poll_error(device)) != SA_SUCCESS)
+                return res;
+            continue;
+        } else if(err == SA_STOP)
+        { return SA_STOP; }
+
+        snd_pcm_sframes_t frames = get_frames_to_request(device);
+        if(frames < 0)
+        {
+            if((res = recover_alsa_device(device, frames)) != SA_SUCCESS)
+                return res;
+            continue;
+        }
+        adapt_latency(device);
+        if(frames == 0)
+        { continue; }
+        /** If the callback has not written any frames in the previous call- there are no frames left so we stop the callback loop */
+
+        arm_deadline_watchdog(device);
+        SA_TRACE_BEGIN(device, SA_TRACE_CALLBACK, frames);
+        readcount = render_period(device, device->samples, frames);
+        SA_TRACE_END(device, SA_TRACE_CALLBACK, readcount);
+        disarm_deadline_watchdog(device, device->samples, readcount);
+
+        if(readcount == 0)
+        {
+            if(device->events.pause_pending)
+                continue;
+            return SA_AT_END;
+        }
+
+        analyze_samples(device, device->samples, readcount);
+        if(device->detect_silence)
+            device->silent_frames =
+              is_silent(device, device->samples, readcount) ? device->silent_frames + readcount : 0;
+        ptr  = (char *) device->samples;
+        cptr = readcount;
+
+        while(cptr > 0)
+        {
+            SA_TRACE_BEGIN(device, SA_TRACE_WRITE, cptr);
+            err = write_alsa_frames(device, ptr, cptr);
+            SA_TRACE_END(device, SA_TRACE_WRITE, err);
+            if(err < 0)
+            {
+                /** The remainder of this period is dropped, the recovery has already refilled the buffer */
+                if((res = recover_alsa_device(device, err)) != SA_SUCCESS)
+                    return res;
+                break;
+            }
+            /** Advance in bytes, the sample width depends on the format */
+            ptr += err * device->frame_bytes;
+            cptr -= err;
+            if(cptr == 0)
+                break;
+            /* It is possible, that the initial buffer cannot store all data from the last period, so wait a while */
+            err = wait_for_poll(device, poll_manager);
+            if(err < 0)
+            {
+                if((res = recover_from_poll_error(device)) != SA_SUCCESS)
+                    return res;
+                break;
+            } else if(err == SA_STOP)
+            { return SA_STOP; }
+        }
+        /** A prefill that came up short leaves the PCM prepared until enough frames are queued */
+        if((err = start_if_threshold_reached(device)) < 0 && (res = recover_alsa_device(device, err)) != SA_SUCCESS)
+            return res;
+        /** Only sleep once everything left in the ALSA buffer is silent as well */
+        if(device->detect_silence && device->silent_frames >= device->buffer_size &&
+           device->silent_frames >= sa_us_to_frames(device, device->config->silence_timeout))
+        {
+            device->silent_frames = 0;
+            if((res = sleep_on_silence(device, poll_manager)) == SA_DEVICE_LOST)
+                res = recover_lost_device(device);
+            if(res != SA_SUCCESS)
+                return res;
+        }
+    }
+    return SA_SUCCESS;
+}
+
+static snd_pcm_sframes_t get_frames_to_request(sa_device *device) {
+    if(!device->config->bulk_fill && device->config->latency_profile == SA_LATENCY_PROFILE_FIXED)
+        return device->period_size;
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(device->handle);
+    if(avail < 0)
+        return avail;
+    if(device->config->latency_profile != SA_LATENCY_PROFILE_FIXED)
+    {
+        snd_pcm_sframes_t fill = device->buffer_size - avail;
+        if(fill < device->adaptive.min_fill)
+            device->adaptive.min_fill = fill;
+        /** Top up to the fill level of the active mode, this may be 0 right after a switch */
+        snd_pcm_sframes_t missing = device->target_fill - fill;
+        return missing > 0 ? missing : 0;
+    }
+    if(avail < device->period_size)
+        return device->period_size;
+    if(avail > device->buffer_size)
+        return device->buffer_size;
+    return avail;
+}
+
+static sa_result recover_from_poll_error(sa_device *device) {
+    snd_pcm_state_t state = snd_pcm_state(device->handle);
+    if(state == SND_PCM_STATE_XRUN || state == SND_PCM_STATE_SUSPENDED)
+        return recover_alsa_device(device, state == SND_PCM_STATE_XRUN ? -EPIPE : -ESTRPIPE);
+    if(state == SND_PCM_STATE_DISCONNECTED)
+        return recover_lost_device(device);
+    SA_LOG(SA_LOG_LEVEL_ERROR, "Wait for poll failed");
+    return SA_ERROR;
+}
+
+static sa_result recover_alsa_device(sa_device *device, int err) {
+    if(is_device_lost(device, err))
+        return recover_lost_device(device);
+    unsigned long long start_us = sa_get_time_us();
+    SA_TRACE_BEGIN(device, SA_TRACE_RECOVERY, err);
+    sa_result result = xrun_recovery(device, err);
+    if(result != SA_SUCCESS)
+    {
+        SA_TRACE_END(device, SA_TRACE_RECOVERY, result);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Write error:", snd_strerror(err));
+        return result;
+    }
+    /** Refill the whole buffer right away so the next xrun does not follow immediately */
+    result                         = prefill_alsa_buffer(device);
+    unsigned long long duration_us = sa_get_time_us() - start_us;
+    SA_TRACE_END(device, SA_TRACE_RECOVERY, result);
+    if(result == SA_DEVICE_LOST)
+        return recover_lost_device(device);
+
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.recovery_time_us += duration_us;
+    if(duration_us > device->stats.max_recovery_time_us)
+        device->stats.max_recovery_time_us = duration_us;
+    pthread_mutex_unlock(&(device->statsMutex));
+    return result;
+}
+
+static sa_result prefill_alsa_buffer(sa_device *device) {
+    snd_pcm_sframes_t avail;
+    int err, readcount;
+
+    avail = snd_pcm_avail_update(device->handle);
+    if(avail < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: avail update failed during prefill:", snd_strerror(avail));
+        return is_device_lost(device, avail) ? SA_DEVICE_LOST : SA_ERROR;
+    }
+    if(avail > device->buffer_size)
+        avail = device->buffer_size;
+    /** Only fill up to the fill level of the active latency mode */
+    avail -= device->buffer_size - device->target_fill;
+
+    if(avail > 0)
+    {
+        /** Ask for all the available space at once, the samples buffer holds a complete ALSA buffer */
+        SA_TRACE_BEGIN(device, SA_TRACE_CALLBACK, avail);
+        readcount = render_period(device, device->samples, avail);
+        SA_TRACE_END(device, SA_TRACE_CALLBACK, readcount);
+        /** Nothing is rendered when a pause event is due right away, the write loop pauses */
+        if(readcount == 0)
+            return device->events.pause_pending ? SA_SUCCESS : SA_AT_END;
+
+        analyze_samples(device, device->samples, readcount);
+        /** There is room for all these frames, so this write does not block */
+        SA_TRACE_BEGIN(device, SA_TRACE_WRITE, readcount);
+        err = write_alsa_frames(device, device->samples, readcount);
+        SA_TRACE_END(device, SA_TRACE_WRITE, err);
+        if(err < 0)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Write error during prefill:", snd_strerror(err));
+            return is_device_lost(device, err) ? SA_DEVICE_LOST : SA_ERROR;
+        }
+    }
+    if((err = start_if_threshold_reached(device)) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Failed to start the pcm after prefill:", snd_strerror(err));
+        return is_device_lost(device, err) ? SA_DEVICE_LOST : SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static int start_if_threshold_reached(sa_device *device) {
+    if(snd_pcm_state(device->handle) != SND_PCM_STATE_PREPARED)
+        return 0;
+    /** ALSA starts by itself at the start threshold, unless the write loop never fills the buffer that far */
+    snd_pcm_sframes_t threshold = get_start_threshold(device);
+    if(threshold > device->target_fill)
+        threshold = device->target_fill;
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(device->handle);
+    if(avail < 0)
+        return avail;
+    if(device->buffer_size - avail < threshold)
+        return 0;
+    return snd_pcm_start(device->handle);
+}
+
+static bool is_device_lost(sa_device *device, int err) {
+    if(err == -ENODEV)
+        return true;
+    return device->handle && snd_pcm_state(device->handle) == SND_PCM_STATE_DISCONNECTED;
+}
+
+static sa_result recover_lost_device(sa_device *device) {
+    SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: lost the playback device", device->config->alsa_device_name);
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.device_losses++;
+    pthread_mutex_unlock(&(device->statsMutex));
+    /** Every call on a disconnected handle fails, only closing it releases the card */
+    close_playback_handle(device);
+    return reconnect_alsa_device(device);
+}
+
+static sa_result reconnect_alsa_device(sa_device *device) {
+    unsigned long long start_us = sa_get_time_us();
+    sa_result result;
+    SA_TRACE_BEGIN(device, SA_TRACE_RECOVERY, -ENODEV);
+    for(int attempt = 0;; attempt++)
+    {
+        if(attempt > 0 && (result = wait_for_reconnect(device)) != SA_SUCCESS)
+            break;
+        if(reopen_alsa_device(device) != SA_SUCCESS)
+            continue;
+        result = prefill_alsa_buffer(device);
+        if(result != SA_DEVICE_LOST)
+            break;
+        close_playback_handle(device);
+    }
+    unsigned long long duration_us = sa_get_time_us() - start_us;
+    SA_TRACE_END(device, SA_TRACE_RECOVERY, result);
+
+    pthread_mutex_lock(&(device->statsMutex));
+    if(device->handle)
+        device->stats.reconnects++;
+    device->stats.recovery_time_us += duration_us;
+    if(duration_us > device->stats.max_recovery_time_us)
+        device->stats.max_recovery_time_us = duration_us;
+    pthread_mutex_unlock(&(device->statsMutex));
+    return result;
+}
+
+static sa_result reopen_alsa_device(sa_device *device) {
+    if(open_playback_handle(device, device->config->alsa_device_name) == SA_SUCCESS)
+        return SA_SUCCESS;
+    if(device->config->fallback_device_name &&
+       open_playback_handle(device, device->config->fallback_device_name) == SA_SUCCESS)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: playing on the fallback device", device->config->fallback_device_name);
+        return SA_SUCCESS;
+    }
+    return SA_ERROR;
+}
+
+static sa_result open_playback_handle(sa_device *device, const char *alsa_device_name) {
+    int err;
+    #ifdef SA_SIMULATE_DEVICE_LOSS
+    if(__atomic_load_n(&(device->simulated_reopen_failures), __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_sub_fetch(&(device->simulated_reopen_failures), 1, __ATOMIC_RELAXED);
+        return SA_ERROR;
+    }
+    #endif
+    if((err = snd_pcm_open(&(device->handle), alsa_device_name, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA: reopening the playback device failed:", snd_strerror(err));
+        device->handle = NULL;
+        return SA_ERROR;
+    }
+    snd_pcm_hw_params_alloca(&(device->hw_params));
+    snd_pcm_sw_params_alloca(&(device->sw_params));
+    if(set_hardware_parameters(device, SND_PCM_ACCESS_RW_INTERLEAVED) != SA_SUCCESS ||
+       set_software_parameters(device) != SA_SUCCESS)
+    {
+        close_playback_handle(device);
+        return SA_ERROR;
+    }
+    /** Callbacks and the buffers of an sa_mixer were sized for the buffer that was negotiated first */
+    if(device->buffer_size > device->sample_capacity)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: the reopened device needs a larger buffer:", alsa_device_name);
+        close_playback_handle(device);
+        return SA_ERROR;
+    }
+    device->supports_pause = snd_pcm_hw_params_can_pause(device->hw_params);
+    device->target_fill    = device->buffer_size;
+    if(init_poll_management(device, device->poll_manager.ufds[0].fd) != SA_SUCCESS ||
+       apply_latency_mode(device, get_requested_latency_mode(device), false) != SA_SUCCESS)
+    {
+        close_playback_handle(device);
+        return SA_ERROR;
+    }
+    SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: reopened the playback device", alsa_device_name);
+    return SA_SUCCESS;
+}
+
+static void close_playback_handle(sa_device *device) {
+    if(!device->handle)
+        return;
+    int err = snd_pcm_close(device->handle);
+    if(err < 0)
+    { SA_LOG(SA_LOG_LEVEL_DEBUG, "Could not close handle : ", snd_strerror(err)); }
+    device->handle = NULL;
+}
+
+static sa_result wait_for_reconnect(sa_device *device) {
+    struct pollfd *pipe_read_end_fd = &(device->poll_manager.ufds[0]);
+    bool paused                     = false;
+    char command;
+    while(1)
+    {
+        int ready = poll(pipe_read_end_fd, 1, paused ? -1 : device->config->reconnect_interval / 1000);
+        if(ready == 0)
+            return SA_SUCCESS;
+        if(ready < 0 || !(pipe_read_end_fd->revents & POLLIN))
+            continue;
+        if(read(pipe_read_end_fd->fd, &command, 1) != 1)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+            continue;
+        }
+        SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+        switch(command)
+        {
+        case 's':
+            return SA_STOP;
+        case 'p':
+            paused = true;
+            break;
+        case 'u':
+            if(paused)
+            {
+                save_device_state(device, SA_DEVICE_STARTED);
+                return SA_SUCCESS;
+            }
+            break;
+        /** A latency mode switch is picked up when the PCM is reopened */
+        default:
+            break;
+        }
+    }
+}
+
+static sa_result sleep_on_silence(sa_device *device, sa_poll_management *poll_manager) {
+    struct pollfd *pipe_read_end_fd = &(poll_manager->ufds[0]);
+    snd_pcm_sframes_t check_frames  = sa_us_to_frames(device, device->config->silence_check_interval);
+    int timeout_ms                  = device->config->silence_check_interval / 1000;
+    unsigned long long start_us     = sa_get_time_us();
+    bool paused                     = false;
+    sa_result result                = SA_SUCCESS;
+    char command;
+    if(check_frames < 1)
+        check_frames = 1;
+    if(check_frames > device->buffer_size)
+        check_frames = device->buffer_size;
+
+    /**
+     * Pausing would keep the queued silence and delay the restart by the whole fill level, so it is dropped. The
+     * last silent write may have left the PCM in XRUN, drop_alsa_device() accepts that state too
+     */
+    if(drop_alsa_device(device) != SA_SUCCESS || prepare_alsa_device(device) != SA_SUCCESS)
+        return is_device_lost(device, 0) ? SA_DEVICE_LOST : SA_ERROR;
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "Output is silent, the PCM is stopped");
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.silence_sleeps++;
+    pthread_mutex_unlock(&(device->statsMutex));
+
+    while(1)
+    {
+        int ready = poll(pipe_read_end_fd, 1, paused ? -1 : (timeout_ms > 0 ? timeout_ms : 1));
+        if(ready > 0 && (pipe_read_end_fd->revents & POLLIN))
+        {
+            if(read(pipe_read_end_fd->fd, &command, 1) != 1)
+            {
+                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+                continue;
+            }
+            SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+            if(command == 's')
+            {
+                result = SA_STOP;
+                break;
+            } else if(command == 'p')
+            {
+                paused = true;
+            } else if(command == 'u' && paused)
+            {
+                paused = false;
+                save_device_state(device, SA_DEVICE_STARTED);
+            } else if(command == 'm')
+            { apply_latency_mode(device, get_requested_latency_mode(device), false); }
+            continue;
+        }
+        if(ready != 0)
+            continue;
+
+        int readcount = render_period(device, device->samples, check_frames);
+        if(readcount == 0)
+        {
+            result = device->events.pause_pending ? SA_SUCCESS : SA_AT_END;
+            break;
+        }
+        analyze_samples(device, device->samples, readcount);
+        if(!is_silent(device, device->samples, readcount))
+        {
+            result = wake_from_silence(device, readcount);
+            break;
+        }
+        /** The silence before a pause event is not played, the write loop pauses */
+        if(device->events.pause_pending)
+            break;
+    }
+
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.silence_sleep_time_us += sa_get_time_us() - start_us;
+    pthread_mutex_unlock(&(device->statsMutex));
+    return result;
+}
+
+static sa_result wake_from_silence(sa_device *device, int frames) {
+    int err;
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "Output is no longer silent, the PCM is restarted");
+    /** A single callback for the rest of the fill level could take longer than the queued frames last, so it is
+     * rendered period by period while the first two periods play */
+    snd_pcm_sframes_t start_fill = 2 * device->period_size;
+    if(start_fill > device->target_fill)
+        start_fill = device->target_fill;
+    snd_pcm_sframes_t queued = 0;
+    while(frames > 0)
+    {
+        SA_TRACE_BEGIN(device, SA_TRACE_WRITE, frames);
+        err = write_alsa_frames(device, device->samples, frames);
+        SA_TRACE_END(device, SA_TRACE_WRITE, err);
+        /** The recovery prepares the PCM again and refills it, the frames of this check are lost */
+        if(err < 0)
+            return recover_alsa_device(device, err);
+        queued += err;
+        if(queued >= start_fill && snd_pcm_state(device->handle) == SND_PCM_STATE_PREPARED &&
+           (err = snd_pcm_start(device->handle)) < 0)
+            return recover_alsa_device(device, err);
+        if(queued >= device->target_fill)
+            break;
+
+        snd_pcm_sframes_t request = device->target_fill - queued;
+        if(request > device->period_size)
+            request = device->period_size;
+        SA_TRACE_BEGIN(device, SA_TRACE_CALLBACK, request);
+        frames = render_period(device, device->samples, request);
+        SA_TRACE_END(device, SA_TRACE_CALLBACK, frames);
+        /** The end of the stream or a pause event is handled by the write loop */
+        if(frames > 0)
+            analyze_samples(device, device->samples, frames);
+    }
+    /** A stream that ended before two periods were queued still plays what it got */
+    if(snd_pcm_state(device->handle) == SND_PCM_STATE_PREPARED && (err = snd_pcm_start(device->handle)) < 0)
+        return recover_alsa_device(device, err);
+    return SA_SUCCESS;
+}
+
+static sa_result pause_on_event(sa_device *device, sa_poll_management *poll_manager) {
+    struct pollfd *pipe_read_end_fd = &(poll_manager->ufds[0]);
+    char command;
+    device->events.pause_pending = false;
+    device->silent_frames        = 0;
+
+    /** Pausing the PCM would hold back the frames before the event, so they are drained instead */
+    if(snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING && drain_alsa_device(device) == SA_STOP)
+        return SA_STOP;
+    if(prepare_alsa_device(device) != SA_SUCCESS)
+        return is_device_lost(device, 0) ? SA_DEVICE_LOST : SA_ERROR;
+    save_device_state(device, SA_DEVICE_PAUSED);
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "Paused by an event");
+
+    while(1)
+    {
+        poll(pipe_read_end_fd, 1, -1);
+        if(!(pipe_read_end_fd->revents & POLLIN))
+            continue;
+        if(read(pipe_read_end_fd->fd, &command, 1) != 1)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+            continue;
+        }
+        SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+        if(command == 's')
+            return SA_STOP;
+        if(command == 'u')
+            break;
+        if(command == 'm')
+            apply_latency_mode(device, get_requested_latency_mode(device), false);
+    }
+    save_device_state(device, SA_DEVICE_STARTED);
+    return prefill_alsa_buffer(device);
+}
+
+static snd_pcm_sframes_t write_alsa_frames(sa_device *device, const void *buffer, snd_pcm_uframes_t frames) {
+    #ifdef SA_SIMULATE_DEVICE_LOSS
+    if(__atomic_exchange_n(&(device->simulated_loss), 0, __ATOMIC_ACQ_REL))
+        return -ENODEV;
+    #endif
+    return snd_pcm_writei(device->handle, buffer, frames);
+}
+
+static unsigned long long sa_get_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static int wait_for_poll(sa_device *device, sa_poll_management *poll_manager) {
+    unsigned short revents;
+    char command;
+    while(1)
+    {
+        /** A period is the number of frames in between each hardware interrupt. The poll() will return once a period */
+        SA_TRACE_BEGIN(device, SA_TRACE_POLL, 0);
+        poll(poll_manager->ufds, poll_manager->count, -1);
+        SA_TRACE_END(device, SA_TRACE_POLL, 0);
+
+        if(poll_manager->ufds[0].revents & POLLIN)
+        {
+            if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
+            {
+                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+            } else
+            {
+                SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+                switch(command)
+                {
+                /** Stop playback */
+                case 's':
+                    return SA_STOP;
+                    break;
+                /** Pause playback */
+                case 'p':
+                    {
+                        sa_result res = pause_callback_loop(poll_manager, device);
+                        /** The 'paused' state can end in 2 ways: either a stop command kills the device or an unpause command resumes playback */
+                        if(res == SA_STOP)
+                        { return SA_STOP; }
+
+                        if(res == SA_UNPAUSE)
+                        {
+                            unpause_PCM_handle(device);
+                            save_device_state(device, SA_DEVICE_STARTED);
+                            /** The latency mode may have been changed while paused */
+                            apply_latency_mode(device, get_requested_latency_mode(device), true);
+                        }
+
+                        break;
+                    }
+                /** Switch latency mode */
+                case 'm':
+                    apply_latency_mode(device, get_requested_latency_mode(device), true);
+                    break;
+                default:
+                    SA_LOG(SA_LOG_LEVEL_DEBUG, "Command sent to the pipe is ignored");
+                    break;
+                }
+            }
+        } else
+        {
+            int err = snd_pcm_poll_descriptors_revents(device->handle, poll_manager->ufds + 1,
+                                                       poll_manager->count - 1, &revents);
+            /** An unplugged PCM reports POLLERR or POLLHUP, recover_from_poll_error() tells it from an xrun */
+            if(err < 0 || (revents & (POLLERR | POLLHUP | POLLNVAL)))
+                return -EIO;
+            if(revents & POLLOUT)
+                return SA_SUCCESS;
+        }
+    }
+    SA_LOG(SA_LOG_LEVEL_ERROR, "Poll loop ended without proper return");
+    return -1;
+}
+
+static sa_result apply_latency_mode(sa_device *device, sa_latency_mode mode, bool running) {
+    snd_pcm_sframes_t target_fill, wake_level;
+    /** The adaptive level survives a restart, it is only clamped to the bounds of the (re)opened PCM */
+    if(device->config->latency_profile == SA_LATENCY_PROFILE_ADAPTIVE)
+        return set_adaptive_fill(device, device->target_fill);
+    if(device->config->latency_profile != SA_LATENCY_PROFILE_DUAL)
+        return SA_SUCCESS;
+
+    if(mode == SA_LATENCY_MODE_LOW)
+    {
+        /** Keep low_latency_time in the buffer and wake up as soon as a period can be written - with a single
+         * period the wakeup would only come once the buffer ran dry */
+        target_fill = sa_us_to_frames(device, device->config->low_latency_time);
+        if(target_fill < 2 * device->period_size)
+            target_fill = 2 * device->period_size;
+        if(target_fill > device->buffer_size)
+            target_fill = device->buffer_size;
+        wake_level = target_fill - device->period_size;
+    } else
+    {
+        /** Keep the buffer full and sleep until only deep_wakeup_time is left */
+        target_fill = device->buffer_size;
+        wake_level  = sa_us_to_frames(device, device->config->deep_wakeup_time);
+        if(wake_level > device->buffer_size - device->period_size)
+            wake_level = device->buffer_size - device->period_size;
+        if(wake_level < 0)
+            wake_level = 0;
+    }
+
+    if(running && mode == SA_LATENCY_MODE_LOW && device->latency_mode == SA_LATENCY_MODE_DEEP)
+        rewind_excess_frames(device, target_fill);
+
+    /** poll only reports POLLOUT once the fill level dropped to wake_level */
+    if(set_avail_min(device, device->buffer_size - wake_level) != SA_SUCCESS)
+        return SA_ERROR;
+    device->target_fill  = target_fill;
+    device->latency_mode = mode;
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.latency_us = (unsigned long long) target_fill * 1000000 / device->config->sample_rate;
+    pthread_mutex_unlock(&(device->statsMutex));
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "Latency mode applied:", mode == SA_LATENCY_MODE_LOW ? "low" : "deep");
+    return SA_SUCCESS;
+}
+
+static sa_latency_mode get_requested_latency_mode(sa_device *device) {
+    return (sa_latency_mode) __atomic_load_n(&(device->requested_latency_mode), __ATOMIC_ACQUIRE);
+}
+
+static sa_result set_adaptive_fill(sa_device *device, snd_pcm_sframes_t target_fill) {
+    sa_adaptive_latency *adaptive = &(device->adaptive);
+    snd_pcm_sframes_t min_fill    = sa_us_to_frames(device, device->config->adaptive_min_time);
+    snd_pcm_sframes_t max_fill    = device->config->adaptive_max_time > 0
+                                      ? sa_us_to_frames(device, device->config->adaptive_max_time)
+                                      : device->buffer_size;
+    if(max_fill > device->buffer_size)
+        max_fill = device->buffer_size;
+    /** With one period the wakeup only comes once the buffer ran dry, like in SA_LATENCY_MODE_LOW */
+    if(min_fill < 2 * device->period_size)
+        min_fill = 2 * device->period_size;
+    if(target_fill > max_fill)
+        target_fill = max_fill;
+    if(target_fill < min_fill)
+        target_fill = min_fill;
+
+    /** poll only reports POLLOUT once a period fits below the fill level */
+    if(set_avail_min(device, device->buffer_size - (target_fill - device->period_size)) != SA_SUCCESS)
+        return SA_ERROR;
+
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.latency_us = (unsigned long long) target_fill * 1000000 / device->config->sample_rate;
+    adaptive->events =
+      device->stats.xrun_count + device->stats.deadline_misses + device->stats.pipeline_late_periods;
+    pthread_mutex_unlock(&(device->statsMutex));
+
+    device->target_fill       = target_fill;
+    adaptive->stable_since_us = sa_get_time_us();
+    adaptive->min_fill        = device->buffer_size;
+    return SA_SUCCESS;
+}
+
+static void adapt_latency(sa_device *device) {
+    sa_adaptive_latency *adaptive = &(device->adaptive);
+    if(device->config->latency_profile != SA_LATENCY_PROFILE_ADAPTIVE)
+        return;
+
+    /** Only the playback thread changes these counters, so they are read without the lock */
+    unsigned long events =
+      device->stats.xrun_count + device->stats.deadline_misses + device->stats.pipeline_late_periods;
+    snd_pcm_sframes_t previous_fill = device->target_fill;
+    unsigned long long now_us       = sa_get_time_us();
+    if(events != adaptive->events)
+    {
+        /** Back off fast, come down slowly */
+        set_adaptive_fill(device, device->target_fill * 2);
+    } else if(adaptive->min_fill < device->target_fill - device->period_size - device->period_size / 2)
+    {
+        /** A wakeup more than half a period late is a near miss, the level is kept for another interval */
+        adaptive->stable_since_us = now_us;
+        adaptive->min_fill        = device->buffer_size;
+        return;
+    } else if(now_us - adaptive->stable_since_us >= (unsigned long long) device->config->adaptive_stable_time)
+    { set_adaptive_fill(device, device->target_fill - device->period_size); }
+
+    if(device->target_fill == previous_fill)
+        return;
+    SA_LOG(SA_LOG_LEVEL_DEBUG, device->target_fill > previous_fill ? "Adaptive fill level raised"
+                                                                   : "Adaptive fill level lowered");
+    pthread_mutex_lock(&(device->statsMutex));
+    if(device->target_fill > previous_fill)
+        device->stats.latency_raises++;
+    else
+        device->stats.latency_drops++;
+    pthread_mutex_unlock(&(device->statsMutex));
+}
+
+static void rewind_excess_frames(sa_device *device, snd_pcm_sframes_t target_fill) {
+    /** Periods rendered ahead sit between the source and ALSA, seeking the source back would play them twice */
+    if(!device->config->rewind_callback || device->pipeline.depth > 0)
+        return;
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(device->handle);
+    if(avail < 0)
+        return;
+    snd_pcm_sframes_t excess     = (device->buffer_size - avail) - target_fill;
+    snd_pcm_sframes_t rewindable = snd_pcm_rewindable(device->handle);
+    if(excess > rewindable)
+        excess = rewindable;
+    if(excess <= 0)
+        return;
+
+    snd_pcm_sframes_t rewound = snd_pcm_rewind(device->handle, excess);
+    if(rewound < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: rewind failed:", snd_strerror(rewound));
+        return;
+    }
+    if(rewound > 0)
+        device->config->rewind_callback(rewound, device, device->config->my_custom_data);
+}
+
+static sa_result set_avail_min(sa_device *device, snd_pcm_uframes_t avail_min) {
+    snd_pcm_sw_params_t *sw_params;
+    int err;
+    snd_pcm_sw_params_alloca(&sw_params);
+
+    if((err = snd_pcm_sw_params_current(device->handle, sw_params)) < 0 ||
+       (err = snd_pcm_sw_params_set_avail_min(device->handle, sw_params, avail_min)) < 0 ||
+       (err = snd_pcm_sw_params(device->handle, sw_params)) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to change the available minimum", snd_strerror(err));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static snd_pcm_sframes_t sa_us_to_frames(sa_device *device, int time_us) {
+    return (snd_pcm_sframes_t) (((unsigned long long) time_us * device->config->sample_rate) / 1000000);
+}
+
+static sa_result init_deadline_watchdog(sa_device *device) {
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+    pthread_condattr_t attr;
+    if(device->config->deadline_margin <= 0)
+        return SA_SUCCESS;
+
+    pthread_mutex_init(&(watchdog->mutex), NULL);
+    /** Deadlines are absolute CLOCK_MONOTONIC times */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(watchdog->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    watchdog->deadline_us = 0;
+    watchdog->quit        = false;
+    if(pthread_create(&(watchdog->thread), NULL, &run_deadline_watchdog, (void *) device) != 0)
+    {
+        pthread_mutex_destroy(&(watchdog->mutex));
+        pthread_cond_destroy(&(watchdog->cond));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static void close_deadline_watchdog(sa_device *device) {
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+    if(device->config->deadline_margin <= 0)
+        return;
+
+    pthread_mutex_lock(&(watchdog->mutex));
+    watchdog->quit = true;
+    pthread_cond_signal(&(watchdog->cond));
+    pthread_mutex_unlock(&(watchdog->mutex));
+    if(pthread_join(watchdog->thread, NULL) != 0)
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not join the deadline watchdog thread");
+    pthread_mutex_destroy(&(watchdog->mutex));
+    pthread_cond_destroy(&(watchdog->cond));
+}
+
+static void *run_deadline_watchdog(void *data) {
+    sa_device *device              = (sa_device *) data;
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+
+    pthread_mutex_lock(&(watchdog->mutex));
+    while(!watchdog->quit)
+    {
+        if(watchdog->deadline_us == 0)
+        {
+            pthread_cond_wait(&(watchdog->cond), &(watchdog->mutex));
+            continue;
+        }
+        struct timespec deadline;
+        deadline.tv_sec  = watchdog->deadline_us / 1000000;
+        deadline.tv_nsec = (watchdog->deadline_us % 1000000) * 1000;
+        pthread_cond_timedwait(&(watchdog->cond), &(watchdog->mutex), &deadline);
+
+        /** The callback may have returned or a new deadline may have been set in the meantime */
+        if(watchdog->quit || watchdog->deadline_us == 0 || sa_get_time_us() < watchdog->deadline_us)
+            continue;
+
+        write_deadline_fallback(device);
+        watchdog->missed = true;
+        /** The callback is still running, so the next block is due once the queued frames have been played */
+        snd_pcm_sframes_t avail, delay;
+        long long slack_us = 0;
+        if(snd_pcm_avail_delay(device->handle, &avail, &delay) == 0)
+            slack_us = ((long long) delay * 1000000) / device->config->sample_rate - device->config->deadline_margin;
+        if(slack_us < SA_DEADLINE_RETRY_US)
+            slack_us = SA_DEADLINE_RETRY_US;
+        watchdog->deadline_us = sa_get_time_us() + slack_us;
+    }
+    pthread_mutex_unlock(&(watchdog->mutex));
+    return NULL;
+}
+
+static void arm_deadline_watchdog(sa_device *device) {
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+    snd_pcm_sframes_t avail, delay;
+    if(device->config->deadline_margin <= 0)
+        return;
+    if(snd_pcm_avail_delay(device->handle, &avail, &delay) < 0)
+        return;
+
+    /** Headroom is the time until the frames that are queued have been played */
+    long long headroom_us = ((long long) delay * 1000000) / device->config->sample_rate;
+    long long slack_us    = headroom_us - device->config->deadline_margin;
+
+    pthread_mutex_lock(&(watchdog->mutex));
+    watchdog->deadline_us = sa_get_time_us() + (slack_us > 0 ? slack_us : 0);
+    watchdog->missed      = false;
+    pthread_cond_signal(&(watchdog->cond));
+    pthread_mutex_unlock(&(watchdog->mutex));
+}
+
+static void disarm_deadline_watchdog(sa_device *device, void *buffer, int frames) {
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+    if(device->config->deadline_margin <= 0)
+        return;
+
+    pthread_mutex_lock(&(watchdog->mutex));
+    watchdog->deadline_us = 0;
+    if(frames > 0 && device->frame_bytes <= SA_MAX_FRAME_BYTES)
+    {
+        char *last_frame = (char *) buffer + (frames - 1) * device->frame_bytes;
+        memcpy(watchdog->last_frame, last_frame, device->frame_bytes);
+    }
+    bool missed = watchdog->missed;
+    pthread_mutex_unlock(&(watchdog->mutex));
+
+    if(missed)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "Data callback missed its deadline");
+        pthread_mutex_lock(&(device->statsMutex));
+        device->stats.deadline_misses++;
+        pthread_mutex_unlock(&(device->statsMutex));
+    }
+}
+
+static void write_deadline_fallback(sa_device *device) {
+    sa_deadline_watchdog *watchdog = &(device->watchdog);
+    snd_pcm_sframes_t frames       = watchdog->fallback_frames;
+    char *buffer                   = (char *) watchdog->fallback_samples;
+
+    /** An xrun is recovered by the playback thread once the callback returns */
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(device->handle);
+    if(avail <= 0)
+        return;
+    if(frames > avail)
+        frames = avail;
+
+    if(device->config->deadline_fallback == SA_DEADLINE_FALLBACK_FADE && device->apply_gain &&
+       device->frame_bytes <= SA_MAX_FRAME_BYTES)
+    {
+        /** Hold the last frame and ramp it down to silence in SA_FADE_STEPS steps */
+        for(snd_pcm_sframes_t i = 0; i < frames; i++)
+            memcpy(buffer + i * device->frame_bytes, watchdog->last_frame, device->frame_bytes);
+        sa_gain gains[SA_MAX_CHANNELS];
+        snd_pcm_sframes_t done = 0;
+        for(int step = 0; step < SA_FADE_STEPS; step++)
+        {
+            snd_pcm_sframes_t end = (frames * (step + 1)) / SA_FADE_STEPS;
+            for(int channel = 0; channel < device->config->channels; channel++)
+                gains[channel] = SA_GAIN_ONE - SA_GAIN_ONE * (step + 1) / SA_FADE_STEPS;
+            device->apply_gain(buffer + done * device->frame_bytes, end - done, device->config->channels,
+                               gains);
+            done = end;
+        }
+        /** The fade ends in silence, so a next block must not start from the held frame again */
+        memset(watchdog->last_frame, 0, sizeof(watchdog->last_frame));
+        snd_pcm_format_set_silence(device->config->format, watchdog->last_frame, device->config->channels);
+    } else
+    { snd_pcm_format_set_silence(device->config->format, buffer, frames * device->config->channels); }
+
+    snd_pcm_sframes_t written = snd_pcm_writei(device->handle, buffer, frames);
+    if(written < 0)
+    {
+        /** The playback thread recovers from the xrun once the callback returns */
+        SA_LOG(SA_LOG_LEVEL_WARNING, "ALSA: writing the deadline fallback failed:", snd_strerror(written));
+        return;
+    }
+    pthread_mutex_lock(&(device->statsMutex));
+    device->stats.fallback_frames += written;
+    pthread_mutex_unlock(&(device->statsMutex));
+}
+
+static int render_frames(sa_device *device, void *buffer, int frames) {
+    if(device->pipeline.depth > 0)
+        return read_pipeline(device, buffer, frames);
+    int (*data_callback)(int framesToSend, void *audioBuffer, sa_device *sa_device, void *my_custom_data) =
+      (int (*)(int, void *, sa_device *, void *my_custom_data)) device->config->data_callback;
+    return data_callback(frames, buffer, device, device->config->my_custom_data);
+}
+
+static int render_period(sa_device *device, void *buffer, int frames) {
+    sa_event_queue *events = &(device->events);
+    int rendered           = 0;
+    collect_events(device);
+
+    while(rendered < frames)
+    {
+        /** Apply every event that is due before the next frame */
+        while(events->pending_count > 0 && events->pending[events->pending_count - 1].timestamp <= events->position &&
+              !events->pause_pending)
+            apply_event(device, &(events->pending[--(events->pending_count)].event));
+        if(events->pause_pending)
+            break;
+
+        int chunk = frames - rendered;
+        if(events->pending_count > 0 &&
+           events->pending[events->pending_count - 1].timestamp - events->position < (unsigned long long) chunk)
+            chunk = (int) (events->pending[events->pending_count - 1].timestamp - events->position);
+        char *chunk_buffer = (char *) buffer + (size_t) rendered * device->frame_bytes;
+        int readcount      = render_frames(device, chunk_buffer, chunk);
+        process_samples(device, chunk_buffer, readcount);
+        rendered += readcount;
+        __atomic_store_n(&(events->position), events->position + readcount, __ATOMIC_RELEASE);
+        if(readcount < chunk)
+            break;
+    }
+    return rendered;
+}
+
+static sa_result init_pipeline(sa_device *device) {
+    sa_pipeline *pipeline = &(device->pipeline);
+    if(pipeline->depth <= 0)
+        return SA_SUCCESS;
+
+    pthread_mutex_init(&(pipeline->mutex), NULL);
+    pthread_cond_init(&(pipeline->worker_cond), NULL);
+    pthread_cond_init(&(pipeline->ready_cond), NULL);
+    pipeline->running = false;
+    pipeline->quit    = false;
+    if(pthread_create(&(pipeline->thread), NULL, &run_pipeline, (void *) device) != 0)
+    {
+        pthread_mutex_destroy(&(pipeline->mutex));
+        pthread_cond_destroy(&(pipeline->worker_cond));
+        pthread_cond_destroy(&(pipeline->ready_cond));
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static void close_pipeline(sa_device *device) {
+    sa_pipeline *pipeline = &(device->pipeline);
+    if(pipeline->depth <= 0)
+        return;
+
+    pthread_mutex_lock(&(pipeline->mutex));
+    pipeline->quit = true;
+    pthread_cond_signal(&(pipeline->worker_cond));
+    pthread_mutex_unlock(&(pipeline->mutex));
+    if(pthread_join(pipeline->thread, NULL) != 0)
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not join the pipeline worker thread");
+    pthread_mutex_destroy(&(pipeline->mutex));
+    pthread_cond_destroy(&(pipeline->worker_cond));
+    pthread_cond_destroy(&(pipeline->ready_cond));
+}
+
+static void *run_pipeline(void *data) {
+    sa_device *device     = (sa_device *) data;
+    sa_pipeline *pipeline = &(device->pipeline);
+    size_t slot_bytes     = (size_t) pipeline->period_frames * device->frame_bytes;
+    int (*data_callback)(int framesToSend, void *audioBuffer, sa_device *sa_device, void *my_custom_data) =
+      (int (*)(int, void *, sa_device *, void *my_custom_data)) device->config->data_callback;
+
+    pthread_mutex_lock(&(pipeline->mutex));
+    while(!pipeline->quit)
+    {
+        if(!pipeline->running || pipeline->end ||
+           pipeline->write_index - pipeline->read_index == (unsigned int) pipeline->depth)
+        {
+            pthread_cond_wait(&(pipeline->worker_cond), &(pipeline->mutex));
+            continue;
+        }
+        int slot       = pipeline->write_index % pipeline->depth;
+        pipeline->busy = true;
+        pthread_mutex_unlock(&(pipeline->mutex));
+
+        /** The slot is not visible to the playback thread until write_index moves past it */
+        int readcount = data_callback(pipeline->period_frames, (char *) pipeline->slots + slot * slot_bytes, device,
+                                      device->config->my_custom_data);
+
+        pthread_mutex_lock(&(pipeline->mutex));
+        pipeline->busy = false;
+        /** A period rendered while the device was stopped is dropped like the rest of the buffer */
+        if(pipeline->running)
+        {
+            if(readcount <= 0)
+                pipeline->end = true;
+            else
+            {
+                pipeline->slot_frames[slot] = readcount;
+                pipeline->write_index++;
+            }
+        }
+        pthread_cond_signal(&(pipeline->ready_cond));
+    }
+    pthread_mutex_unlock(&(pipeline->mutex));
+    return NULL;
+}
+
+static void start_pipeline(sa_device *device) {
+    sa_pipeline *pipeline = &(device->pipeline);
+    if(pipeline->depth <= 0)
+        return;
+
+    pthread_mutex_lock(&(pipeline->mutex));
+    pipeline->write_index = 0;
+    pipeline->read_index  = 0;
+    pipeline->read_offset = 0;
+    pipeline->end         = false;
+    pipeline->running     = true;
+    pthread_cond_signal(&(pipeline->worker_cond));
+    pthread_mutex_unlock(&(pipeline->mutex));
+}
+
+static void stop_pipeline(sa_device *device) {
+    sa_pipeline *pipeline = &(device->pipeline);
+    if(pipeline->depth <= 0)
+        return;
+
+    pthread_mutex_lock(&(pipeline->mutex));
+    pipeline->running = false;
+    while(pipeline->busy)
+        pthread_cond_wait(&(pipeline->ready_cond), &(pipeline->mutex));
+    pthread_mutex_unlock(&(pipeline->mutex));
+}
+
+static int read_pipeline(sa_device *device, void *buffer, int frames) {
+    sa_pipeline *pipeline       = &(device->pipeline);
+    size_t slot_bytes           = (size_t) pipeline->period_frames * device->frame_bytes;
+    unsigned long long start_us = 0;
+    int copied                  = 0;
+
+    while(copied < frames)
+    {
+        pthread_mutex_lock(&(pipeline->mutex));
+        while(pipeline->read_index == pipeline->write_index && !pipeline->end)
+        {
+            /** The worker fell behind, the time spent here is the lateness of the callback */
+            if(!start_us)
+                start_us = sa_get_time_us();
+            pthread_cond_wait(&(pipeline->ready_cond), &(pipeline->mutex));
+        }
+        bool ready = pipeline->read_index != pipeline->write_index;
+        pthread_mutex_unlock(&(pipeline->mutex));
+        if(!ready)
+            break;
+
+        int slot   = pipeline->read_index % pipeline->depth;
+        int amount = pipeline->slot_frames[slot] - pipeline->read_offset;
+        if(amount > frames - copied)
+            amount = frames - copied;
+        memcpy((char *) buffer + (size_t) copied * device->frame_bytes,
+               (char *) pipeline->slots + slot * slot_bytes + (size_t) pipeline->read_offset * device->frame_bytes,
+               (size_t) amount * device->frame_bytes);
+        copied += amount;
+        pipeline->read_offset += amount;
+        if(pipeline->read_offset == pipeline->slot_frames[slot])
+        {
+            pthread_mutex_lock(&(pipeline->mutex));
+            pipeline->read_index++;
+            pipeline->read_offset = 0;
+            pthread_cond_signal(&(pipeline->worker_cond));
+            pthread_mutex_unlock(&(pipeline->mutex));
+        }
+    }
+    /** Waiting for the first periods before the PCM runs is not late */
+    if(start_us && device->handle && snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING)
+    {
+        unsigned long long waited_us = sa_get_time_us() - start_us;
+        pthread_mutex_lock(&(device->statsMutex));
+        device->stats.pipeline_late_periods++;
+        if(waited_us > device->stats.max_pipeline_wait_us)
+            device->stats.max_pipeline_wait_us = waited_us;
+        pthread_mutex_unlock(&(device->statsMutex));
+    }
+    return copied;
+}
+
+static sa_result pause_callback_loop(sa_poll_management *poll_manager, sa_device *device) {
+    pause_PCM_handle(device);
+
+    int pauzed = 1;
+    char command;
+    while(pauzed)
+    {
+        poll(&(poll_manager->ufds[0]), 1, -1);
+        if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+        } else
+        {
+            SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+            switch(command)
+            {
+            /** Stop playback */
+            case 's':
+                {
+                    return SA_STOP;
+                    break;
+                }
+            /** Unpause */
+            case 'u':
+                {
+                    return SA_UNPAUSE;
+                    break;
+                }
+            default:
+                break;
+            }
+        }
+    }
+    return SA_ERROR;
+}
+
+static void save_device_state(sa_device *device, sa_device_state new_state) {
+    /** Save state */
+    sa_set_device_state(device, new_state);
+    pthread_mutex_lock(&(device->condition_var.mutex));
+    device->condition_var.is_stopped = new_state == SA_DEVICE_STOPPED;
+    pthread_mutex_unlock(&(device->condition_var.mutex));
+    /** Broadcast change*/
+    pthread_cond_signal(&(device->condition_var.cond));
+}
+
+static sa_result xrun_recovery(sa_device *device, int err) {
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "ASLA: xrun occured");
+    unsigned int backoff_us = SA_XRUN_BACKOFF_MIN_US;
+    unsigned int waited_us  = 0;
+    sa_recovery_step step;
+
+    pthread_mutex_lock(&(device->statsMutex));
+    if(err == -EPIPE)
+    {
+        /* Underrun */
+        device->stats.xrun_count++;
+        step = SA_RECOVERY_PREPARE;
+    } else if(err == -ESTRPIPE)
+    {
+        /* Suspended */
+        device->stats.suspend_count++;
+        step = SA_RECOVERY_RESUME;
+    } else
+    {
+        pthread_mutex_unlock(&(device->statsMutex));
+        return SA_ERROR;
+    }
+    pthread_mutex_unlock(&(device->statsMutex));
+
+    while(1)
+    {
+        switch(step)
+        {
+        case SA_RECOVERY_RESUME:
+            err = snd_pcm_resume(device->handle);
+            if(err == 0)
+                return SA_SUCCESS;
+            /** Wait for the suspend flag to be released, but never longer than the resume timeout */
+            if(err == -EAGAIN && waited_us < SA_XRUN_RESUME_TIMEOUT_US)
+                step = SA_RECOVERY_BACKOFF;
+            else
+                step = SA_RECOVERY_PREPARE;
+            break;
+        case SA_RECOVERY_BACKOFF:
+            usleep(backoff_us);
+            waited_us += backoff_us;
+            backoff_us = backoff_us * 2 > SA_XRUN_BACKOFF_MAX_US ? SA_XRUN_BACKOFF_MAX_US : backoff_us * 2;
+            pthread_mutex_lock(&(device->statsMutex));
+            device->stats.resume_retries++;
+            pthread_mutex_unlock(&(device->statsMutex));
+            step = SA_RECOVERY_RESUME;
+            break;
+        case SA_RECOVERY_PREPARE:
+            err = snd_pcm_prepare(device->handle);
+            if(err < 0)
+            {
+                SA_LOG(SA_LOG_LEVEL_ERROR,
+                       "ALSA: Can't recover from xrun, prepare failed:", snd_strerror(err));
+                return SA_ERROR;
+            }
+            return SA_SUCCESS;
+        }
+    }
+}
+
+static sa_result pause_alsa_device(sa_device *device) {
+    /** The state is set before the command is sent, so the playback thread can correct it when it defers the pause */
+    sa_set_device_state(device, SA_DEVICE_PAUSED);
+    if(message_pipe(device, 'p') == SA_ERROR)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send pause command to the message pipe");
+        sa_set_device_state(device, SA_DEVICE_STARTED);
+        return SA_ERROR;
+    };
+    return SA_SUCCESS;
+}
+
+static sa_result unpause_alsa_device(sa_device *device) {
+    if(message_pipe(device, 'u') == SA_ERROR)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send unpause command to the message pipe");
+        return SA_ERROR;
+    };
+    sa_set_device_state(device, SA_DEVICE_STARTED);
+    return SA_SUCCESS;
+}
 
-static sa_result sa_start_device_async(sa_device *device) {
-    if(sa_get_device_state(device) != SA_DEVICE_STARTED)
+static sa_result wait_for_start_alsa_device(sa_device *device) {
+    while((device->condition_var.is_stopped))
+    { pthread_cond_wait(&(device->condition_var.cond), &(device->condition_var.mutex)); }
+    return SA_SUCCESS;
+}
+
+static sa_result stop_alsa_device(sa_device *device) {
+    if(message_pipe(device, 's') == SA_ERROR)
     {
-        return start_alsa_device(device);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send cancel command to the message pipe");
+        return SA_ERROR;
+    };
+    sa_set_device_state(device, SA_DEVICE_STOPPED);
+    return SA_SUCCESS;
+}
+
+static sa_result wait_for_stop_alsa_device(sa_device *device) {
+    while(!(device->condition_var.is_stopped))
+    { pthread_cond_wait(&(device->condition_var.cond), &(device->condition_var.mutex)); }
+    return SA_SUCCESS;
+}
+
+static sa_result pause_PCM_handle(sa_device *device) {
+    if(device->supports_pause)
+    {
+        if(snd_pcm_pause(device->handle, 1) != 0)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Failed to snd_pcm_pause the pcm handle (when pausing)");
+            return SA_ERROR;
+        }
+        return SA_SUCCESS;
     } else
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to start the device, the device is already started");
-        return SA_INVALID_STATE;
+        if(drop_alsa_device(device) == SA_SUCCESS && prepare_alsa_device(device) == SA_SUCCESS)
+            return SA_SUCCESS;
+    }
+    return SA_ERROR;
+}
+
+static sa_result unpause_PCM_handle(sa_device *device) {
+    if(device->supports_pause)
+    {
+        if(snd_pcm_pause(device->handle, 0) != 0)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Failed to snd_pcm_pause the pcm handle (when resuming)");
+            return SA_ERROR;
+        }
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result drop_alsa_device(sa_device *device) {
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA drop called");
+    int err               = 0;
+    snd_pcm_state_t state = device->handle ? snd_pcm_state(device->handle) : SND_PCM_STATE_OPEN;
+    /** A PCM that underran or was never started still holds frames, snd_pcm_drop() clears those as well */
+    if(state == SND_PCM_STATE_RUNNING || state == SND_PCM_STATE_PAUSED || state == SND_PCM_STATE_PREPARED ||
+       state == SND_PCM_STATE_XRUN)
+    {
+        err = snd_pcm_drop(device->handle);
+        if(err == 0)
+        {
+            return SA_SUCCESS;
+        } else
+        { SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: snd_pcm_drop() failed: ", snd_strerror(err)); }
+    }
+    SA_LOG(SA_LOG_LEVEL_ERROR,
+           "Failed to drop samples from the ALSA device: pcm_handle not in a running, paused, prepared or xrun state");
+    return SA_ERROR;
+}
+
+static sa_result drain_alsa_device(sa_device *device) {
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA drain called");
+    int err = 0;
+    /** A stream that ended before the start threshold was reached is started so its frames are played */
+    if(device->handle && snd_pcm_state(device->handle) == SND_PCM_STATE_PREPARED &&
+       snd_pcm_avail_update(device->handle) < device->buffer_size)
+        snd_pcm_start(device->handle);
+    if(device->handle && (snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING ||
+                          snd_pcm_state(device->handle) == SND_PCM_STATE_PAUSED))
+    {
+        /** A blocking drain would hold the thread for up to a whole buffer, in non-blocking mode it only starts it */
+        snd_pcm_nonblock(device->handle, 1);
+        err = snd_pcm_drain(device->handle);
+        if(err == 0 || err == -EAGAIN)
+        {
+            sa_result result = wait_for_drain(device);
+            snd_pcm_nonblock(device->handle, 0);
+            return result;
+        }
+        snd_pcm_nonblock(device->handle, 0);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: snd_pcm_drain() failed: ", snd_strerror(err));
+    }
+    SA_LOG(SA_LOG_LEVEL_ERROR,
+           "Failed to drain samples from the ALSA device: pcm_handle not in runnning or paused state");
+    return SA_ERROR;
+}
+
+static sa_result wait_for_drain(sa_device *device) {
+    sa_poll_management *poll_manager = &(device->poll_manager);
+    snd_pcm_sframes_t delay;
+    char command;
+    bool pause_deferred = false;
+    SA_TRACE_BEGIN(device, SA_TRACE_DRAIN, 0);
+    while(snd_pcm_state(device->handle) == SND_PCM_STATE_DRAINING)
+    {
+        /** Only the pipe is polled, the PCM descriptors do not report the end of a drain on every plugin */
+        if(snd_pcm_delay(device->handle, &delay) < 0 || delay < 0)
+            delay = 0;
+        int timeout_ms = (int) ((unsigned long long) delay * 1000 / device->config->sample_rate) + 1;
+        if(poll(&(poll_manager->ufds[0]), 1, timeout_ms) <= 0 || !(poll_manager->ufds[0].revents & POLLIN))
+            continue;
+        if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+            continue;
+        }
+        SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+        if(command == 's')
+        {
+            /** Dropping is instant, whatever is left in the buffer is discarded */
+            snd_pcm_drop(device->handle);
+            SA_TRACE_END(device, SA_TRACE_DRAIN, SA_STOP);
+            return SA_STOP;
+        }
+        /** snd_pcm_pause() only accepts a RUNNING PCM, the hardware keeps draining whatever is asked */
+        if(command == 'p')
+        {
+            pause_deferred = true;
+            save_device_state(device, SA_DEVICE_STARTED);
+        }
+        if(command == 'u')
+            pause_deferred = false;
+    }
+    SA_TRACE_END(device, SA_TRACE_DRAIN, SA_AT_END);
+
+    if(pause_deferred)
+    {
+        /** The last frame was played, eof is reported when the stream is resumed and not at all when it is stopped */
+        save_device_state(device, SA_DEVICE_PAUSED);
+        SA_LOG(SA_LOG_LEVEL_DEBUG, "Paused at the end of the drain");
+        while(1)
+        {
+            poll(&(poll_manager->ufds[0]), 1, -1);
+            if(!(poll_manager->ufds[0].revents & POLLIN))
+                continue;
+            if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
+            {
+                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
+                continue;
+            }
+            SA_TRACE_INSTANT(device, SA_TRACE_COMMAND, command);
+            if(command == 's')
+                return SA_STOP;
+            if(command == 'u')
+                break;
+        }
+        save_device_state(device, SA_DEVICE_STARTED);
+    }
+    return SA_AT_END;
+}
+
+static sa_result prepare_alsa_device(sa_device *device) {
+    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA prepare called");
+    if(device->handle && snd_pcm_prepare(device->handle) == 0)
+    { return SA_SUCCESS; }
+    SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to prepare the ALSA device");
+    return SA_ERROR;
+}
+
+static sa_result message_pipe(sa_device *device, char toSend) {
+    int result = write(device->pipe_write_end, &toSend, 1);
+    if(result != 1)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to write to the pipe");
+        return SA_ERROR;
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result cleanup_device(sa_device *device) {
+    if(device)
+    {
+        close(device->pipe_write_end);
+
+        /** Everything lives in the user supplied block for static devices */
+        bool owns_memory = device->static_memory == NULL;
+        if(device->config && owns_memory)
+        { free(device->config); }
+        pthread_mutex_destroy(&(device->condition_var.mutex));
+        pthread_cond_destroy(&(device->condition_var.cond));
+        if(device->samples && owns_memory)
+        { free(device->samples); }
+        if(device->handle)
+        {
+            int err = snd_pcm_close(device->handle);
+            if(err < 0)
+            { SA_LOG(SA_LOG_LEVEL_ERROR, "Could not close handle : ", snd_strerror(err)); }
+        }
+        pthread_mutex_destroy(&(device->stateMutex));
+        pthread_mutex_destroy(&(device->statsMutex));
+        if(owns_memory)
+        { free(device); }
+        snd_config_update_free_global();
+    }
+    return SA_SUCCESS;
+}
+
+static sa_result destroy_alsa_device(sa_device *device) {
+    sa_stop_device(device);
+    /** The device is left intact when the thread cannot be stopped, freeing it would pull it from under the thread */
+    if(message_pipe(device, 'd') != SA_SUCCESS || close_playback_thread(device) == SA_ERROR)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not close thread");
+        return SA_ERROR;
+    }
+    close_analysis(device);
+    close_pipeline(device);
+    close_deadline_watchdog(device);
+    #ifdef SA_TRACE
+    if(__atomic_load_n(&(device->trace.active), __ATOMIC_ACQUIRE))
+        sa_stop_trace(device);
+    #endif
+    return cleanup_device(device);
+}
+
+static void sa_set_device_state(sa_device *device, sa_device_state state) {
+    pthread_mutex_lock(&(device->stateMutex));
+    device->state = state;
+    pthread_mutex_unlock(&(device->stateMutex));
+}
+
+/*=================== SAMPLE PROCESSING DEFINITIONS ===================*/
+static inline int32_t sa_float_to_s16(float sample) {
+    return sample >= 32767.0f ? 32767 : sample <= -32768.0f ? -32768 : (int32_t) lrintf(sample);
+}
+
+static inline int32_t sa_float_to_s24(float sample) {
+    return sample >= 8388607.0f ? 8388607 : sample <= -8388608.0f ? -8388608 : (int32_t) lrintf(sample);
+}
+
+static inline int32_t sa_double_to_s32(double sample) {
+    return sample >= 2147483647.0 ? 2147483647 : sample <= -2147483648.0 ? INT32_MIN : (int32_t) lrint(sample);
+}
+
+    #if defined SA_FIXED_POINT
+/**
+ * Fixed point processing: samples are Q15 (S16) or Q31 (S24 and S32, mixing) and gains Q15 with one integer bit.
+ * Products are rounded half up and every result saturates. The scalar helpers below are the reference, the NEON and
+ * SSE2 paths further down compute the same values. Only integer arithmetic is used, so the output is bit-exact on
+ * every architecture.
+ */
+static inline sa_gain sa_to_gain(float gain) {
+    return gain >= 65535.0f / 32768.0f    ? 65535
+           : gain <= -65535.0f / 32768.0f ? -65535
+                                          : (sa_gain) lrintf(gain * 32768.0f);
+}
+
+static inline int32_t sa_saturate_s16(int32_t sample) {
+    sample = sample < 32767 ? sample : 32767;
+    return sample > -32768 ? sample : -32768;
+}
+
+static inline int32_t sa_saturate_s24(int64_t sample) {
+    sample = sample < 8388607 ? sample : 8388607;
+    return (int32_t) (sample > -8388608 ? sample : -8388608);
+}
+
+static inline int32_t sa_saturate_s32(int64_t sample) {
+    sample = sample < INT32_MAX ? sample : INT32_MAX;
+    return (int32_t) (sample > INT32_MIN ? sample : INT32_MIN);
+}
+
+/** |gain| < 2.0, so the product of a 16 bit sample and a Q15 gain fits in 32 bits */
+static inline int32_t sa_q15_scale_s16(int32_t sample, sa_gain gain) {
+    return sa_saturate_s16((sample * gain + (1 << 14)) >> 15);
+}
+
+static inline int32_t sa_q15_scale_s24(int32_t sample, sa_gain gain) {
+    return sa_saturate_s24(((int64_t) sample * gain + (1 << 14)) >> 15);
+}
+
+static inline int32_t sa_q15_scale_s32(int32_t sample, sa_gain gain) {
+    return sa_saturate_s32(((int64_t) sample * gain + (1 << 14)) >> 15);
+}
+
+/** Saturating add in 32 bits: an overflow flips the sign of the sum against both operands */
+static inline int32_t sa_add_saturate_s32(int32_t a, int32_t b) {
+    int32_t sum      = (int32_t) ((uint32_t) a + (uint32_t) b);
+    int32_t overflow = ((a ^ sum) & (b ^ sum)) >> 31;
+    int32_t limit    = (a >> 31) ^ INT32_MAX;
+    return (sum & ~overflow) | (limit & overflow);
+}
+
+/**
+ * Splits a Q15 gain into a fraction in ]-1.0; 1.0[ and a whole part of -1, 0 or 1. The fraction fits the rounding
+ * multiplies of NEON and SSE2, the whole part adds or subtracts the sample with saturation - since the whole part
+ * is a multiple of 2^15 this is exactly the rounded product of the scalar helpers.
+ */
+static inline int32_t sa_q15_fraction(sa_gain gain) {
+    return gain >= 32768 ? gain - 32768 : gain <= -32768 ? gain + 32768 : gain;
+}
+
+static inline int32_t sa_q15_whole(sa_gain gain) {
+    return gain >= 32768 ? 1 : gain <= -32768 ? -1 : 0;
+}
+
+        #if defined __ARM_NEON
+/** vqrdmulh computes (2 * a * b + 2^(bits - 1)) >> bits, so the fraction is shifted to the high half for 32 bit */
+static inline int32x4_t sa_neon_scale_s32(int32x4_t sample, const int32x4_t *lanes) {
+    int32x4_t scaled = vqrdmulhq_s32(sample, lanes[0]);
+    scaled           = vqaddq_s32(scaled, vandq_s32(sample, lanes[1]));
+    return vqsubq_s32(scaled, vandq_s32(sample, lanes[2]));
+}
+
+/** Fraction, add mask and subtract mask per lane for one or two interleaved channels */
+static inline void sa_neon_lanes_s32(int channels, const sa_gain *gains, int32x4_t *lanes) {
+    int32_t fraction[4], add[4], subtract[4];
+    for(int lane = 0; lane < 4; lane++)
+    {
+        sa_gain gain   = gains[lane % channels];
+        fraction[lane] = sa_q15_fraction(gain) * 65536;
+        add[lane]      = sa_q15_whole(gain) > 0 ? -1 : 0;
+        subtract[lane] = sa_q15_whole(gain) < 0 ? -1 : 0;
+    }
+    lanes[0] = vld1q_s32(fraction);
+    lanes[1] = vld1q_s32(add);
+    lanes[2] = vld1q_s32(subtract);
+}
+
+/** Scales whole vectors of one or two interleaved channels and returns the frames done, the caller does the rest */
+static int sa_simd_gain_s16(int16_t *samples, int frames, int channels, const sa_gain *gains) {
+    int16_t fraction[8], add[8], subtract[8];
+    for(int lane = 0; lane < 8; lane++)
+    {
+        sa_gain gain   = gains[lane % channels];
+        fraction[lane] = (int16_t) sa_q15_fraction(gain);
+        add[lane]      = sa_q15_whole(gain) > 0 ? -1 : 0;
+        subtract[lane] = sa_q15_whole(gain) < 0 ? -1 : 0;
+    }
+    const int16x8_t fraction_lanes = vld1q_s16(fraction);
+    const int16x8_t add_lanes      = vld1q_s16(add);
+    const int16x8_t subtract_lanes = vld1q_s16(subtract);
+    int index                      = 0;
+    for(; index + 8 <= frames * channels; index += 8)
+    {
+        int16x8_t sample = vld1q_s16(&samples[index]);
+        int16x8_t scaled = vqrdmulhq_s16(sample, fraction_lanes);
+        scaled           = vqaddq_s16(scaled, vandq_s16(sample, add_lanes));
+        vst1q_s16(&samples[index], vqsubq_s16(scaled, vandq_s16(sample, subtract_lanes)));
+    }
+    return index / channels;
+}
+
+static int sa_simd_gain_s32(int32_t *samples, int frames, int channels, const sa_gain *gains) {
+    int32x4_t lanes[3];
+    sa_neon_lanes_s32(channels, gains, lanes);
+    int index = 0;
+    for(; index + 4 <= frames * channels; index += 4)
+        vst1q_s32(&samples[index], sa_neon_scale_s32(vld1q_s32(&samples[index]), lanes));
+    return index / channels;
+}
+
+/** Adds whole vectors of scaled samples to the mix and returns the samples done */
+static int sa_simd_mix_add(int32_t *mix, const int32_t *source, int samples, int channels, const sa_gain *gains) {
+    int32x4_t lanes[3];
+    sa_neon_lanes_s32(channels, gains, lanes);
+    int index = 0;
+    for(; index + 4 <= samples; index += 4)
+    {
+        int32x4_t scaled = sa_neon_scale_s32(vld1q_s32(&source[index]), lanes);
+        vst1q_s32(&mix[index], vqaddq_s32(vld1q_s32(&mix[index]), scaled));
+    }
+    return index;
+}
+
+            #define SA_SIMD_GAIN_S16 sa_simd_gain_s16
+            #define SA_SIMD_GAIN_S32 sa_simd_gain_s32
+            #define SA_SIMD_MIX_ADD  sa_simd_mix_add
+        #elif defined __SSE2__
+/**
+ * Rounded Q15 product, pmulhrsw computes (a * b + 2^14) >> 15 directly. SSE2 doubles the high half of the product
+ * and rounds with the top two bits t of the low half: (t + 1) >> 1, which pavgw with zero computes
+ */
+static inline __m128i sa_sse_mulhrs_epi16(__m128i sample, __m128i fraction) {
+            #if defined __SSSE3__
+    return _mm_mulhrs_epi16(sample, fraction);
+            #else
+    __m128i high  = _mm_mulhi_epi16(sample, fraction);
+    __m128i round = _mm_avg_epu16(_mm_srli_epi16(_mm_mullo_epi16(sample, fraction), 14), _mm_setzero_si128());
+    return _mm_add_epi16(_mm_add_epi16(high, high), round);
+            #endif
+}
+
+/** x86 has no 32 bit rounding multiply, so only the 16 bit gains use SIMD */
+static int sa_simd_gain_s16(int16_t *samples, int frames, int channels, const sa_gain *gains) {
+    int16_t fraction[8], add[8], subtract[8];
+    for(int lane = 0; lane < 8; lane++)
+    {
+        sa_gain gain   = gains[lane % channels];
+        fraction[lane] = (int16_t) sa_q15_fraction(gain);
+        add[lane]      = sa_q15_whole(gain) > 0 ? -1 : 0;
+        subtract[lane] = sa_q15_whole(gain) < 0 ? -1 : 0;
+    }
+    const __m128i fraction_lanes = _mm_loadu_si128((const __m128i *) fraction);
+    const __m128i add_lanes      = _mm_loadu_si128((const __m128i *) add);
+    const __m128i subtract_lanes = _mm_loadu_si128((const __m128i *) subtract);
+    int index                    = 0;
+    for(; index + 8 <= frames * channels; index += 8)
+    {
+        __m128i sample = _mm_loadu_si128((const __m128i *) &samples[index]);
+        __m128i scaled = sa_sse_mulhrs_epi16(sample, fraction_lanes);
+        scaled         = _mm_adds_epi16(scaled, _mm_and_si128(sample, add_lanes));
+        scaled         = _mm_subs_epi16(scaled, _mm_and_si128(sample, subtract_lanes));
+        _mm_storeu_si128((__m128i *) &samples[index], scaled);
+    }
+    return index / channels;
+}
+
+            #define SA_SIMD_GAIN_S16 sa_simd_gain_s16
+        #endif
+
+        #define SA_SCALE_S16(sample, gain)    sa_q15_scale_s16(sample, gain)
+        #define SA_SCALE_S24(sample, gain)    sa_q15_scale_s24(sample, gain)
+        #define SA_SCALE_S32(sample, gain)    sa_q15_scale_s32(sample, gain)
+        #define SA_SCALE_FLOAT(sample, gain)  ((sample) * ((float) (gain) * (1.0f / 32768.0f)))
+        #define SA_MIX_ADD(mix, sample, gain) sa_add_saturate_s32(mix, sa_q15_scale_s32(sample, gain))
+    #else
+static inline sa_gain sa_to_gain(float gain) {
+    return gain;
+}
+
+        #define SA_SCALE_S16(sample, gain)    sa_float_to_s16((float) (sample) * (gain))
+        #define SA_SCALE_S24(sample, gain)    sa_float_to_s24((float) (sample) * (gain))
+        #define SA_SCALE_S32(sample, gain)    sa_double_to_s32((double) (sample) * (gain))
+        #define SA_SCALE_FLOAT(sample, gain)  ((sample) * (gain))
+        #define SA_MIX_ADD(mix, sample, gain) ((mix) + (sample) * (gain))
+    #endif
+
+    /** Without a SIMD path every frame is left to the scalar loop */
+    #define SA_NO_SIMD(samples, frames, channels, gains) 0
+    #if !defined SA_SIMD_GAIN_S16
+        #define SA_SIMD_GAIN_S16 SA_NO_SIMD
+    #endif
+    #if !defined SA_SIMD_GAIN_S32
+        #define SA_SIMD_GAIN_S32 SA_NO_SIMD
+    #endif
+    #if !defined SA_SIMD_MIX_ADD
+        #define SA_SIMD_MIX_ADD(mix, source, samples, channels, gains) 0
+    #endif
+
+/**
+ * Generates a gain function for one sample type and channel count. CHANNELS is a compile time constant for the
+ * common layouts so the compiler can unroll the channel loop and vectorize over frames, 0 means any channel count.
+ * SIMD handles the leading whole vectors where there is an intrinsic path and returns the frames it did.
+ */
+    #define SA_DEFINE_GAIN_FUNCTION(NAME, TYPE, CHANNELS, SCALE, SIMD)                       \
+        static void NAME(void *buffer, int frames, int channels, const sa_gain *gains) {     \
+            TYPE *__restrict samples = (TYPE *) buffer;                                      \
+            const int count          = CHANNELS ? CHANNELS : channels;                       \
+            for(int frame = SIMD(samples, frames, count, gains); frame < frames; frame++)    \
+            {                                                                                \
+                for(int channel = 0; channel < count; channel++)                             \
+                {                                                                            \
+                    TYPE *sample = &samples[frame * count + channel];                        \
+                    *sample      = (TYPE) SCALE(*sample, gains[channel]);                    \
+                }                                                                            \
+            }                                                                                \
+        }
+
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s16_1ch, int16_t, 1, SA_SCALE_S16, SA_SIMD_GAIN_S16)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s16_2ch, int16_t, 2, SA_SCALE_S16, SA_SIMD_GAIN_S16)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s16_nch, int16_t, 0, SA_SCALE_S16, SA_NO_SIMD)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s32_1ch, int32_t, 1, SA_SCALE_S32, SA_SIMD_GAIN_S32)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s32_2ch, int32_t, 2, SA_SCALE_S32, SA_SIMD_GAIN_S32)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_s32_nch, int32_t, 0, SA_SCALE_S32, SA_NO_SIMD)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_float_1ch, float, 1, SA_SCALE_FLOAT, SA_NO_SIMD)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_float_2ch, float, 2, SA_SCALE_FLOAT, SA_NO_SIMD)
+SA_DEFINE_GAIN_FUNCTION(sa_gain_float_nch, float, 0, SA_SCALE_FLOAT, SA_NO_SIMD)
+
+/**
+ * S24_3LE samples are packed in 3 bytes, so they are unpacked to 32 bit, scaled and packed again.
+ */
+    #define SA_DEFINE_GAIN_FUNCTION_S24_3LE(NAME, CHANNELS)                                          \
+        static void NAME(void *buffer, int frames, int channels, const sa_gain *gains) {             \
+            uint8_t *__restrict bytes = (uint8_t *) buffer;                                          \
+            const int count           = CHANNELS ? CHANNELS : channels;                              \
+            for(int frame = 0; frame < frames; frame++)                                              \
+            {                                                                                        \
+                for(int channel = 0; channel < count; channel++)                                     \
+                {                                                                                    \
+                    uint8_t *sample = &bytes[(frame * count + channel) * 3];                         \
+                    int32_t value =                                                                  \
+                      (int32_t) ((uint32_t) sample[0] << 8 | (uint32_t) sample[1] << 16 |            \
+                                 (uint32_t) sample[2] << 24) >>                                      \
+                      8;                                                                             \
+                    value     = SA_SCALE_S24(value, gains[channel]);                                 \
+                    sample[0] = (uint8_t) value;                                                     \
+                    sample[1] = (uint8_t) (value >> 8);                                              \
+                    sample[2] = (uint8_t) (value >> 16);                                             \
+                }                                                                                    \
+            }                                                                                        \
+        }
+
+SA_DEFINE_GAIN_FUNCTION_S24_3LE(sa_gain_s24_3le_1ch, 1)
+SA_DEFINE_GAIN_FUNCTION_S24_3LE(sa_gain_s24_3le_2ch, 2)
+SA_DEFINE_GAIN_FUNCTION_S24_3LE(sa_gain_s24_3le_nch, 0)
+
+static sa_gain_function select_gain_function(sa_device *device) {
+    /** Index 0 is used for any channel count, 1 and 2 for the specialized layouts */
+    static const sa_gain_function s16[3]     = {sa_gain_s16_nch, sa_gain_s16_1ch, sa_gain_s16_2ch};
+    static const sa_gain_function s24_3le[3] = {sa_gain_s24_3le_nch, sa_gain_s24_3le_1ch, sa_gain_s24_3le_2ch};
+    static const sa_gain_function s32[3]     = {sa_gain_s32_nch, sa_gain_s32_1ch, sa_gain_s32_2ch};
+    static const sa_gain_function flt[3]     = {sa_gain_float_nch, sa_gain_float_1ch, sa_gain_float_2ch};
+    int layout = device->config->channels <= 2 ? device->config->channels : 0;
+    if(device->config->channels > SA_MAX_CHANNELS)
+        return NULL;
+
+    switch(device->config->format)
+    {
+    case SND_PCM_FORMAT_S16_LE:
+        return s16[layout];
+    case SND_PCM_FORMAT_S24_3LE:
+        return s24_3le[layout];
+    case SND_PCM_FORMAT_S32_LE:
+        return s32[layout];
+    case SND_PCM_FORMAT_FLOAT_LE:
+        return flt[layout];
+    default:
+        return NULL;
     }
 }
 
-static sa_result sa_stop_device_async(sa_device *device) {
-    if(sa_get_device_state(device) != SA_DEVICE_STOPPED)
-        return stop_alsa_device(device);
-    else
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to stop the device, the device is already stopped");
-        return SA_INVALID_STATE;
-    }
+static void process_samples(sa_device *device, void *buffer, int frames) {
+    if(!__atomic_load_n(&(device->gain_active), __ATOMIC_ACQUIRE))
+        return;
+    sa_gain gains[SA_MAX_CHANNELS];
+    for(int i = 0; i < device->config->channels && i < SA_MAX_CHANNELS; i++)
+        __atomic_load(&(device->channel_gain[i]), &gains[i], __ATOMIC_RELAXED);
+    device->apply_gain(buffer, frames, device->config->channels, gains);
 }
 
+    #define SA_LOAD_S16(bytes, index)   ((float) ((const int16_t *) (bytes))[index] * (1.0f / 32768.0f))
+    #define SA_LOAD_S32(bytes, index)   ((float) ((const int32_t *) (bytes))[index] * (1.0f / 2147483648.0f))
+    #define SA_LOAD_FLOAT(bytes, index) (((const float *) (bytes))[index])
+    #define SA_LOAD_S24_3LE(bytes, index)                                                                       \
+        ((float) ((int32_t) ((uint32_t) (bytes)[(index) * 3] << 8 | (uint32_t) (bytes)[(index) * 3 + 1] << 16 | \
+                             (uint32_t) (bytes)[(index) * 3 + 2] << 24) >>                                      \
+                  8) *                                                                                          \
+         (1.0f / 8388608.0f))
+
+    #if defined SA_FIXED_POINT
+        /** The meters load Q31, only FLOAT_LE devices still convert each sample */
+        #define SA_METER_LOAD_S16(bytes, index)   ((int32_t) ((const int16_t *) (bytes))[index] * 65536)
+        #define SA_METER_LOAD_S32(bytes, index)   (((const int32_t *) (bytes))[index])
+        #define SA_METER_LOAD_FLOAT(bytes, index) sa_double_to_s32((double) SA_LOAD_FLOAT(bytes, index) * 2147483648.0)
+        #define SA_METER_LOAD_S24_3LE(bytes, index)                                                                \
+            ((int32_t) ((uint32_t) (bytes)[(index) * 3] << 8 | (uint32_t) (bytes)[(index) * 3 + 1] << 16 |       \
+                        (uint32_t) (bytes)[(index) * 3 + 2] << 24))
+        #define SA_METER_MAGNITUDE(value) ((value) < 0 ? -(uint32_t) (value) : (uint32_t) (value))
+        #define SA_METER_SQUARE(value)    ((uint64_t) ((int64_t) ((value) >> 16) * ((value) >> 16)))
+typedef int32_t sa_meter_value;
+    #else
+        #define SA_METER_LOAD_S16         SA_LOAD_S16
+        #define SA_METER_LOAD_S32         SA_LOAD_S32
+        #define SA_METER_LOAD_FLOAT       SA_LOAD_FLOAT
+        #define SA_METER_LOAD_S24_3LE     SA_LOAD_S24_3LE
+        #define SA_METER_MAGNITUDE(value) ((value) < 0.0f ? -(value) : (value))
+        #define SA_METER_SQUARE(value)    ((value) * (value))
+typedef float sa_meter_value;
     #endif
 
-extern sa_result sa_start_device(sa_device *device) {
-    pthread_mutex_lock(&(device->condition_var->mutex));
-    if(sa_get_device_state(device) != SA_DEVICE_STARTED)
-        if(start_alsa_device(device) == SA_SUCCESS)
-        {
-            sa_result result = wait_for_start_alsa_device(device);
-            pthread_mutex_unlock(&(device->condition_var->mutex));
-            return result;
+/**
+ * Generates a level meter for one sample type and channel count. The samples are spread over SA_METER_LANES
+ * frames worth of independent accumulators, a multiple of the channel count so every lane belongs to a single
+ * channel - the lanes do not depend on each other, so the compiler vectorizes them without reassociating floats.
+ */
+    #define SA_DEFINE_METER_FUNCTION(NAME, CHANNELS, LOAD)                                            \
+        static void NAME(const void *buffer, int frames, int channels, sa_meter_peak *peak,           \
+                         sa_meter_sum *sum) {                                                          \
+            const uint8_t *__restrict bytes             = (const uint8_t *) buffer;                   \
+            const int count                             = CHANNELS ? CHANNELS : channels;             \
+            const int lanes                             = SA_METER_LANES * count;                     \
+            const int total                             = frames * count;                             \
+            sa_meter_peak lane_peak[SA_METER_LANES * SA_MAX_CHANNELS] = {0};                          \
+            sa_meter_sum lane_sum[SA_METER_LANES * SA_MAX_CHANNELS]   = {0};                          \
+            int index                                   = 0;                                          \
+            for(; index + lanes <= total; index += lanes)                                             \
+            {                                                                                         \
+                for(int lane = 0; lane < lanes; lane++)                                               \
+                {                                                                                     \
+                    sa_meter_value value    = LOAD(bytes, index + lane);                              \
+                    sa_meter_peak magnitude = SA_METER_MAGNITUDE(value);                              \
+                    lane_peak[lane] = magnitude > lane_peak[lane] ? magnitude : lane_peak[lane];      \
+                    lane_sum[lane] += SA_METER_SQUARE(value);                                         \
+                }                                                                                     \
+            }                                                                                         \
+            for(int lane = 0; index < total; index++, lane++)                                         \
+            {                                                                                         \
+                sa_meter_value value    = LOAD(bytes, index);                                         \
+                sa_meter_peak magnitude = SA_METER_MAGNITUDE(value);                                  \
+                lane_peak[lane] = magnitude > lane_peak[lane] ? magnitude : lane_peak[lane];          \
+                lane_sum[lane] += SA_METER_SQUARE(value);                                             \
+            }                                                                                         \
+            for(int lane = 0; lane < lanes; lane++)                                                   \
+            {                                                                                         \
+                int channel   = lane % count;                                                         \
+                peak[channel] = lane_peak[lane] > peak[channel] ? lane_peak[lane] : peak[channel];    \
+                sum[channel] += lane_sum[lane];                                                       \
+            }                                                                                         \
         }
-    pthread_mutex_unlock(&(device->condition_var->mutex));
-    return SA_INVALID_STATE;
-}
 
-extern sa_result sa_stop_device(sa_device *device) {
-    pthread_mutex_lock(&(device->condition_var->mutex));
-    if(sa_get_device_state(device) != SA_DEVICE_STOPPED)
+SA_DEFINE_METER_FUNCTION(sa_meter_s16_1ch, 1, SA_METER_LOAD_S16)
+SA_DEFINE_METER_FUNCTION(sa_meter_s16_2ch, 2, SA_METER_LOAD_S16)
+SA_DEFINE_METER_FUNCTION(sa_meter_s16_nch, 0, SA_METER_LOAD_S16)
+SA_DEFINE_METER_FUNCTION(sa_meter_s24_3le_1ch, 1, SA_METER_LOAD_S24_3LE)
+SA_DEFINE_METER_FUNCTION(sa_meter_s24_3le_2ch, 2, SA_METER_LOAD_S24_3LE)
+SA_DEFINE_METER_FUNCTION(sa_meter_s24_3le_nch, 0, SA_METER_LOAD_S24_3LE)
+SA_DEFINE_METER_FUNCTION(sa_meter_s32_1ch, 1, SA_METER_LOAD_S32)
+SA_DEFINE_METER_FUNCTION(sa_meter_s32_2ch, 2, SA_METER_LOAD_S32)
+SA_DEFINE_METER_FUNCTION(sa_meter_s32_nch, 0, SA_METER_LOAD_S32)
+SA_DEFINE_METER_FUNCTION(sa_meter_float_1ch, 1, SA_METER_LOAD_FLOAT)
+SA_DEFINE_METER_FUNCTION(sa_meter_float_2ch, 2, SA_METER_LOAD_FLOAT)
+SA_DEFINE_METER_FUNCTION(sa_meter_float_nch, 0, SA_METER_LOAD_FLOAT)
+
+/**
+ * Generates the downmix into the spectrum ring for one sample type. The ring is read by the spectrum worker
+ * while it is written, so the samples are stored atomically - a plain store on every supported architecture.
+ */
+    #define SA_DEFINE_DOWNMIX_FUNCTION(NAME, LOAD)                                                            \
+        static void NAME(const void *buffer, int frames, int channels, float *ring, unsigned int mask,        \
+                         unsigned int position) {                                                             \
+            const uint8_t *__restrict bytes = (const uint8_t *) buffer;                                       \
+            const float scale               = 1.0f / (float) channels;                                        \
+            for(int frame = 0; frame < frames; frame++)                                                       \
+            {                                                                                                 \
+                float value = 0.0f;                                                                           \
+                for(int channel = 0; channel < channels; channel++)                                           \
+                    value += LOAD(bytes, frame * channels + channel);                                         \
+                value *= scale;                                                                               \
+                __atomic_store(&ring[(position + (unsigned int) frame) & mask], &value, __ATOMIC_RELAXED);    \
+            }                                                                                                 \
+        }
+
+SA_DEFINE_DOWNMIX_FUNCTION(sa_downmix_s16, SA_LOAD_S16)
+SA_DEFINE_DOWNMIX_FUNCTION(sa_downmix_s24_3le, SA_LOAD_S24_3LE)
+SA_DEFINE_DOWNMIX_FUNCTION(sa_downmix_s32, SA_LOAD_S32)
+SA_DEFINE_DOWNMIX_FUNCTION(sa_downmix_float, SA_LOAD_FLOAT)
+
+static bool is_silent(sa_device *device, const void *buffer, int frames) {
+    const uint8_t *__restrict bytes = (const uint8_t *) buffer;
+    size_t size                     = (size_t) frames * device->frame_bytes;
+    size_t index                    = 0;
+    uint8_t expected[64];
+    for(int i = 0; i < 64; i++)
+        expected[i] = (uint8_t) (device->silence_pattern >> (8 * (i & 7)));
+
+    /** OR-reduce into independent byte lanes so the compiler vectorizes the scan, stop after the first loud block */
+    while(index + 64 <= size)
     {
-        if(stop_alsa_device(device) == SA_SUCCESS)
+        size_t end = index + SA_SILENCE_SCAN_BLOCK <= size ? index + SA_SILENCE_SCAN_BLOCK : size & ~(size_t) 63;
+        uint8_t lanes[64] = {0};
+        uint8_t loud      = 0;
+        for(; index < end; index += 64)
         {
-            sa_result result = wait_for_stop_alsa_device(device);
-            pthread_mutex_unlock(&(device->condition_var->mutex));
-            return result;
+            for(int lane = 0; lane < 64; lane++)
+                lanes[lane] |= bytes[index + lane] ^ expected[lane];
         }
+        for(int lane = 0; lane < 64; lane++)
+            loud |= lanes[lane];
+        if(loud)
+            return false;
     }
-    pthread_mutex_unlock(&(device->condition_var->mutex));
-    return SA_INVALID_STATE;
+    for(; index < size; index++)
+        if(bytes[index] != expected[index & 63])
+            return false;
+    return true;
 }
 
-extern sa_result sa_pause_device(sa_device *device) {
-    if(sa_get_device_state(device) == SA_DEVICE_STARTED)
-        return pause_alsa_device(device);
-    else
+static sa_meter_function select_meter_function(sa_device *device) {
+    /** Index 0 is used for any channel count, 1 and 2 for the specialized layouts */
+    static const sa_meter_function s16[3]     = {sa_meter_s16_nch, sa_meter_s16_1ch, sa_meter_s16_2ch};
+    static const sa_meter_function s24_3le[3] = {sa_meter_s24_3le_nch, sa_meter_s24_3le_1ch, sa_meter_s24_3le_2ch};
+    static const sa_meter_function s32[3]     = {sa_meter_s32_nch, sa_meter_s32_1ch, sa_meter_s32_2ch};
+    static const sa_meter_function flt[3]     = {sa_meter_float_nch, sa_meter_float_1ch, sa_meter_float_2ch};
+    int layout = device->config->channels <= 2 ? device->config->channels : 0;
+    if(device->config->channels > SA_MAX_CHANNELS)
+        return NULL;
+
+    switch(device->config->format)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to pause the device, the device is already ");
-        return SA_INVALID_STATE;
+    case SND_PCM_FORMAT_S16_LE:
+        return s16[layout];
+    case SND_PCM_FORMAT_S24_3LE:
+        return s24_3le[layout];
+    case SND_PCM_FORMAT_S32_LE:
+        return s32[layout];
+    case SND_PCM_FORMAT_FLOAT_LE:
+        return flt[layout];
+    default:
+        return NULL;
     }
 }
 
-extern sa_result sa_destroy_device(sa_device *device) {
-    return destroy_alsa_device(device);
-}
-
-extern sa_device_state sa_get_device_state(sa_device *device) {
-    pthread_mutex_lock(&(device->stateMutex));
-    sa_device_state result = device->state;
-    pthread_mutex_unlock(&(device->stateMutex));
-    return result;
+static sa_downmix_function select_downmix_function(sa_device *device) {
+    switch(device->config->format)
+    {
+    case SND_PCM_FORMAT_S16_LE:
+        return sa_downmix_s16;
+    case SND_PCM_FORMAT_S24_3LE:
+        return sa_downmix_s24_3le;
+    case SND_PCM_FORMAT_S32_LE:
+        return sa_downmix_s32;
+    case SND_PCM_FORMAT_FLOAT_LE:
+        return sa_downmix_float;
+    default:
+        return NULL;
+    }
 }
 
-/*========================= LOG DEFINITIONS ==========================*/
-static void sa_log(sa_log_type type, const char msg0[], const char msg1[]) {
-    switch(type)
+static void analyze_samples(sa_device *device, const void *buffer, int frames) {
+    sa_analysis *analysis = &(device->analysis);
+    if(analysis->meter && frames > 0)
     {
-    #ifndef SA_NO_ERROR_LOGS
-    case SA_LOG_LEVEL_ERROR:
-        printf("\e[1;31m[  SA ERROR   ] \e[0m %s %s\n", msg0, msg1);
-        break;
-    #endif
-    #ifndef SA_NO_WARNING_LOGS
-    case SA_LOG_LEVEL_WARNING:
-        printf("\e[1;33m[  SA WARNING ] \e[0m %s %s\n", msg0, msg1);
-        break;
-    #endif
-    #ifndef SA_NO_DEBUG_LOGS
-    case SA_LOG_LEVEL_DEBUG:
-        printf("\e[1;35m[  SA DEBUG   ] \e[0m %s %s\n", msg0, msg1);
-        break;
+        sa_meter_peak peak[SA_MAX_CHANNELS] = {0};
+        sa_meter_sum sum[SA_MAX_CHANNELS]   = {0};
+        int channels                        = device->config->channels;
+        analysis->meter(buffer, frames, channels, peak, sum);
+
+        /** Seqlock: readers retry while the sequence is odd or changed under them */
+        unsigned int sequence = analysis->levels_sequence;
+        __atomic_store_n(&(analysis->levels_sequence), sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for(int channel = 0; channel < channels; channel++)
+        {
+    #if defined SA_FIXED_POINT
+            /** The meter stays in integers, only the per period results become the public float levels */
+            float level = (float) peak[channel] * (1.0f / 2147483648.0f);
+            float rms   = sqrtf((float) (sum[channel] / (uint64_t) frames)) * (1.0f / 32768.0f);
+    #else
+            float level = peak[channel];
+            float rms   = sqrtf(sum[channel] / (float) frames);
     #endif
-    default:
-        break;
+            __atomic_store(&(analysis->levels.peak[channel]), &level, __ATOMIC_RELAXED);
+            __atomic_store(&(analysis->levels.rms[channel]), &rms, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&(analysis->levels_sequence), sequence + 2, __ATOMIC_RELEASE);
+    }
+    if(analysis->ring && frames > 0)
+    {
+        analysis->downmix(buffer, frames, device->config->channels, analysis->ring, analysis->ring_size - 1,
+                          analysis->write_position);
+        __atomic_store_n(&(analysis->write_position), analysis->write_position + (unsigned int) frames,
+                         __ATOMIC_RELEASE);
     }
-    fflush(stdout);
 }
 
-/*======================= ALSA FUNC DEFINITIONS ======================*/
-static sa_result init_alsa_device(sa_device *device) {
-    int err;
-    snd_pcm_hw_params_alloca(&(device->hw_params));
-    snd_pcm_sw_params_alloca(&(device->sw_params));
-
-    if((err = snd_pcm_open(&(device->handle), device->config->alsa_device_name, SND_PCM_STREAM_PLAYBACK, 0)) <
-       0)
+/*========================= MIXER DEFINITIONS ========================*/
+extern sa_result sa_init_mixer(sa_device_config *config, sa_mixer **mixer) {
+    if(config->format != SND_PCM_FORMAT_S16_LE && config->format != SND_PCM_FORMAT_S24_3LE &&
+       config->format != SND_PCM_FORMAT_S32_LE && config->format != SND_PCM_FORMAT_FLOAT_LE)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: playback open error:", snd_strerror(err));
-        exit(EXIT_FAILURE);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Mixer does not support format", snd_pcm_format_name(config->format));
+        return SA_ERROR;
     }
+    sa_mixer *mixer_temp = (sa_mixer *) calloc(1, sizeof(sa_mixer));
+    if(!mixer_temp)
+        return SA_ERROR;
 
-    if((err = set_hardware_parameters(device, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+    config->data_callback  = &mixer_data_callback;
+    config->eof_callback   = NULL;
+    config->my_custom_data = mixer_temp;
+    mixer_temp->channels   = config->channels;
+    if(sa_init_device(config, &(mixer_temp->device)) != SA_SUCCESS)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: setting hardware parameters failed:", snd_strerror(err));
-        exit(EXIT_FAILURE);
+        free(mixer_temp);
+        return SA_ERROR;
     }
-    if((err = set_software_parameters(device)) < 0)
+
+    size_t samples            = (size_t) mixer_temp->device->buffer_size * config->channels;
+    mixer_temp->mix_buffer    = (sa_mix_sample *) malloc(samples * sizeof(sa_mix_sample));
+    mixer_temp->source_buffer = (sa_mix_sample *) malloc(samples * sizeof(sa_mix_sample));
+    if(!mixer_temp->mix_buffer || !mixer_temp->source_buffer)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: setting software parameters failed:", snd_strerror(err));
-        exit(EXIT_FAILURE);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to allocate the mix buffers");
+        sa_destroy_mixer(mixer_temp);
+        return SA_ERROR;
     }
+    *mixer = mixer_temp;
+    return SA_SUCCESS;
+}
 
-    device->samples = (int *) malloc((device->period_size * device->config->channels *
-                                      snd_pcm_format_physical_width(device->config->format)) /
-                                     8);
-
-    if(device->samples == NULL)
-    { exit(EXIT_FAILURE); }
+extern sa_device *sa_get_mixer_device(sa_mixer *mixer) {
+    return mixer->device;
+}
 
-    device->supports_pause = snd_pcm_hw_params_can_pause(device->hw_params);
-    if(device->supports_pause)
-    {
-        SA_LOG(SA_LOG_LEVEL_DEBUG, "Device supports snd_pcm_pause()");
-    } else
-    { SA_LOG(SA_LOG_LEVEL_DEBUG, "Device does not support snd_pcm_pause()"); }
+extern sa_result sa_destroy_mixer(sa_mixer *mixer) {
+    sa_result result = sa_destroy_device(mixer->device);
+    for(int i = 0; i < SA_MAX_MIXER_SOURCES; i++)
+        free(mixer->sources[i].ring);
+    free(mixer->mix_buffer);
+    free(mixer->source_buffer);
+    free(mixer);
+    return result;
+}
 
-    if(prepare_playback_thread(device) != SA_SUCCESS)
+extern sa_result sa_mixer_add_source(sa_mixer *mixer, sa_mixer_callback callback, void *my_custom_data,
+                                     int *source_id) {
+    if(!callback)
+        return SA_ERROR;
+    int slot = claim_mixer_source(mixer);
+    if(slot < 0)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to prepare the playback thread");
-        exit(EXIT_FAILURE);
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Every mixer source is in use");
+        return SA_ERROR;
     }
+    sa_mixer_source *source = &(mixer->sources[slot]);
+    source->callback        = callback;
+    source->my_custom_data  = my_custom_data;
+    __atomic_store_n(&(source->state), SA_MIXER_SOURCE_ACTIVE, __ATOMIC_RELEASE);
+    *source_id = slot;
     return SA_SUCCESS;
 }
 
-static sa_result set_hardware_parameters(sa_device *device, snd_pcm_access_t access) {
-    unsigned int rrate;
-    snd_pcm_uframes_t size;
-    int err, dir;
+extern sa_result sa_mixer_add_ring_source(sa_mixer *mixer, int ring_frames, int *source_id) {
+    if(ring_frames <= 0)
+        return SA_ERROR;
+    unsigned int capacity = 1;
+    while(capacity < (unsigned int) ring_frames)
+        capacity <<= 1;
+    sa_mix_sample *ring = (sa_mix_sample *) calloc((size_t) capacity * mixer->channels, sizeof(sa_mix_sample));
+    if(!ring)
+        return SA_ERROR;
 
-    err = snd_pcm_hw_params_any(device->handle, device->hw_params);
-    if(err < 0)
+    int slot = claim_mixer_source(mixer);
+    if(slot < 0)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR,
-               "ALSA: broken configuration for playback: no configurations available:", snd_strerror(err));
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Every mixer source is in use");
+        free(ring);
         return SA_ERROR;
     }
-    /** Set the sample_rate */
-    err = snd_pcm_hw_params_set_rate_resample(device->handle, device->hw_params, 1);
-    if(err < 0)
+    sa_mixer_source *source = &(mixer->sources[slot]);
+    source->callback        = NULL;
+    source->ring            = ring;
+    source->ring_frames     = capacity;
+    source->read_position   = 0;
+    source->write_position  = 0;
+    __atomic_store_n(&(source->state), SA_MIXER_SOURCE_ACTIVE, __ATOMIC_RELEASE);
+    *source_id = slot;
+    return SA_SUCCESS;
+}
+
+extern int sa_mixer_write(sa_mixer *mixer, int source_id, const sa_mix_sample *frames, int amount_of_frames) {
+    if(source_id < 0 || source_id >= SA_MAX_MIXER_SOURCES)
+        return -1;
+    sa_mixer_source *source = &(mixer->sources[source_id]);
+
+    /** Announce the copy before checking the state, so a removal either sees the writer or the writer sees the claim */
+    __atomic_store_n(&(source->writing), 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&(source->state), __ATOMIC_SEQ_CST) != SA_MIXER_SOURCE_ACTIVE || !source->ring)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: resampling setup failed for playback:", snd_strerror(err));
-        return SA_ERROR;
+        __atomic_store_n(&(source->writing), 0, __ATOMIC_RELEASE);
+        return -1;
     }
-    /* Set the interleaved read/write format */
-    err = snd_pcm_hw_params_set_access(device->handle, device->hw_params, access);
-    if(err < 0)
+    unsigned int write = source->write_position;
+    unsigned int read  = __atomic_load_n(&(source->read_position), __ATOMIC_ACQUIRE);
+    unsigned int space = source->ring_frames - (write - read);
+    unsigned int count = (unsigned int) amount_of_frames < space ? (unsigned int) amount_of_frames : space;
+    for(unsigned int frame = 0; frame < count; frame++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: access type not available for playback", snd_strerror(err));
-        return SA_ERROR;
+        sa_mix_sample *slot = &(source->ring[((write + frame) & (source->ring_frames - 1)) * mixer->channels]);
+        memcpy(slot, &frames[frame * mixer->channels], sizeof(sa_mix_sample) * mixer->channels);
     }
-    /* Set the sample format */
-    err = snd_pcm_hw_params_set_format(device->handle, device->hw_params, device->config->format);
-    if(err < 0)
+    __atomic_store_n(&(source->write_position), write + count, __ATOMIC_RELEASE);
+    __atomic_store_n(&(source->writing), 0, __ATOMIC_RELEASE);
+    return (int) count;
+}
+
+extern sa_result sa_mixer_remove_source(sa_mixer *mixer, int source_id) {
+    if(source_id < 0 || source_id >= SA_MAX_MIXER_SOURCES)
+        return SA_ERROR;
+    sa_mixer_source *source = &(mixer->sources[source_id]);
+    int expected            = SA_MIXER_SOURCE_ACTIVE;
+    if(!__atomic_compare_exchange_n(&(source->state), &expected, SA_MIXER_SOURCE_CLAIMED, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return SA_INVALID_STATE;
+
+    /** A mix that started before the claim may still use the source, wait until it is done */
+    unsigned int sequence = __atomic_load_n(&(mixer->mix_sequence), __ATOMIC_SEQ_CST);
+    if(sequence & 1)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample format not available for playback:", snd_strerror(err));
+        while(__atomic_load_n(&(mixer->mix_sequence), __ATOMIC_SEQ_CST) == sequence)
+            usleep(100);
+    }
+
+    /** The producer may be inside sa_mixer_write(), it bails out once it sees the claim */
+    while(__atomic_load_n(&(source->writing), __ATOMIC_SEQ_CST))
+        usleep(100);
+    free(source->ring);
+    source->ring           = NULL;
+    source->callback       = NULL;
+    source->my_custom_data = NULL;
+    __atomic_store_n(&(source->state), SA_MIXER_SOURCE_FREE, __ATOMIC_RELEASE);
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_mixer_set_source_gain(sa_mixer *mixer, int source_id, float gain, float pan) {
+    if(source_id < 0 || source_id >= SA_MAX_MIXER_SOURCES || pan < -1.0f || pan > 1.0f)
         return SA_ERROR;
+    sa_gain gains[2];
+    sa_pan_gains(mixer->channels, gain, pan, gains);
+    __atomic_store(&(mixer->sources[source_id].gains[0]), &gains[0], __ATOMIC_RELAXED);
+    __atomic_store(&(mixer->sources[source_id].gains[1]), &gains[1], __ATOMIC_RELAXED);
+    return SA_SUCCESS;
+}
+
+static int mixer_data_callback(int amount_of_frames, void *audio_buffer, sa_device *device, void *my_custom_data) {
+    sa_mixer *mixer = (sa_mixer *) my_custom_data;
+    int samples     = amount_of_frames * mixer->channels;
+    memset(mixer->mix_buffer, 0, sizeof(sa_mix_sample) * samples);
+
+    __atomic_add_fetch(&(mixer->mix_sequence), 1, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < SA_MAX_MIXER_SOURCES; i++)
+    {
+        sa_mixer_source *source = &(mixer->sources[i]);
+        if(__atomic_load_n(&(source->state), __ATOMIC_SEQ_CST) != SA_MIXER_SOURCE_ACTIVE)
+            continue;
+        int frames = source->callback ? source->callback(amount_of_frames, mixer->source_buffer, mixer->channels,
+                                                         source->my_custom_data)
+                                      : read_mixer_ring(source, mixer->source_buffer, amount_of_frames,
+                                                        mixer->channels);
+        if(frames <= 0)
+            continue;
+        sa_gain gains[2];
+        __atomic_load(&(source->gains[0]), &gains[0], __ATOMIC_RELAXED);
+        __atomic_load(&(source->gains[1]), &gains[1], __ATOMIC_RELAXED);
+        sa_mix_add(mixer->mix_buffer, mixer->source_buffer, frames < amount_of_frames ? frames : amount_of_frames,
+                   mixer->channels, gains);
     }
-    /* Set the count of channels */
-    err = snd_pcm_hw_params_set_channels(device->handle, device->hw_params, device->config->channels);
-    if(err < 0)
+    __atomic_add_fetch(&(mixer->mix_sequence), 1, __ATOMIC_SEQ_CST);
+
+    sa_mix_convert(mixer->mix_buffer, audio_buffer, samples, device->config->format);
+    /** The mix never ends on its own, silence is played when no source is active */
+    return amount_of_frames;
+}
+
+static int claim_mixer_source(sa_mixer *mixer) {
+    for(int i = 0; i < SA_MAX_MIXER_SOURCES; i++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: channels count not available for playback", snd_strerror(err));
-        return SA_ERROR;
+        int expected = SA_MIXER_SOURCE_FREE;
+        if(__atomic_compare_exchange_n(&(mixer->sources[i].state), &expected, SA_MIXER_SOURCE_CLAIMED, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            sa_gain unity = SA_GAIN_ONE;
+            __atomic_store(&(mixer->sources[i].gains[0]), &unity, __ATOMIC_RELAXED);
+            __atomic_store(&(mixer->sources[i].gains[1]), &unity, __ATOMIC_RELAXED);
+            return i;
+        }
     }
-    /* Set the stream rate */
-    rrate = device->config->sample_rate;
-    err   = snd_pcm_hw_params_set_rate_near(device->handle, device->hw_params, &rrate, 0);
-    if(err < 0)
+    return -1;
+}
+
+static int read_mixer_ring(sa_mixer_source *source, sa_mix_sample *buffer, int amount_of_frames, int channels) {
+    unsigned int read      = source->read_position;
+    unsigned int write     = __atomic_load_n(&(source->write_position), __ATOMIC_ACQUIRE);
+    unsigned int available = write - read;
+    unsigned int count = (unsigned int) amount_of_frames < available ? (unsigned int) amount_of_frames : available;
+    for(unsigned int frame = 0; frame < count; frame++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample_rate not available for playback", snd_strerror(err));
-        return SA_ERROR;
+        const sa_mix_sample *slot = &(source->ring[((read + frame) & (source->ring_frames - 1)) * channels]);
+        memcpy(&buffer[frame * channels], slot, sizeof(sa_mix_sample) * channels);
     }
-    if(rrate != device->config->sample_rate)
+    __atomic_store_n(&(source->read_position), read + count, __ATOMIC_RELEASE);
+    return (int) count;
+}
+
+static void sa_mix_add(sa_mix_sample *mix, const sa_mix_sample *source, int frames, int channels,
+                       const sa_gain *gains) {
+    sa_mix_sample *__restrict out      = mix;
+    const sa_mix_sample *__restrict in = source;
+    int done                           = SA_SIMD_MIX_ADD(out, in, frames * channels, channels == 2 ? 2 : 1, gains);
+    if(channels == 2)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: sample rate does not match the requested rate");
-        return SA_ERROR;
+        const sa_gain left = gains[0], right = gains[1];
+        for(int frame = done / 2; frame < frames; frame++)
+        {
+            out[frame * 2]     = SA_MIX_ADD(out[frame * 2], in[frame * 2], left);
+            out[frame * 2 + 1] = SA_MIX_ADD(out[frame * 2 + 1], in[frame * 2 + 1], right);
+        }
+        return;
     }
-    /* Set the buffer time */
-    err = snd_pcm_hw_params_set_buffer_time_near(device->handle, device->hw_params,
-                                                 (unsigned int *) &(device->config->buffer_time), &dir);
-    if(err < 0)
+    const sa_gain gain = gains[0];
+    for(int i = done; i < frames * channels; i++)
+        out[i] = SA_MIX_ADD(out[i], in[i], gain);
+}
+
+static inline float sa_clamp_unit(float sample) {
+    sample = sample < 1.0f ? sample : 1.0f;
+    return sample > -1.0f ? sample : -1.0f;
+}
+
+static void sa_pan_gains(int channels, float gain, float pan, sa_gain *gains) {
+    /** Balance law: the centre is unity gain, panning only attenuates the opposite side */
+    gains[0] = sa_to_gain(channels == 2 ? gain * (pan > 0.0f ? 1.0f - pan : 1.0f) : gain);
+    gains[1] = sa_to_gain(gain * (pan < 0.0f ? 1.0f + pan : 1.0f));
+}
+
+    #if defined SA_FIXED_POINT
+/**
+ * The sums already saturated, so converting the Q31 mix only drops the low bits.
+ */
+static void sa_mix_convert(const sa_mix_sample *mix, void *buffer, int samples, snd_pcm_format_t format) {
+    const int32_t *__restrict in = mix;
+    switch(format)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set the buffer time for playback:", snd_strerror(err));
-        return SA_ERROR;
+    case SND_PCM_FORMAT_S16_LE: {
+        int16_t *__restrict out = (int16_t *) buffer;
+        for(int i = 0; i < samples; i++)
+            out[i] = (int16_t) (in[i] >> 16);
+        break;
     }
-    err = snd_pcm_hw_params_get_buffer_size(device->hw_params, &size);
-    if(err < 0)
+    case SND_PCM_FORMAT_S24_3LE: {
+        uint8_t *__restrict out = (uint8_t *) buffer;
+        for(int i = 0; i < samples; i++)
+        {
+            int32_t value  = in[i] >> 8;
+            out[i * 3]     = (uint8_t) value;
+            out[i * 3 + 1] = (uint8_t) (value >> 8);
+            out[i * 3 + 2] = (uint8_t) (value >> 16);
+        }
+        break;
+    }
+    case SND_PCM_FORMAT_S32_LE:
+        memcpy(buffer, in, sizeof(int32_t) * samples);
+        break;
+    case SND_PCM_FORMAT_FLOAT_LE: {
+        float *__restrict out = (float *) buffer;
+        for(int i = 0; i < samples; i++)
+            out[i] = (float) in[i] * (1.0f / 2147483648.0f);
+        break;
+    }
+    default:
+        break;
+    }
+}
+    #else
+        #if defined __ARM_NEON
+/** Lane wise sa_clamp_unit(), the selects keep its handling of NaN */
+static inline float32x4_t sa_neon_clamp_unit(float32x4_t sample) {
+    sample = vbslq_f32(vcltq_f32(sample, vdupq_n_f32(1.0f)), sample, vdupq_n_f32(1.0f));
+    return vbslq_f32(vcgtq_f32(sample, vdupq_n_f32(-1.0f)), sample, vdupq_n_f32(-1.0f));
+}
+
+/** Clamps and converts whole vectors, returns the samples done and leaves the rest to the scalar loop */
+static int sa_simd_convert_s16(const float *mix, int16_t *out, int samples) {
+    int index = 0;
+    for(; index + 8 <= samples; index += 8)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to get the buffer size for playback:", snd_strerror(err));
-        return SA_ERROR;
+        float32x4_t low  = vmulq_n_f32(sa_neon_clamp_unit(vld1q_f32(&mix[index])), 32767.0f);
+        float32x4_t high = vmulq_n_f32(sa_neon_clamp_unit(vld1q_f32(&mix[index + 4])), 32767.0f);
+        vst1q_s16(&out[index], vcombine_s16(vmovn_s32(vcvtq_s32_f32(low)), vmovn_s32(vcvtq_s32_f32(high))));
     }
-    device->buffer_size = size;
-    /* Set the period time */
-    err                 = snd_pcm_hw_params_set_period_time_near(device->handle, device->hw_params,
-                                                                 (unsigned int *) &(device->config->period_time), &dir);
-    if(err < 0)
+    return index;
+}
+
+static int sa_simd_convert_float(const float *mix, float *out, int samples) {
+    int index = 0;
+    for(; index + 4 <= samples; index += 4)
+        vst1q_f32(&out[index], sa_neon_clamp_unit(vld1q_f32(&mix[index])));
+    return index;
+}
+
+            #define SA_SIMD_CONVERT_S16   sa_simd_convert_s16
+            #define SA_SIMD_CONVERT_FLOAT sa_simd_convert_float
+        #elif defined __SSE2__
+/** Lane wise sa_clamp_unit(), minps and maxps return the second operand for NaN just like its comparisons */
+static inline __m128 sa_sse_clamp_unit(__m128 sample) {
+    return _mm_max_ps(_mm_min_ps(sample, _mm_set1_ps(1.0f)), _mm_set1_ps(-1.0f));
+}
+
+/** Clamps and converts whole vectors, returns the samples done and leaves the rest to the scalar loop */
+static int sa_simd_convert_s16(const float *mix, int16_t *out, int samples) {
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    int index          = 0;
+    for(; index + 8 <= samples; index += 8)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set the period time for playback:", snd_strerror(err));
-        return SA_ERROR;
+        __m128i low  = _mm_cvttps_epi32(_mm_mul_ps(sa_sse_clamp_unit(_mm_loadu_ps(&mix[index])), scale));
+        __m128i high = _mm_cvttps_epi32(_mm_mul_ps(sa_sse_clamp_unit(_mm_loadu_ps(&mix[index + 4])), scale));
+        _mm_storeu_si128((__m128i *) &out[index], _mm_packs_epi32(low, high));
     }
-    err = snd_pcm_hw_params_get_period_size(device->hw_params, &size, &dir);
-    if(err < 0)
+    return index;
+}
+
+/** The scalar loop scales in double, so do the lanes: two per conversion */
+static int sa_simd_convert_s32(const float *mix, int32_t *out, int samples) {
+    const __m128d scale = _mm_set1_pd(2147483647.0);
+    int index           = 0;
+    for(; index + 4 <= samples; index += 4)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to get period size for playback:", snd_strerror(err));
-        return SA_ERROR;
+        __m128 sample = sa_sse_clamp_unit(_mm_loadu_ps(&mix[index]));
+        __m128i low   = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(sample), scale));
+        __m128i high  = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(sample, sample)), scale));
+        _mm_storeu_si128((__m128i *) &out[index], _mm_unpacklo_epi64(low, high));
     }
-    device->period_size = size;
-    /* Write the parameters to device */
-    err                 = snd_pcm_hw_params(device->handle, device->hw_params);
-    if(err < 0)
+    return index;
+}
+
+static int sa_simd_convert_float(const float *mix, float *out, int samples) {
+    int index = 0;
+    for(; index + 4 <= samples; index += 4)
+        _mm_storeu_ps(&out[index], sa_sse_clamp_unit(_mm_loadu_ps(&mix[index])));
+    return index;
+}
+
+            #define SA_SIMD_CONVERT_S16   sa_simd_convert_s16
+            #define SA_SIMD_CONVERT_S32   sa_simd_convert_s32
+            #define SA_SIMD_CONVERT_FLOAT sa_simd_convert_float
+        #endif
+
+        /** Without a SIMD path every sample is left to the scalar loop */
+        #define SA_NO_SIMD_CONVERT(mix, buffer, samples) 0
+        #if !defined SA_SIMD_CONVERT_S16
+            #define SA_SIMD_CONVERT_S16 SA_NO_SIMD_CONVERT
+        #endif
+        #if !defined SA_SIMD_CONVERT_S32
+            #define SA_SIMD_CONVERT_S32 SA_NO_SIMD_CONVERT
+        #endif
+        #if !defined SA_SIMD_CONVERT_FLOAT
+            #define SA_SIMD_CONVERT_FLOAT SA_NO_SIMD_CONVERT
+        #endif
+
+/**
+ * The loops clamp in the float domain and then truncate. The clamp and conversion do not vectorize at -O2 without
+ * -ffast-math, so the NEON and SSE2 paths above convert the leading whole vectors; S24_3LE, S32 on NEON and the
+ * tails use the scalar loops, which give the same values.
+ */
+static void sa_mix_convert(const sa_mix_sample *mix, void *buffer, int samples, snd_pcm_format_t format) {
+    const float *__restrict in = mix;
+    switch(format)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR,
-               "ALSA: unable to set hardware parameters for playback:", snd_strerror(err));
-        return SA_ERROR;
+    case SND_PCM_FORMAT_S16_LE: {
+        int16_t *__restrict out = (int16_t *) buffer;
+        for(int i = SA_SIMD_CONVERT_S16(in, out, samples); i < samples; i++)
+        {
+            float sample = sa_clamp_unit(in[i]);
+            out[i]       = (int16_t) (sample * 32767.0f);
+        }
+        break;
+    }
+    case SND_PCM_FORMAT_S24_3LE: {
+        uint8_t *__restrict out = (uint8_t *) buffer;
+        for(int i = 0; i < samples; i++)
+        {
+            float sample   = sa_clamp_unit(in[i]);
+            int32_t value  = (int32_t) (sample * 8388607.0f);
+            out[i * 3]     = (uint8_t) value;
+            out[i * 3 + 1] = (uint8_t) (value >> 8);
+            out[i * 3 + 2] = (uint8_t) (value >> 16);
+        }
+        break;
+    }
+    case SND_PCM_FORMAT_S32_LE: {
+        int32_t *__restrict out = (int32_t *) buffer;
+        for(int i = SA_SIMD_CONVERT_S32(in, out, samples); i < samples; i++)
+        {
+            float sample = sa_clamp_unit(in[i]);
+            out[i]       = (int32_t) ((double) sample * 2147483647.0);
+        }
+        break;
+    }
+    case SND_PCM_FORMAT_FLOAT_LE: {
+        float *__restrict out = (float *) buffer;
+        for(int i = SA_SIMD_CONVERT_FLOAT(in, out, samples); i < samples; i++)
+            out[i] = sa_clamp_unit(in[i]);
+        break;
+    }
+    default:
+        break;
     }
-    return SA_SUCCESS;
 }
+    #endif
 
-static sa_result set_software_parameters(sa_device *device) {
-    int err;
+/*======================== SAMPLER DEFINITIONS =======================*/
+extern sa_result sa_init_sampler(sa_mixer *mixer, sa_sampler **sampler) {
+    sa_sampler *sampler_temp = (sa_sampler *) calloc(1, sizeof(sa_sampler));
+    if(!sampler_temp)
+        return SA_ERROR;
+    sampler_temp->mixer = mixer;
+    for(int i = 0; i < SA_SAMPLER_VOICES; i++)
+        sampler_temp->voices[i].clip_id = -1;
+    for(unsigned int i = 0; i < SA_SAMPLER_TRIGGER_CAPACITY; i++)
+        sampler_temp->triggers[i].sequence = i;
 
-    /* Get the current sw_params */
-    err = snd_pcm_sw_params_current(device->handle, device->sw_params);
-    if(err < 0)
+    if(sa_mixer_add_source(mixer, &sampler_callback, sampler_temp, &(sampler_temp->source_id)) != SA_SUCCESS)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR,
-               "ALSA: unable to determine current software parameters for playback:", snd_strerror(err));
+        free(sampler_temp);
         return SA_ERROR;
     }
-    /* Start the transfer when the buffer is almost full: (buffer_size / avail_min) * avail_min */
-    err = snd_pcm_sw_params_set_start_threshold(
-      device->handle, device->sw_params, (device->buffer_size / device->period_size) * device->period_size);
-    if(err < 0)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to start set threshold mode for playback",
-               snd_strerror(err));
+    *sampler = sampler_temp;
+    return SA_SUCCESS;
+}
+
+extern sa_result sa_destroy_sampler(sa_sampler *sampler) {
+    sa_result result = sa_mixer_remove_source(sampler->mixer, sampler->source_id);
+    for(int i = 0; i < SA_SAMPLER_MAX_CLIPS; i++)
+        free(sampler->clips[i].frames);
+    free(sampler);
+    return result;
+}
+
+extern sa_result sa_sampler_load_clip(sa_sampler *sampler, const sa_mix_sample *frames, int amount_of_frames,
+                                      int *clip_id) {
+    if(!frames || amount_of_frames <= 0)
         return SA_ERROR;
-    }
-    /* Allow the transfer when at least period_size samples can be processed */
-    /* or disable this mechanism when period event is enabled (aka interrupt like style processing) */
-    err = snd_pcm_sw_params_set_avail_min(device->handle, device->sw_params,
-                                          0 ? device->buffer_size : device->period_size);
-    if(err < 0)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set available minimum for playback", snd_strerror(err));
+    size_t bytes        = (size_t) amount_of_frames * sampler->mixer->channels * sizeof(sa_mix_sample);
+    sa_mix_sample *copy = (sa_mix_sample *) malloc(bytes);
+    if(!copy)
         return SA_ERROR;
-    }
-    /* Enable period events when requested */
-    if(0)
+    memcpy(copy, frames, bytes);
+
+    /** Claim the slot only once nothing can fail, a claimed slot is never given back */
+    int slot = __atomic_load_n(&(sampler->clip_count), __ATOMIC_RELAXED);
+    do
     {
-        err = snd_pcm_sw_params_set_period_event(device->handle, device->sw_params, 1);
-        if(err < 0)
+        if(slot >= SA_SAMPLER_MAX_CLIPS)
         {
-            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set period event", snd_strerror(err));
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Every sampler clip slot is in use");
+            free(copy);
             return SA_ERROR;
         }
-    }
-    /* Write the parameters to the playback device */
-    err = snd_pcm_sw_params(device->handle, device->sw_params);
-    if(err < 0)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: unable to set software parameters for playback", snd_strerror(err));
-        return SA_ERROR;
-    }
+    } while(!__atomic_compare_exchange_n(&(sampler->clip_count), &slot, slot + 1, true, __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED));
+    sampler->clips[slot].amount_of_frames = amount_of_frames;
+    /** Publishing the frames makes the clip playable */
+    __atomic_store_n(&(sampler->clips[slot].frames), copy, __ATOMIC_RELEASE);
+    *clip_id = slot;
     return SA_SUCCESS;
 }
 
-static sa_result prepare_playback_thread(sa_device *device) {
-    /** Prepare communication pipe */
-    int pipe_fds[2];
-    if(pipe(pipe_fds) < 0)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Cannot create poll_pipe");
-        return SA_ERROR;
-    }
-    /** Makes read end nonblocking */
-    if(fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK) < 0)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to make pipe non-blocking");
-        close(pipe_fds[0]);
-        close(pipe_fds[1]);
+extern sa_result sa_sampler_trigger(sa_sampler *sampler, int clip_id, float gain, float pan,
+                                    unsigned long long at_frame) {
+    if(clip_id < 0 || clip_id >= SA_SAMPLER_MAX_CLIPS)
         return SA_ERROR;
-    }
-    /** Store the write end */
-    device->pipe_write_end          = pipe_fds[1];
-    /** Prepare read polling structure of the read end */
-    struct pollfd *pipe_read_end_fd = (struct pollfd *) malloc(sizeof(struct pollfd));
-    pipe_read_end_fd->fd            = pipe_fds[0];
-    pipe_read_end_fd->events        = POLLIN;
-    /** Prepare the condition variable*/
-    device->condition_var           = (sa_condition_variable *) malloc(sizeof(sa_condition_variable));
-    pthread_mutex_init(&(device->condition_var->mutex), NULL);
-    pthread_cond_init(&(device->condition_var->cond), NULL);
-    device->condition_var->is_stopped = true;
-    /** Prepare stateMutex */
-    pthread_mutex_init(&(device->stateMutex), NULL);
-    /** Startup the playback thread */
-    sa_thread_data *thread_data   = (sa_thread_data *) malloc(sizeof(sa_thread_data));
-    thread_data->device           = device;
-    thread_data->pipe_read_end_fd = pipe_read_end_fd;
-    if(pthread_create(&device->playback_thread, NULL, &init_playback_thread, (void *) thread_data) != 0)
+    unsigned int position = __atomic_load_n(&(sampler->enqueue_position), __ATOMIC_RELAXED);
+    sa_sampler_trigger_entry *entry;
+    while(1)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the playback thread");
-        return SA_ERROR;
+        entry            = &(sampler->triggers[position & (SA_SAMPLER_TRIGGER_CAPACITY - 1)]);
+        unsigned int seq = __atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE);
+        int difference   = (int) (seq - position);
+        if(difference == 0)
+        {
+            if(__atomic_compare_exchange_n(&(sampler->enqueue_position), &position, position + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(difference < 0)
+        {
+            __atomic_add_fetch(&(sampler->dropped_triggers), 1, __ATOMIC_RELAXED);
+            return SA_ERROR;
+        } else
+        { position = __atomic_load_n(&(sampler->enqueue_position), __ATOMIC_RELAXED); }
     }
+    entry->clip_id  = clip_id;
+    entry->at_frame = at_frame;
+    sa_pan_gains(sampler->mixer->channels, gain, pan, entry->gains);
+    __atomic_store_n(&(entry->sequence), position + 1, __ATOMIC_RELEASE);
     return SA_SUCCESS;
 }
 
-static sa_result start_alsa_device(sa_device *device) {
-    return unpause_alsa_device(device);
+extern unsigned long long sa_sampler_get_frame_time(sa_sampler *sampler) {
+    return __atomic_load_n(&(sampler->frame_time), __ATOMIC_ACQUIRE);
 }
 
-static void *init_playback_thread(void *data) {
-    char command;
-    /** Unwrap the data packet */
-    sa_thread_data *thread_data     = (sa_thread_data *) data;
-    sa_device *device               = thread_data->device;
-    struct pollfd *pipe_read_end_fd = thread_data->pipe_read_end_fd;
-    free(thread_data);
+static int sampler_callback(int amount_of_frames, sa_mix_sample *audio_buffer, int channels, void *my_custom_data) {
+    sa_sampler *sampler             = (sa_sampler *) my_custom_data;
+    unsigned long long period_start = sampler->frame_time;
+    bool silent                     = true;
+    start_sampler_voices(sampler);
 
-    /** Actual playback loop, lives and dies with the device */
-    while(1)
+    for(int i = 0; i < SA_SAMPLER_VOICES; i++)
     {
-        /** Poll on read end, wait for initial play command */
-        poll(pipe_read_end_fd, 1, -1);
-
-        if(pipe_read_end_fd->revents & POLLIN)
+        sa_sampler_voice *voice = &(sampler->voices[i]);
+        if(voice->clip_id < 0 || voice->start_frame >= period_start + amount_of_frames)
+            continue;
+        if(silent)
         {
-            if(read(pipe_read_end_fd->fd, &command, 1) != 1)
-            {
-                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
-            } else
-            {
-                switch(command)
-                {
-                /** Play command */
-                case 'u':
-                    {
-                        /** Save state */
-                        save_device_state(device, SA_DEVICE_STARTED);
-                        /** Start playback */
-                        sa_result res = start_write_and_poll_loop(device, pipe_read_end_fd);
-                        /** The write and poll loop can end in three ways: error, a stop command is sent, or
-                         * no more audio is send to the audio buffer */
-                        if(res == SA_ERROR)
-                        {
-                            save_device_state(device, SA_DEVICE_STOPPED);
-                            break;
-                        } else if(res == SA_STOP)
-                        {
-                            drop_alsa_device(device);
-                            prepare_alsa_device(device);
-                            save_device_state(device, SA_DEVICE_STOPPED);
-
-                        } else if(res == SA_AT_END)
-                        {
-                            /** Received no frames anymore from the callback so we stop and prepare the alsa device again */
-                            drain_alsa_device(device);
-                            prepare_alsa_device(device);
-                            save_device_state(device, SA_DEVICE_STOPPED);
-                            /** Signal eof */
-                            void (*eof_callback)(sa_device * sa_device, void *my_custom_data) =
-                              (void (*)(sa_device *, void *my_custom_data)) device->config->eof_callback;
-                            eof_callback(device, device->config->my_custom_data);
-                        }
-                        continue;
-                    }
-                /** Destroy command, no continue; break out of while */
-                case 'd':
-                    break;
-                default:
-                    SA_LOG(SA_LOG_LEVEL_DEBUG, "Command sent to the pipe is ignored");
-                    continue;
-                }
-                SA_LOG(SA_LOG_LEVEL_DEBUG, "Attempting to destroy the device");
-                break;
-            }
+            memset(audio_buffer, 0, sizeof(sa_mix_sample) * amount_of_frames * channels);
+            silent = false;
         }
+        sa_sampler_clip *clip = &(sampler->clips[voice->clip_id]);
+        int offset = voice->start_frame > period_start ? (int) (voice->start_frame - period_start) : 0;
+        int frames = amount_of_frames - offset;
+        if(frames > clip->amount_of_frames - voice->position)
+            frames = clip->amount_of_frames - voice->position;
+        sa_mix_add(&audio_buffer[offset * channels], &(clip->frames[voice->position * channels]), frames, channels,
+                   voice->gains);
+        voice->position += frames;
+        if(voice->position >= clip->amount_of_frames)
+            voice->clip_id = -1;
     }
-    close(pipe_read_end_fd->fd);
-    free(pipe_read_end_fd);
-    return NULL;
+    __atomic_store_n(&(sampler->frame_time), period_start + amount_of_frames, __ATOMIC_RELEASE);
+    /** Returning 0 lets the mixer skip the sampler while no voice plays */
+    return silent ? 0 : amount_of_frames;
 }
 
-static sa_result start_write_and_poll_loop(sa_device *device, struct pollfd *pipe_read_end_fd) {
-    sa_result result                 = SA_ERROR;
-    sa_poll_management *poll_manager = NULL;
-    /** Init the poll manager */
-    if(init_poll_management(device, &poll_manager, pipe_read_end_fd) != SA_SUCCESS)
+static void start_sampler_voices(sa_sampler *sampler) {
+    unsigned int position = sampler->dequeue_position;
+    while(1)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not initialize the poll manager");
-        return result;
+        sa_sampler_trigger_entry *entry = &(sampler->triggers[position & (SA_SAMPLER_TRIGGER_CAPACITY - 1)]);
+        if((int) (__atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE) - (position + 1)) < 0)
+            break;
+        /** A clip that is not published yet is skipped */
+        if(__atomic_load_n(&(sampler->clips[entry->clip_id].frames), __ATOMIC_ACQUIRE))
+        {
+            sa_sampler_voice *voice = allocate_sampler_voice(sampler);
+            voice->clip_id          = entry->clip_id;
+            voice->position         = 0;
+            voice->start_frame      = entry->at_frame > sampler->frame_time ? entry->at_frame : sampler->frame_time;
+            voice->serial           = ++(sampler->voice_serial);
+            voice->gains[0]         = entry->gains[0];
+            voice->gains[1]         = entry->gains[1];
+        }
+        __atomic_store_n(&(entry->sequence), position + SA_SAMPLER_TRIGGER_CAPACITY, __ATOMIC_RELEASE);
+        position++;
     }
-    result = write_and_poll_loop(device, poll_manager);
-    /** Cleanup */
-    free(poll_manager->ufds);
-    free(poll_manager);
-    poll_manager = NULL;
-    return result;
+    sampler->dequeue_position = position;
 }
 
-static sa_result init_poll_management(sa_device *device, sa_poll_management **poll_manager,
-                                      struct pollfd *pipe_read_end_fd) {
-    sa_poll_management *poll_manager_temp = (sa_poll_management *) malloc(sizeof(sa_poll_management));
-    int err;
-
-    poll_manager_temp->count = 1 + snd_pcm_poll_descriptors_count(device->handle);
-    /** There must be at least one alsa descriptor */
-    if(poll_manager_temp->count <= 1)
+static sa_sampler_voice *allocate_sampler_voice(sa_sampler *sampler) {
+    sa_sampler_voice *oldest = &(sampler->voices[0]);
+    for(int i = 0; i < SA_SAMPLER_VOICES; i++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Invalid poll descriptor count");
-        return SA_ERROR;
+        if(sampler->voices[i].clip_id < 0)
+            return &(sampler->voices[i]);
+        if(sampler->voices[i].serial < oldest->serial)
+            oldest = &(sampler->voices[i]);
     }
+    __atomic_add_fetch(&(sampler->stolen_voices), 1, __ATOMIC_RELAXED);
+    return oldest;
+}
 
-    poll_manager_temp->ufds = (struct pollfd *) malloc(sizeof(struct pollfd) * (poll_manager_temp->count));
-    if(poll_manager_temp->ufds == NULL)
-    {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Not enough memory to allocate ufds");
+/*========================= CACHE DEFINITIONS ========================*/
+extern sa_result sa_init_cache(size_t memory_budget, sa_cache_decoder decoder, void *my_custom_data,
+                               sa_cache **cache) {
+    if(!decoder)
         return SA_ERROR;
-    }
-    /** Store read end of pipe in the array */
-    poll_manager_temp->ufds[0] = *pipe_read_end_fd;
-
-    /** Don't give ALSA the first poll descriptor */
-    if((err = snd_pcm_poll_descriptors(device->handle, poll_manager_temp->ufds + 1,
-                                       poll_manager_temp->count - 1)) < 0)
+    sa_cache *cache_temp = (sa_cache *) calloc(1, sizeof(sa_cache));
+    if(!cache_temp)
+        return SA_ERROR;
+    cache_temp->decoder        = decoder;
+    cache_temp->my_custom_data = my_custom_data;
+    cache_temp->memory_budget  = memory_budget;
+    pthread_mutex_init(&(cache_temp->mutex), NULL);
+    pthread_cond_init(&(cache_temp->work_cond), NULL);
+    pthread_cond_init(&(cache_temp->loaded_cond), NULL);
+    if(pthread_create(&(cache_temp->worker), NULL, &cache_worker, cache_temp) != 0)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Unable to obtain poll descriptors for playback", snd_strerror(err));
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to start the cache worker");
+        pthread_cond_destroy(&(cache_temp->loaded_cond));
+        pthread_cond_destroy(&(cache_temp->work_cond));
+        pthread_mutex_destroy(&(cache_temp->mutex));
+        free(cache_temp);
         return SA_ERROR;
     }
-    *poll_manager = poll_manager_temp;
+    *cache = cache_temp;
     return SA_SUCCESS;
 }
 
-static sa_result close_playback_thread(sa_device *device) {
-    if(pthread_join(device->playback_thread, NULL) != 0)
+extern sa_result sa_destroy_cache(sa_cache *cache) {
+    pthread_mutex_lock(&(cache->mutex));
+    cache->quit = true;
+    pthread_cond_signal(&(cache->work_cond));
+    pthread_mutex_unlock(&(cache->mutex));
+    pthread_join(cache->worker, NULL);
+
+    sa_cache_entry *entry = cache->head;
+    while(entry)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not join playback thread");
-        return SA_ERROR;
+        sa_cache_entry *next = entry->next;
+        if(entry->references > 0)
+            SA_LOG(SA_LOG_LEVEL_WARNING, "Destroying a cache entry that is still referenced:", entry->name);
+        free_cache_entry(entry);
+        entry = next;
     }
+    pthread_cond_destroy(&(cache->loaded_cond));
+    pthread_cond_destroy(&(cache->work_cond));
+    pthread_mutex_destroy(&(cache->mutex));
+    free(cache);
     return SA_SUCCESS;
 }
 
-static sa_result write_and_poll_loop(sa_device *device, sa_poll_management *poll_manager) {
-    int *ptr;
-    int err, cptr, init, readcount;
-    readcount = 1;
-    init      = 1;
-    while(1)
+extern sa_result sa_cache_prefetch(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels) {
+    pthread_mutex_lock(&(cache->mutex));
+    sa_cache_entry *entry = find_cache_entry(cache, name, format, channels);
+    pthread_mutex_unlock(&(cache->mutex));
+    return entry ? SA_SUCCESS : SA_ERROR;
+}
+
+extern sa_result sa_cache_acquire(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels,
+                                  bool wait, sa_cache_entry **entry) {
+    pthread_mutex_lock(&(cache->mutex));
+    sa_cache_entry *found = find_cache_entry(cache, name, format, channels);
+    if(!found)
     {
-        if(!init)
-        {
-            err = wait_for_poll(device, poll_manager);
+        pthread_mutex_unlock(&(cache->mutex));
+        return SA_ERROR;
+    }
+    found->references++;
+    while(wait && found->state == SA_CACHE_ENTRY_LOADING)
+        pthread_cond_wait(&(cache->loaded_cond), &(cache->mutex));
+    if(wait && found->state == SA_CACHE_ENTRY_FAILED)
+    {
+        found->references--;
+        evict_cache_entries(cache);
+        pthread_mutex_unlock(&(cache->mutex));
+        return SA_ERROR;
+    }
+    pthread_mutex_unlock(&(cache->mutex));
 
-            if(err < 0)
-            {
-                if(snd_pcm_state(device->handle) == SND_PCM_STATE_XRUN ||
-                   snd_pcm_state(device->handle) == SND_PCM_STATE_SUSPENDED)
-                {
-                    err = snd_pcm_state(device->handle) == SND_PCM_STATE_XRUN ? -EPIPE : -ESTRPIPE;
-                    if(xrun_recovery(device->handle, err) != SA_SUCCESS)
-                    {
-                        SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Write error:", snd_strerror(err));
-                        return SA_ERROR;
-                    }
-                    init = 1;
-                } else
-                {
-                    SA_LOG(SA_LOG_LEVEL_ERROR, "Wait for poll failed");
-                    return SA_ERROR;
-                }
-            } else if(err == SA_STOP)
-            { return SA_STOP; }
-        }
-        /** If the callback has not written any frames in the previous call- there are no frames left so we stop the callback loop */
+    *entry = found;
+    return SA_SUCCESS;
+}
 
-        int (*data_callback)(int framesToSend, void *audioBuffer, sa_device *sa_device,
-                             void *my_custom_data) =
-          (int (*)(int, void *, sa_device *, void *my_custom_data)) device->config->data_callback;
-        readcount = data_callback(device->period_size, device->samples, device,
-                                  device->config->my_custom_data);
+extern void sa_cache_release(sa_cache *cache, sa_cache_entry *entry) {
+    pthread_mutex_lock(&(cache->mutex));
+    entry->references--;
+    evict_cache_entries(cache);
+    pthread_mutex_unlock(&(cache->mutex));
+}
 
-        if(readcount == 0)
-        { return SA_AT_END; }
+extern sa_result sa_open_cache_source(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels,
+                                      sa_cache_source *source) {
+    source->cache       = cache;
+    source->position    = 0;
+    source->frame_bytes = snd_pcm_format_physical_width(format) / 8 * channels;
+    return sa_cache_acquire(cache, name, format, channels, false, &(source->entry));
+}
 
-        ptr  = device->samples;
-        cptr = readcount;
+extern void sa_close_cache_source(sa_cache_source *source) {
+    if(source->entry)
+        sa_cache_release(source->cache, source->entry);
+    source->entry = NULL;
+}
 
-        while(cptr > 0)
-        {
-            err = snd_pcm_writei(device->handle, ptr, cptr);
-            if(err < 0)
-            {
-                if(xrun_recovery(device->handle, err) != SA_SUCCESS)
-                {
-                    SA_LOG(SA_LOG_LEVEL_ERROR, "Write error:", snd_strerror(err));
-                    return SA_ERROR;
-                }
-                init = 1;
-                break;
-            }
-            if(snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING)
-                init = 0;
-            ptr += err * device->config->channels;
-            cptr -= err;
-            if(cptr == 0)
-                break;
-            /* It is possible, that the initial buffer cannot store all data from the last period, so wait a while */
-            err = wait_for_poll(device, poll_manager);
-            if(err < 0)
-            {
-                if(snd_pcm_state(device->handle) == SND_PCM_STATE_XRUN ||
-                   snd_pcm_state(device->handle) == SND_PCM_STATE_SUSPENDED)
-                {
-                    err = snd_pcm_state(device->handle) == SND_PCM_STATE_XRUN ? -EPIPE : -ESTRPIPE;
-                    if(xrun_recovery(device->handle, err) != SA_SUCCESS)
-                    {
-                        SA_LOG(SA_LOG_LEVEL_ERROR, "Write error:", snd_strerror(err));
-                        return SA_ERROR;
-                    }
-                    init = 1;
-                } else
-                {
-                    SA_LOG(SA_LOG_LEVEL_ERROR, "Wait for poll failed");
-                    return SA_ERROR;
-                }
-            } else if(err == SA_STOP)
-            { return SA_STOP; }
-        }
+extern int sa_cache_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                    void *my_custom_data) {
+    sa_cache_source *source = (sa_cache_source *) my_custom_data;
+    sa_cache_entry *entry   = source->entry;
+    switch(__atomic_load_n(&(entry->state), __ATOMIC_ACQUIRE))
+    {
+    case SA_CACHE_ENTRY_LOADING:
+        /** Keep the device running until the worker is done */
+        snd_pcm_format_set_silence(entry->format, audio_buffer, amount_of_frames * entry->channels);
+        return amount_of_frames;
+    case SA_CACHE_ENTRY_FAILED:
+        return 0;
+    default:
+        break;
     }
-    return SA_SUCCESS;
+    int frames = entry->amount_of_frames - source->position;
+    if(frames > amount_of_frames)
+        frames = amount_of_frames;
+    if(frames <= 0)
+        return 0;
+    memcpy(audio_buffer, (char *) entry->frames + (size_t) source->position * source->frame_bytes,
+           (size_t) frames * source->frame_bytes);
+    source->position += frames;
+    return frames;
 }
 
-static int wait_for_poll(sa_device *device, sa_poll_management *poll_manager) {
-    unsigned short revents;
-    char command;
-    while(1)
+static sa_cache_entry *find_cache_entry(sa_cache *cache, const char *name, snd_pcm_format_t format, int channels) {
+    for(sa_cache_entry *entry = cache->head; entry; entry = entry->next)
     {
-        /** A period is the number of frames in between each hardware interrupt. The poll() will return once a period */
-        poll(poll_manager->ufds, poll_manager->count, -1);
-
-        if(poll_manager->ufds[0].revents & POLLIN)
-        {
-            if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
-            {
-                SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
-            } else
-            {
-                switch(command)
-                {
-                /** Stop playback */
-                case 's':
-                    return SA_STOP;
-                    break;
-                /** Pause playback */
-                case 'p':
-                    {
-                        sa_result res = pause_callback_loop(poll_manager, device);
-                        /** The 'paused' state can end in 2 ways: either a stop command kills the device or an unpause command resumes playback */
-                        if(res == SA_STOP)
-                        { return SA_STOP; }
-
-                        if(res == SA_UNPAUSE)
-                        {
-                            unpause_PCM_handle(device);
-                            save_device_state(device, SA_DEVICE_STARTED);
-                        }
-
-                        break;
-                    }
-                default:
-                    SA_LOG(SA_LOG_LEVEL_DEBUG, "Command sent to the pipe is ignored");
-                    break;
-                }
-            }
-        } else
+        if(entry->format == format && entry->channels == channels && strcmp(entry->name, name) == 0)
         {
-            snd_pcm_poll_descriptors_revents(device->handle, poll_manager->ufds + 1, poll_manager->count - 1,
-                                             &revents);
-            if(revents & POLLERR)
-                return -EIO;
-            if(revents & POLLOUT)
-                return SA_SUCCESS;
+            touch_cache_entry(cache, entry);
+            return entry;
         }
     }
-    SA_LOG(SA_LOG_LEVEL_ERROR, "Poll loop ended without proper return");
-    return -1;
+
+    sa_cache_entry *entry = (sa_cache_entry *) calloc(1, sizeof(sa_cache_entry));
+    if(!entry)
+        return NULL;
+    entry->name = strdup(name);
+    if(!entry->name)
+    {
+        free(entry);
+        return NULL;
+    }
+    entry->format   = format;
+    entry->channels = channels;
+    entry->state    = SA_CACHE_ENTRY_LOADING;
+    touch_cache_entry(cache, entry);
+
+    if(cache->pending_tail)
+        cache->pending_tail->next_pending = entry;
+    else
+        cache->pending_head = entry;
+    cache->pending_tail = entry;
+    pthread_cond_signal(&(cache->work_cond));
+    return entry;
 }
 
-static sa_result pause_callback_loop(sa_poll_management *poll_manager, sa_device *device) {
-    pause_PCM_handle(device);
+static void touch_cache_entry(sa_cache *cache, sa_cache_entry *entry) {
+    if(cache->head == entry)
+        return;
+    unlink_cache_entry(cache, entry);
+    entry->next = cache->head;
+    if(cache->head)
+        cache->head->previous = entry;
+    cache->head = entry;
+    if(!cache->tail)
+        cache->tail = entry;
+}
 
-    int pauzed = 1;
-    char command;
-    while(pauzed)
+static void unlink_cache_entry(sa_cache *cache, sa_cache_entry *entry) {
+    if(entry->previous)
+        entry->previous->next = entry->next;
+    else if(cache->head == entry)
+        cache->head = entry->next;
+    if(entry->next)
+        entry->next->previous = entry->previous;
+    else if(cache->tail == entry)
+        cache->tail = entry->previous;
+    entry->previous = NULL;
+    entry->next     = NULL;
+}
+
+static void evict_cache_entries(sa_cache *cache) {
+    sa_cache_entry *entry = cache->tail;
+    while(entry)
     {
-        poll(&(poll_manager->ufds[0]), 1, -1);
-        if(read(poll_manager->ufds[0].fd, &command, 1) != 1)
-        {
-            SA_LOG(SA_LOG_LEVEL_ERROR, "Pipe read error");
-        } else
+        sa_cache_entry *previous = entry->previous;
+        /** Failed entries hold no frames, they are dropped right away so a transient error is retried */
+        bool drop = entry->state == SA_CACHE_ENTRY_FAILED ||
+                    (entry->state == SA_CACHE_ENTRY_READY && cache->memory_used > cache->memory_budget);
+        if(entry->references == 0 && drop)
         {
-            switch(command)
-            {
-            /** Stop playback */
-            case 's':
-                {
-                    return SA_STOP;
-                    break;
-                }
-            /** Unpause */
-            case 'u':
-                {
-                    return SA_UNPAUSE;
-                    break;
-                }
-            default:
-                break;
-            }
+            unlink_cache_entry(cache, entry);
+            cache->memory_used -= entry->bytes;
+            free_cache_entry(entry);
         }
+        entry = previous;
     }
-    return SA_ERROR;
 }
 
-static void save_device_state(sa_device *device, sa_device_state new_state) {
-    /** Save state */
-    sa_set_device_state(device, new_state);
-    pthread_mutex_lock(&(device->condition_var->mutex));
-    device->condition_var->is_stopped = new_state == SA_DEVICE_STOPPED;
-    pthread_mutex_unlock(&(device->condition_var->mutex));
-    /** Broadcast change*/
-    pthread_cond_signal(&(device->condition_var->cond));
+static void free_cache_entry(sa_cache_entry *entry) {
+    free(entry->frames);
+    free(entry->name);
+    free(entry);
 }
 
-static sa_result xrun_recovery(snd_pcm_t *handle, int err) {
-    SA_LOG(SA_LOG_LEVEL_DEBUG, "ASLA: xrun occured");
-    if(err == -EPIPE)
-    { /* Underrun */
-        err = snd_pcm_prepare(handle);
-        if(err < 0)
-        {
-            SA_LOG(SA_LOG_LEVEL_ERROR,
-                   "ALSA: Can't recover from underrun, prepare failed:", snd_strerror(err));
-            return SA_ERROR;
-        }
-    } else if(err == -ESTRPIPE)
+static void *cache_worker(void *data) {
+    sa_cache *cache = (sa_cache *) data;
+    pthread_mutex_lock(&(cache->mutex));
+    while(!cache->quit)
     {
-        while((err = snd_pcm_resume(handle)) == -EAGAIN)
+        sa_cache_entry *entry = cache->pending_head;
+        if(!entry)
         {
-            /* Wait until the suspend flag is released */
-            sleep(1);
+            pthread_cond_wait(&(cache->work_cond), &(cache->mutex));
+            continue;
         }
-        if(err < 0)
+        cache->pending_head = entry->next_pending;
+        if(!cache->pending_head)
+            cache->pending_tail = NULL;
+        entry->next_pending = NULL;
+
+        /** Decode without the lock, the entry cannot be evicted while it is loading */
+        pthread_mutex_unlock(&(cache->mutex));
+        void *frames         = NULL;
+        int amount_of_frames = 0;
+        sa_result result     = cache->decoder(entry->name, entry->format, entry->channels, &frames,
+                                              &amount_of_frames, cache->my_custom_data);
+        pthread_mutex_lock(&(cache->mutex));
+
+        if(result == SA_SUCCESS && frames && amount_of_frames > 0)
         {
-            err = snd_pcm_prepare(handle);
-            if(err < 0)
-            {
-                SA_LOG(SA_LOG_LEVEL_ERROR,
-                       "ALSA: Can't recover from suspend, prepare failed:", snd_strerror(err));
-                return SA_ERROR;
-            }
+            entry->frames           = frames;
+            entry->amount_of_frames = amount_of_frames;
+            entry->bytes =
+              (size_t) amount_of_frames * entry->channels * snd_pcm_format_physical_width(entry->format) / 8;
+            cache->memory_used += entry->bytes;
+            __atomic_store_n(&(entry->state), SA_CACHE_ENTRY_READY, __ATOMIC_RELEASE);
+        } else
+        {
+            SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to decode", entry->name);
+            free(frames);
+            __atomic_store_n(&(entry->state), SA_CACHE_ENTRY_FAILED, __ATOMIC_RELEASE);
         }
-        return SA_SUCCESS;
+        pthread_cond_broadcast(&(cache->loaded_cond));
+        evict_cache_entries(cache);
     }
-    return SA_ERROR;
+    pthread_mutex_unlock(&(cache->mutex));
+    return NULL;
 }
 
-static sa_result pause_alsa_device(sa_device *device) {
-    if(message_pipe(device, 'p') == SA_ERROR)
+/*========================= BANK DEFINITIONS =========================*/
+extern sa_result sa_open_bank(const char *path, sa_bank **bank) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send pause command to the message pipe");
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to open sample bank", path);
         return SA_ERROR;
-    };
-    sa_set_device_state(device, SA_DEVICE_PAUSED);
-    return SA_SUCCESS;
-}
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) < 0 || (size_t) file_stat.st_size < sizeof(sa_bank_header))
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Sample bank is too small:", path);
+        close(fd);
+        return SA_ERROR;
+    }
+    size_t size  = (size_t) file_stat.st_size;
+    void *memory = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    /** The mapping keeps the file referenced */
+    close(fd);
+    if(memory == MAP_FAILED)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to map sample bank", path);
+        return SA_ERROR;
+    }
 
-static sa_result unpause_alsa_device(sa_device *device) {
-    if(message_pipe(device, 'u') == SA_ERROR)
+    const sa_bank_header *header = (const sa_bank_header *) memory;
+    bool valid = memcmp(header->magic, SA_BANK_MAGIC, sizeof(SA_BANK_MAGIC)) == 0 &&
+                 header->version == SA_BANK_VERSION && header->index_offset % SA_MEMORY_ALIGNMENT == 0 &&
+                 header->index_offset <= size &&
+                 header->entry_count <= (size - header->index_offset) / sizeof(sa_bank_entry);
+    const sa_bank_entry *entries = (const sa_bank_entry *) ((const char *) memory + header->index_offset);
+    for(uint32_t i = 0; valid && i < header->entry_count; i++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send unpause command to the message pipe");
+        const sa_bank_entry *entry = &entries[i];
+        uint64_t frame_bytes       = (uint64_t) snd_pcm_format_physical_width((snd_pcm_format_t) entry->format) /
+                               8 * entry->channels;
+        valid = memchr(entry->name, '\0', sizeof(entry->name)) && frame_bytes > 0 &&
+                entry->offset % SA_BANK_ALIGNMENT == 0 && entry->offset <= size &&
+                entry->amount_of_frames <= (size - entry->offset) / frame_bytes &&
+                entry->amount_of_frames <= INT_MAX;
+    }
+    if(!valid)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Not a valid sample bank:", path);
+        munmap(memory, size);
         return SA_ERROR;
-    };
-    sa_set_device_state(device, SA_DEVICE_STARTED);
+    }
+
+    sa_bank *bank_temp = (sa_bank *) malloc(sizeof(sa_bank));
+    if(!bank_temp)
+    {
+        munmap(memory, size);
+        return SA_ERROR;
+    }
+    /** Assets are touched in no particular order, reading ahead on a fault would only waste memory */
+    madvise(memory, size, MADV_RANDOM);
+    bank_temp->memory  = (const char *) memory;
+    bank_temp->size    = size;
+    bank_temp->header  = header;
+    bank_temp->entries = entries;
+    *bank              = bank_temp;
     return SA_SUCCESS;
 }
 
-static sa_result wait_for_start_alsa_device(sa_device *device) {
-    while((device->condition_var->is_stopped))
-    { pthread_cond_wait(&(device->condition_var->cond), &(device->condition_var->mutex)); }
-    return SA_SUCCESS;
+extern void sa_close_bank(sa_bank *bank) {
+    munmap((void *) bank->memory, bank->size);
+    free(bank);
 }
 
-static sa_result stop_alsa_device(sa_device *device) {
-    if(message_pipe(device, 's') == SA_ERROR)
+extern const sa_bank_entry *sa_bank_find(sa_bank *bank, const char *name) {
+    for(uint32_t i = 0; i < bank->header->entry_count; i++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not send cancel command to the message pipe");
+        if(strcmp(bank->entries[i].name, name) == 0)
+            return &(bank->entries[i]);
+    }
+    return NULL;
+}
+
+extern sa_result sa_bank_will_need(sa_bank *bank, const sa_bank_entry *entry) {
+    size_t length = (size_t) entry->amount_of_frames *
+                    (snd_pcm_format_physical_width((snd_pcm_format_t) entry->format) / 8 * entry->channels);
+    if(length == 0)
+        return SA_SUCCESS;
+    if(madvise((void *) (bank->memory + entry->offset), length, MADV_WILLNEED) < 0)
+    {
+        SA_LOG(SA_LOG_LEVEL_WARNING, "madvise(MADV_WILLNEED) failed for", entry->name);
         return SA_ERROR;
-    };
-    sa_set_device_state(device, SA_DEVICE_STOPPED);
+    }
     return SA_SUCCESS;
 }
 
-static sa_result wait_for_stop_alsa_device(sa_device *device) {
-    while(!(device->condition_var->is_stopped))
-    { pthread_cond_wait(&(device->condition_var->cond), &(device->condition_var->mutex)); }
+extern sa_result sa_open_bank_source(sa_bank *bank, const char *name, sa_bank_source *source) {
+    const sa_bank_entry *entry = sa_bank_find(bank, name);
+    if(!entry)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Sample bank has no asset", name);
+        return SA_ERROR;
+    }
+    source->entry       = entry;
+    source->frames      = bank->memory + entry->offset;
+    source->position    = 0;
+    source->frame_bytes = snd_pcm_format_physical_width((snd_pcm_format_t) entry->format) / 8 * entry->channels;
+    sa_bank_will_need(bank, entry);
     return SA_SUCCESS;
 }
 
-static sa_result pause_PCM_handle(sa_device *device) {
-    if(device->supports_pause)
+extern int sa_bank_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                   void *my_custom_data) {
+    sa_bank_source *source = (sa_bank_source *) my_custom_data;
+    int frames             = (int) source->entry->amount_of_frames - source->position;
+    if(frames > amount_of_frames)
+        frames = amount_of_frames;
+    if(frames <= 0)
+        return 0;
+    memcpy(audio_buffer, source->frames + (size_t) source->position * source->frame_bytes,
+           (size_t) frames * source->frame_bytes);
+    source->position += frames;
+    return frames;
+}
+
+/*========================= SHM DEFINITIONS ==========================*/
+extern sa_result sa_create_shm_source(snd_pcm_format_t format, int channels, unsigned int sample_rate,
+                                      int capacity_frames, sa_shm_source **source) {
+    int frame_bytes = channels * snd_pcm_format_physical_width(format) / 8;
+    if(capacity_frames <= 0 || (capacity_frames & (capacity_frames - 1)) != 0 || frame_bytes <= 0)
     {
-        if(snd_pcm_pause(device->handle, 1) != 0)
-        {
-            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Failed to snd_pcm_pause the pcm handle (when pausing)");
-            return SA_ERROR;
-        }
-        return SA_SUCCESS;
-    } else
+        SA_LOG(SA_LOG_LEVEL_ERROR, "The capacity of a shared memory ring must be a power of two");
+        return SA_ERROR;
+    }
+    sa_shm_source *source_temp = (sa_shm_source *) calloc(1, sizeof(sa_shm_source));
+    if(!source_temp)
+        return SA_ERROR;
+    size_t data_offset = sa_align_size(sizeof(sa_shm_header));
+    source_temp->size  = data_offset + (size_t) capacity_frames * frame_bytes;
+
+    /** memfd_create() is called through syscall() so the header does not depend on _GNU_SOURCE */
+    source_temp->memfd   = (int) syscall(SYS_memfd_create, "simpleALSA-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    source_temp->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(source_temp->memfd < 0 || source_temp->eventfd < 0 || ftruncate(source_temp->memfd, source_temp->size) < 0 ||
+       fcntl(source_temp->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
     {
-        if(drop_alsa_device(device) == SA_SUCCESS && prepare_alsa_device(device) == SA_SUCCESS)
-            return SA_SUCCESS;
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to create the shared memory ring:", strerror(errno));
+        return abort_create_shm_source(source_temp);
+    }
+    source_temp->header =
+      (sa_shm_header *) mmap(NULL, source_temp->size, PROT_READ | PROT_WRITE, MAP_SHARED, source_temp->memfd, 0);
+    if(source_temp->header == MAP_FAILED)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to map the shared memory ring:", strerror(errno));
+        return abort_create_shm_source(source_temp);
     }
+    /** A fresh memfd is zero filled, so only the format has to be written */
+    memcpy(source_temp->header->magic, SA_SHM_MAGIC, sizeof(SA_SHM_MAGIC));
+    source_temp->header->version         = SA_SHM_VERSION;
+    source_temp->header->data_offset     = (uint32_t) data_offset;
+    source_temp->header->sample_rate     = sample_rate;
+    source_temp->header->channels        = (uint32_t) channels;
+    source_temp->header->format          = (int32_t) format;
+    source_temp->header->frame_bytes     = (uint32_t) frame_bytes;
+    source_temp->header->capacity_frames = (uint32_t) capacity_frames;
+    source_temp->frames                  = (char *) source_temp->header + data_offset;
+    source_temp->capacity_frames         = (uint32_t) capacity_frames;
+    source_temp->frame_bytes             = frame_bytes;
+    source_temp->format                  = format;
+    source_temp->channels                = channels;
+    *source                              = source_temp;
+    return SA_SUCCESS;
+}
+
+static sa_result abort_create_shm_source(sa_shm_source *source) {
+    if(source->memfd >= 0)
+        close(source->memfd);
+    if(source->eventfd >= 0)
+        close(source->eventfd);
+    free(source);
     return SA_ERROR;
 }
 
-static sa_result unpause_PCM_handle(sa_device *device) {
-    if(device->supports_pause)
+extern void sa_destroy_shm_source(sa_shm_source *source) {
+    if(!source)
+        return;
+    munmap(source->header, source->size);
+    close(source->memfd);
+    close(source->eventfd);
+    free(source);
+}
+
+extern int sa_shm_source_callback(int amount_of_frames, void *audio_buffer, sa_device *device,
+                                  void *my_custom_data) {
+    sa_shm_source *source = (sa_shm_source *) my_custom_data;
+    sa_shm_header *header = source->header;
+    uint32_t mask         = source->capacity_frames - 1;
+    if(device->frame_bytes != source->frame_bytes)
     {
-        if(snd_pcm_pause(device->handle, 0) != 0)
+        SA_LOG(SA_LOG_LEVEL_ERROR, "The format of the shared memory ring does not match the device");
+        return 0;
+    }
+
+    /** closed is read first, the producer sets it after its last frame */
+    uint32_t closed    = __atomic_load_n(&(header->closed), __ATOMIC_ACQUIRE);
+    uint32_t read      = header->read_position;
+    uint32_t available = __atomic_load_n(&(header->write_position), __ATOMIC_ACQUIRE) - read;
+    /** The producer is not trusted, a corrupt position can never make the copy leave the ring */
+    if(available > source->capacity_frames)
+        available = source->capacity_frames;
+    int frames = (int) available < amount_of_frames ? (int) available : amount_of_frames;
+
+    int first = (int) (source->capacity_frames - (read & mask));
+    if(first > frames)
+        first = frames;
+    memcpy(audio_buffer, source->frames + (size_t) (read & mask) * source->frame_bytes,
+           (size_t) first * source->frame_bytes);
+    memcpy((char *) audio_buffer + (size_t) first * source->frame_bytes, source->frames,
+           (size_t) (frames - first) * source->frame_bytes);
+
+    if(frames > 0)
+    {
+        /** Pairs with the store of producer_waiting in sa_shm_wait_writable(), one of both sees the other */
+        __atomic_store_n(&(header->read_position), read + frames, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&(header->producer_waiting), __ATOMIC_SEQ_CST) &&
+           __atomic_exchange_n(&(header->producer_waiting), 0, __ATOMIC_SEQ_CST))
         {
-            SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: Failed to snd_pcm_pause the pcm handle (when resuming)");
-            return SA_ERROR;
+            uint64_t one = 1;
+            if(write(source->eventfd, &one, sizeof(one)) != sizeof(one))
+                SA_LOG(SA_LOG_LEVEL_WARNING, "Failed to wake the shared memory producer");
         }
     }
+    if(frames == amount_of_frames || closed)
+        return frames;
+
+    /** The producer fell behind: keep the PCM running on silence */
+    snd_pcm_format_set_silence(source->format, (char *) audio_buffer + (size_t) frames * source->frame_bytes,
+                               (amount_of_frames - frames) * source->channels);
+    __atomic_add_fetch(&(header->underrun_frames), (uint64_t) (amount_of_frames - frames), __ATOMIC_RELAXED);
+    return amount_of_frames;
+}
+
+extern unsigned long long sa_shm_source_underruns(sa_shm_source *source) {
+    return __atomic_load_n(&(source->header->underrun_frames), __ATOMIC_RELAXED);
+}
+
+extern sa_result sa_open_shm_writer(int memfd, int eventfd, sa_shm_writer **writer) {
+    struct stat file_stat;
+    if(fstat(memfd, &file_stat) < 0 || (size_t) file_stat.st_size < sizeof(sa_shm_header))
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Not a shared memory ring");
+        return SA_ERROR;
+    }
+    size_t size           = (size_t) file_stat.st_size;
+    sa_shm_header *header = (sa_shm_header *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(header == MAP_FAILED)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to map the shared memory ring:", strerror(errno));
+        return SA_ERROR;
+    }
+    uint32_t capacity = header->capacity_frames;
+    bool valid        = memcmp(header->magic, SA_SHM_MAGIC, sizeof(SA_SHM_MAGIC)) == 0 &&
+                 header->version == SA_SHM_VERSION && capacity > 0 && (capacity & (capacity - 1)) == 0 &&
+                 header->data_offset >= sizeof(sa_shm_header) &&
+                 header->data_offset + (size_t) capacity * header->frame_bytes <= size;
+    sa_shm_writer *writer_temp = valid ? (sa_shm_writer *) calloc(1, sizeof(sa_shm_writer)) : NULL;
+    if(!writer_temp)
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Invalid shared memory ring header");
+        munmap(header, size);
+        return SA_ERROR;
+    }
+    writer_temp->eventfd         = eventfd;
+    writer_temp->header          = header;
+    writer_temp->frames          = (char *) header + header->data_offset;
+    writer_temp->size            = size;
+    writer_temp->capacity_frames = capacity;
+    writer_temp->frame_bytes     = (int) header->frame_bytes;
+    *writer                      = writer_temp;
     return SA_SUCCESS;
 }
 
-static sa_result drop_alsa_device(sa_device *device) {
-    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA drop called");
-    int err = 0;
-    if(device->handle && (snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING ||
-                          snd_pcm_state(device->handle) == SND_PCM_STATE_PAUSED))
+extern void sa_close_shm_writer(sa_shm_writer *writer, bool end_of_stream) {
+    if(!writer)
+        return;
+    if(end_of_stream)
+        __atomic_store_n(&(writer->header->closed), 1, __ATOMIC_RELEASE);
+    munmap(writer->header, writer->size);
+    free(writer);
+}
+
+extern int sa_shm_begin_write(sa_shm_writer *writer, void **region) {
+    sa_shm_header *header = writer->header;
+    uint32_t write        = header->write_position;
+    uint32_t used         = write - __atomic_load_n(&(header->read_position), __ATOMIC_ACQUIRE);
+    uint32_t offset       = write & (writer->capacity_frames - 1);
+    uint32_t contiguous   = writer->capacity_frames - offset;
+    uint32_t free_frames  = writer->capacity_frames - used;
+    *region               = writer->frames + (size_t) offset * writer->frame_bytes;
+    return (int) (free_frames < contiguous ? free_frames : contiguous);
+}
+
+extern void sa_shm_commit_write(sa_shm_writer *writer, int amount_of_frames) {
+    __atomic_store_n(&(writer->header->write_position), writer->header->write_position + amount_of_frames,
+                     __ATOMIC_RELEASE);
+}
+
+extern int sa_shm_write(sa_shm_writer *writer, const void *frames, int amount_of_frames) {
+    int written = 0;
+    void *region;
+    /** At most two regions: up to the end of the ring and from its start */
+    while(written < amount_of_frames)
     {
-        err = snd_pcm_drop(device->handle);
-        if(err == 0)
-        {
-            return SA_SUCCESS;
-        } else
-        { SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: snd_pcm_drop() failed: ", snd_strerror(err)); }
+        int room = sa_shm_begin_write(writer, &region);
+        if(room == 0)
+            break;
+        if(room > amount_of_frames - written)
+            room = amount_of_frames - written;
+        memcpy(region, (const char *) frames + (size_t) written * writer->frame_bytes,
+               (size_t) room * writer->frame_bytes);
+        sa_shm_commit_write(writer, room);
+        written += room;
     }
-    SA_LOG(SA_LOG_LEVEL_ERROR,
-           "Failed to drop samples from the ALSA device: pcm_hanlde not in runnning or paused state");
-    exit(EXIT_FAILURE);
+    return written;
 }
 
-static sa_result drain_alsa_device(sa_device *device) {
-    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA drain called");
-    int err = 0;
-    if(device->handle && (snd_pcm_state(device->handle) == SND_PCM_STATE_RUNNING ||
-                          snd_pcm_state(device->handle) == SND_PCM_STATE_PAUSED))
+extern sa_result sa_shm_wait_writable(sa_shm_writer *writer, int timeout_ms) {
+    sa_shm_header *header = writer->header;
+    struct pollfd wakeup  = {writer->eventfd, POLLIN, 0};
+    uint64_t value;
+    while(1)
     {
-        err = snd_pcm_drain(device->handle);
-        if(err == 0)
+        __atomic_store_n(&(header->producer_waiting), 1, __ATOMIC_SEQ_CST);
+        uint32_t used = header->write_position - __atomic_load_n(&(header->read_position), __ATOMIC_SEQ_CST);
+        if(used < writer->capacity_frames)
         {
+            __atomic_store_n(&(header->producer_waiting), 0, __ATOMIC_RELAXED);
             return SA_SUCCESS;
-        } else
-        { SA_LOG(SA_LOG_LEVEL_ERROR, "ALSA: snd_pcm_drain() failed: ", snd_strerror(err)); }
+        }
+        if(poll(&wakeup, 1, timeout_ms) <= 0)
+        {
+            __atomic_store_n(&(header->producer_waiting), 0, __ATOMIC_RELAXED);
+            return SA_ERROR;
+        }
+        /** The eventfd is non-blocking, a concurrent reader may have taken the count already */
+        if(read(writer->eventfd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            return SA_ERROR;
     }
-    SA_LOG(SA_LOG_LEVEL_ERROR,
-           "Failed to drain samples from the ALSA device: pcm_handle not in runnning or paused state");
-    return SA_ERROR;
 }
 
-static sa_result prepare_alsa_device(sa_device *device) {
-    SA_LOG(SA_LOG_LEVEL_DEBUG, "ALSA prepare called");
-    if(device->handle && snd_pcm_prepare(device->handle) == 0)
-    { return SA_SUCCESS; }
-    SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to prepare the ALSA device");
-    exit(EXIT_FAILURE);
-}
+/*======================= ANALYSIS DEFINITIONS =======================*/
+static sa_result init_analysis(sa_device *device) {
+    sa_analysis *analysis = &(device->analysis);
+    pthread_attr_t attr;
+    if(analysis->spectrum_size <= 0)
+        return SA_SUCCESS;
 
-static sa_result message_pipe(sa_device *device, char toSend) {
-    int result = write(device->pipe_write_end, &toSend, 1);
-    if(result != 1)
+    /** Room for the FFT block plus a whole write in progress on both sides, so a copy is rarely torn */
+    unsigned int needed = 2 * ((unsigned int) analysis->spectrum_size + (unsigned int) device->sample_capacity);
+    analysis->ring_size = 1;
+    while(analysis->ring_size < needed)
+        analysis->ring_size <<= 1;
+    size_t size   = (size_t) analysis->spectrum_size;
+    float *memory = (float *) calloc(analysis->ring_size + 3 * size + size / 2, sizeof(float));
+    if(!memory)
+        return SA_ERROR;
+    analysis->ring       = memory;
+    analysis->window     = memory + analysis->ring_size;
+    analysis->real       = analysis->window + size;
+    analysis->imaginary  = analysis->real + size;
+    analysis->magnitudes = analysis->imaginary + size;
+
+    double window_sum = 0.0;
+    for(size_t i = 0; i < size; i++)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Failed to write to the pipe");
-        exit(EXIT_FAILURE);
+        analysis->window[i] = (float) (0.5 - 0.5 * cos(2.0 * 3.14159265358979323846 * (double) i / (double) size));
+        window_sum += analysis->window[i];
+    }
+    analysis->magnitude_scale = (float) (2.0 / window_sum);
+    analysis->quit            = 0;
+
+    /** The worker never inherits a realtime policy from the thread that initializes the device */
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    int err = pthread_create(&(analysis->thread), &attr, &run_spectrum_worker, (void *) device);
+    pthread_attr_destroy(&attr);
+    if(err != 0)
+    {
+        free(memory);
+        analysis->ring       = NULL;
+        analysis->magnitudes = NULL;
+        return SA_ERROR;
     }
     return SA_SUCCESS;
 }
 
-static sa_result cleanup_device(sa_device *device) {
-    if(device)
+static void close_analysis(sa_device *device) {
+    sa_analysis *analysis = &(device->analysis);
+    if(!analysis->ring)
+        return;
+
+    __atomic_store_n(&(analysis->quit), 1, __ATOMIC_RELEASE);
+    if(pthread_join(analysis->thread, NULL) != 0)
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not join the spectrum worker thread");
+    free(analysis->ring);
+    analysis->ring       = NULL;
+    analysis->magnitudes = NULL;
+}
+
+static void *run_spectrum_worker(void *data) {
+    sa_device *device = (sa_device *) data;
+    while(!__atomic_load_n(&(device->analysis.quit), __ATOMIC_ACQUIRE))
     {
-        close(device->pipe_write_end);
+        compute_spectrum(device);
+        usleep(SA_SPECTRUM_INTERVAL_US);
+    }
+    return NULL;
+}
 
-        if(device->config)
-        { free(device->config); }
-        if(device->condition_var)
+static void compute_spectrum(sa_device *device) {
+    sa_analysis *analysis = &(device->analysis);
+    unsigned int size     = (unsigned int) analysis->spectrum_size;
+    unsigned int mask     = analysis->ring_size - 1;
+    unsigned int end      = __atomic_load_n(&(analysis->write_position), __ATOMIC_ACQUIRE);
+    /** Nothing was played since the last FFT, keep the published spectrum */
+    if(end == analysis->analyzed_position)
+        return;
+
+    for(unsigned int i = 0; i < size; i++)
+    {
+        float sample;
+        __atomic_load(&(analysis->ring[(end - size + i) & mask]), &sample, __ATOMIC_RELAXED);
+        analysis->real[i]      = sample * analysis->window[i];
+        analysis->imaginary[i] = 0.0f;
+    }
+    /** The playback thread does not wait for the worker, drop the copy when it was overwritten meanwhile */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    unsigned int written = __atomic_load_n(&(analysis->write_position), __ATOMIC_RELAXED) - end;
+    if(written + (unsigned int) device->sample_capacity > analysis->ring_size - size)
+        return;
+    analysis->analyzed_position = end;
+
+    sa_fft(analysis->real, analysis->imaginary, (int) size);
+    unsigned int sequence = analysis->spectrum_sequence;
+    __atomic_store_n(&(analysis->spectrum_sequence), sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(unsigned int bin = 0; bin < size / 2; bin++)
+    {
+        float magnitude = sqrtf(analysis->real[bin] * analysis->real[bin] +
+                                analysis->imaginary[bin] * analysis->imaginary[bin]) *
+                          analysis->magnitude_scale;
+        /** DC has no mirrored negative frequency */
+        if(bin == 0)
+            magnitude *= 0.5f;
+        __atomic_store(&(analysis->magnitudes[bin]), &magnitude, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(analysis->spectrum_sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void sa_fft(float *real, float *imaginary, int size) {
+    /** Bit reversed reordering */
+    for(int i = 1, j = 0; i < size; i++)
+    {
+        int bit = size >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
         {
-            pthread_mutex_destroy(&(device->condition_var->mutex));
-            pthread_cond_destroy(&(device->condition_var->cond));
-            free(device->condition_var);
+            float temp = real[i];
+            real[i]    = real[j];
+            real[j]    = temp;
         }
-        if(device->samples)
-        { free(device->samples); }
-        if(device->handle)
+    }
+    /** Butterflies, the input is real so the imaginary parts start at zero and need no reordering */
+    for(int length = 2; length <= size; length <<= 1)
+    {
+        double angle = -2.0 * 3.14159265358979323846 / (double) length;
+        for(int k = 0; k < length / 2; k++)
         {
-            int err = snd_pcm_close(device->handle);
-            if(err < 0)
-            { SA_LOG(SA_LOG_LEVEL_ERROR, "Could not close handle : ", snd_strerror(err)); }
+            float twiddle_real      = (float) cos(angle * k);
+            float twiddle_imaginary = (float) sin(angle * k);
+            for(int start = k; start < size; start += length)
+            {
+                int pair         = start + length / 2;
+                float odd_real   = real[pair] * twiddle_real - imaginary[pair] * twiddle_imaginary;
+                float odd_imag   = real[pair] * twiddle_imaginary + imaginary[pair] * twiddle_real;
+                real[pair]       = real[start] - odd_real;
+                imaginary[pair]  = imaginary[start] - odd_imag;
+                real[start]      = real[start] + odd_real;
+                imaginary[start] = imaginary[start] + odd_imag;
+            }
         }
-        pthread_mutex_destroy(&(device->stateMutex));
-        free(device);
-        snd_config_update_free_global();
     }
+}
+
+/*======================== EVENT DEFINITIONS =========================*/
+static sa_result post_event(sa_device *device, const sa_event *event, unsigned long long timestamp, bool by_time) {
+    if(!device || !event || event->type < SA_EVENT_GAIN || event->type > SA_EVENT_CALLBACK)
+        return SA_ERROR;
+    if(event->type == SA_EVENT_GAIN && (!device->apply_gain || event->channel < -1 ||
+                                        event->channel >= device->config->channels || event->channel >= SA_MAX_CHANNELS))
+    {
+        SA_LOG(SA_LOG_LEVEL_ERROR, "Invalid channel or format for a gain event");
+        return SA_ERROR;
+    }
+    if(event->type == SA_EVENT_CALLBACK && !event->callback)
+        return SA_ERROR;
+
+    sa_event_queue *events = &(device->events);
+    unsigned int position  = __atomic_load_n(&(events->enqueue_position), __ATOMIC_RELAXED);
+    sa_event_entry *entry;
+    while(1)
+    {
+        entry            = &(events->queue[position & (SA_EVENT_CAPACITY - 1)]);
+        unsigned int seq = __atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE);
+        int difference   = (int) (seq - position);
+        if(difference == 0)
+        {
+            if(__atomic_compare_exchange_n(&(events->enqueue_position), &position, position + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(difference < 0)
+        {
+            __atomic_add_fetch(&(events->dropped), 1, __ATOMIC_RELAXED);
+            return SA_ERROR;
+        } else
+        { position = __atomic_load_n(&(events->enqueue_position), __ATOMIC_RELAXED); }
+    }
+    entry->event     = *event;
+    entry->timestamp = timestamp;
+    entry->by_time   = by_time;
+    __atomic_store_n(&(entry->sequence), position + 1, __ATOMIC_RELEASE);
     return SA_SUCCESS;
 }
 
-static sa_result destroy_alsa_device(sa_device *device) {
-    sa_stop_device(device);
-    message_pipe(device, 'd');
-    if(close_playback_thread(device) == SA_ERROR)
+static void collect_events(sa_device *device) {
+    sa_event_queue *events = &(device->events);
+    unsigned int position  = events->dequeue_position;
+    long long audible      = 0;
+    long long now_ns       = -1;
+
+    /** A full pending list leaves the rest in the queue until earlier events were applied */
+    while(events->pending_count < SA_EVENT_CAPACITY)
     {
-        SA_LOG(SA_LOG_LEVEL_ERROR, "Could not close thread");
-        exit(EXIT_FAILURE);
+        sa_event_entry *entry = &(events->queue[position & (SA_EVENT_CAPACITY - 1)]);
+        if((int) (__atomic_load_n(&(entry->sequence), __ATOMIC_ACQUIRE) - (position + 1)) < 0)
+            break;
+        sa_event_entry pending = *entry;
+        __atomic_store_n(&(entry->sequence), position + SA_EVENT_CAPACITY, __ATOMIC_RELEASE);
+        position++;
+
+        if(pending.by_time)
+        {
+            /** The frame that is audible now lags the stream position by what is queued in ALSA */
+            if(now_ns < 0)
+            {
+                struct timespec now;
+                snd_pcm_sframes_t delay;
+                if(!device->handle || snd_pcm_delay(device->handle, &delay) < 0 || delay < 0)
+                    delay = 0;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                now_ns  = (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+                audible = (long long) events->position - delay;
+            }
+            double offset = (double) ((long long) pending.timestamp - now_ns) * device->config->sample_rate / 1e9;
+            long long frame   = audible + (long long) floor(offset + 0.5);
+            pending.timestamp = frame > 0 ? (unsigned long long) frame : 0;
+            pending.by_time   = false;
+        }
+        /** Sorted so the next event is last, events at the same frame stay in the order they were posted */
+        int index = events->pending_count++;
+        while(index > 0 && events->pending[index - 1].timestamp <= pending.timestamp)
+        {
+            events->pending[index] = events->pending[index - 1];
+            index--;
+        }
+        events->pending[index] = pending;
     }
-    return cleanup_device(device);
+    events->dequeue_position = position;
 }
 
-static void sa_set_device_state(sa_device *device, sa_device_state state) {
-    pthread_mutex_lock(&(device->stateMutex));
-    device->state = state;
-    pthread_mutex_unlock(&(device->stateMutex));
+static void apply_event(sa_device *device, const sa_event *event) {
+    switch(event->type)
+    {
+    case SA_EVENT_GAIN:
+        if(event->channel < 0)
+            sa_set_software_gain(device, event->gain);
+        else
+            sa_set_channel_gain(device, event->channel, event->gain);
+        break;
+    case SA_EVENT_PAUSE:
+        device->events.pause_pending = true;
+        break;
+    case SA_EVENT_CALLBACK:
+        event->callback(device, event->my_custom_data);
+        break;
+    }
 }
 
 #endif  // SA_IMPLEMENTATION
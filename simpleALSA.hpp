@@ -0,0 +1,478 @@
+/**
+ * @file simpleALSA.hpp
+ * @author Yano Stulens (yano.stulens00@gmail.com)
+ * @author Daan Witters (daanwitters@gmail.com)
+ * @brief A header-only C++ layer on top of simpleALSA.h with typed callbacks
+ * @version 0.1.1
+ * @date 2022-07-26
+ * @link https://github.com/yanostulens/simpleALSA @endlink
+ * @copyright Copyright (c) 2022 Yano Stulens - Daan Witters
+ *
+ * Just like simpleALSA.h this header must be included in a file where SA_IMPLEMENTATION is defined.
+ * The license of simpleALSA.h applies to this file as well.
+ */
+
+#ifndef SIMPLEALSA_HPP
+#define SIMPLEALSA_HPP
+/*============================== INCLUDES ==============================*/
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "simpleALSA.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+    #include <coroutine>
+    #include <exception>
+    #define SA_HAS_COROUTINES
+#endif
+
+namespace sa {
+/*============================ SAMPLE TYPES =============================*/
+/**
+ * @brief a packed 24 bit sample as used by SND_PCM_FORMAT_S24_3LE
+ *
+ */
+struct Sample24
+{
+    uint8_t bytes[3];
+
+    /** Returns the sign extended value */
+    int32_t get() const {
+        return (int32_t) ((uint32_t) bytes[0] << 8 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 24) >> 8;
+    }
+
+    /** Stores the lower 24 bits of value */
+    void set(int32_t value) {
+        bytes[0] = (uint8_t) value;
+        bytes[1] = (uint8_t) (value >> 8);
+        bytes[2] = (uint8_t) (value >> 16);
+    }
+};
+
+/**
+ * @brief maps an ALSA sample format to the C++ type of one sample
+ *
+ */
+template<snd_pcm_format_t Format>
+struct FormatTraits;
+
+template<>
+struct FormatTraits<SND_PCM_FORMAT_S16_LE>
+{
+    using Sample = int16_t;
+};
+
+template<>
+struct FormatTraits<SND_PCM_FORMAT_S24_3LE>
+{
+    using Sample = Sample24;
+};
+
+template<>
+struct FormatTraits<SND_PCM_FORMAT_S32_LE>
+{
+    using Sample = int32_t;
+};
+
+template<>
+struct FormatTraits<SND_PCM_FORMAT_FLOAT_LE>
+{
+    using Sample = float;
+};
+
+/*============================= FRAME SPAN ==============================*/
+/**
+ * @brief a typed view on the interleaved frames the callback must fill
+ * The channel count is a compile time constant, so loops over channels can be unrolled by the compiler
+ */
+template<typename Sample, int Channels>
+class FrameSpan
+{
+  public:
+    FrameSpan(Sample *data, int frames) : data_(data), frames_(frames) {
+    }
+
+    /** Amount of frames that may be written */
+    int frames() const {
+        return frames_;
+    }
+
+    /** Amount of samples that may be written: frames * Channels */
+    std::size_t size() const {
+        return (std::size_t) frames_ * Channels;
+    }
+
+    /** Pointer to the first sample */
+    Sample *data() const {
+        return data_;
+    }
+
+    /** Access to a sample by frame and channel */
+    Sample &operator()(int frame, int channel) const {
+        return data_[frame * Channels + channel];
+    }
+
+    /** Access to a sample by its interleaved index */
+    Sample &operator[](std::size_t index) const {
+        return data_[index];
+    }
+
+    Sample *begin() const {
+        return data_;
+    }
+
+    Sample *end() const {
+        return data_ + size();
+    }
+
+  private:
+    Sample *data_;
+    int frames_;
+};
+
+/*=============================== DEVICE ================================*/
+/**
+ * @brief an owning, move-only wrapper around an sa_device
+ * The write loop of simpleALSA.h calls the data_callback through a function pointer, so every period costs one
+ * indirect call into a trampoline. The trampoline is instantiated for this exact Callback, Format and Channels
+ * combination, so the callback body is inlined into it and works on concrete types instead of void pointers.
+ *
+ * The callback has the signature: int(sa::FrameSpan<Sample, Channels> frames) and returns the amount of frames
+ * that have been written, returning 0 ends playback just like the data_callback of simpleALSA.h
+ */
+template<typename Callback, snd_pcm_format_t Format = SND_PCM_FORMAT_S16_LE, int Channels = 2>
+class Device
+{
+    static_assert(Channels > 0, "A device needs at least one channel");
+
+  public:
+    using Sample = typename FormatTraits<Format>::Sample;
+    using Frames = FrameSpan<Sample, Channels>;
+
+    /**
+     * @brief initializes the device, configure can adjust the remaining sa_device_config fields. Check ok() before
+     * using the device, init_result() tells why the initialization failed
+     *
+     * @param callback - functor or lambda that fills the frames
+     * @param configure - called with the default config before the device is initialized
+     */
+    template<typename Configure>
+    Device(Callback callback, Configure &&configure) : state_(new State{std::move(callback), {}, this}) {
+        sa_device_config *raw_config = nullptr;
+        if((init_result_ = sa_init_device_config(&raw_config)) != SA_SUCCESS)
+            return;
+        /** The device owns the config once it is initialized, until then it is freed here */
+        std::unique_ptr<sa_device_config, void (*)(void *)> config(raw_config, &std::free);
+        configure(*config);
+        config->format         = Format;
+        config->channels       = Channels;
+        config->data_callback  = &Device::data_trampoline;
+        config->eof_callback   = &Device::eof_trampoline;
+        config->my_custom_data = state_.get();
+        if((init_result_ = sa_init_device(config.get(), &device_)) != SA_SUCCESS)
+        {
+            device_ = nullptr;
+            return;
+        }
+        config.release();
+    }
+
+    explicit Device(Callback callback) : Device(std::move(callback), [](sa_device_config &) {}) {
+    }
+
+    Device(const Device &)            = delete;
+    Device &operator=(const Device &) = delete;
+
+    Device(Device &&other) noexcept
+        : device_(std::exchange(other.device_, nullptr)), init_result_(other.init_result_),
+          state_(std::move(other.state_)) {
+        if(state_)
+            state_->owner = this;
+    }
+
+    Device &operator=(Device &&other) noexcept {
+        if(this != &other)
+        {
+            reset();
+            device_      = std::exchange(other.device_, nullptr);
+            init_result_ = other.init_result_;
+            state_       = std::move(other.state_);
+            if(state_)
+                state_->owner = this;
+        }
+        return *this;
+    }
+
+    ~Device() {
+        reset();
+    }
+
+    /** Whether the device was initialized successfully */
+    bool ok() const {
+        return device_ != nullptr;
+    }
+
+    explicit operator bool() const {
+        return ok();
+    }
+
+    /** The result of the initialization, SA_SUCCESS when ok() */
+    sa_result init_result() const {
+        return init_result_;
+    }
+
+    sa_result start() {
+        return sa_start_device(device_);
+    }
+
+    sa_result stop() {
+        return sa_stop_device(device_);
+    }
+
+    sa_result pause() {
+        return sa_pause_device(device_);
+    }
+
+    sa_device_state state() const {
+        return sa_get_device_state(device_);
+    }
+
+    sa_result stats(sa_device_stats &stats) const {
+        return sa_get_device_stats(device_, &stats);
+    }
+
+    sa_result set_gain(float gain) {
+        return sa_set_software_gain(device_, gain);
+    }
+
+    /** Sets the function that is called when the callback returned 0 frames */
+    void on_end(std::function<void(Device &)> handler) {
+        state_->on_end = std::move(handler);
+    }
+
+    /** Access to the callback, it must not be modified while the device is playing */
+    Callback &callback() {
+        return state_->callback;
+    }
+
+    /** The wrapped device, for the parts of the C API that have no wrapper */
+    sa_device *native_handle() const {
+        return device_;
+    }
+
+  private:
+    /** Lives on the heap so my_custom_data stays valid when the Device is moved */
+    struct State
+    {
+        Callback callback;
+        std::function<void(Device &)> on_end;
+        /** The Device that currently owns this state */
+        Device *owner;
+    };
+
+    static int data_trampoline(int frames, void *buffer, sa_device *, void *data) {
+        State *state = static_cast<State *>(data);
+        return state->callback(Frames(static_cast<Sample *>(buffer), frames));
+    }
+
+    static void eof_trampoline(sa_device *, void *data) {
+        State *state = static_cast<State *>(data);
+        if(state->on_end)
+            state->on_end(*state->owner);
+    }
+
+    void reset() {
+        if(device_)
+            sa_destroy_device(device_);
+        device_ = nullptr;
+    }
+
+    sa_device *device_     = nullptr;
+    sa_result init_result_ = SA_ERROR;
+    std::unique_ptr<State> state_;
+};
+
+/**
+ * @brief creates a Device while deducing the callback type
+ *
+ */
+template<snd_pcm_format_t Format = SND_PCM_FORMAT_S16_LE, int Channels = 2, typename Callback>
+Device<Callback, Format, Channels> make_device(Callback callback) {
+    return Device<Callback, Format, Channels>(std::move(callback));
+}
+
+template<snd_pcm_format_t Format = SND_PCM_FORMAT_S16_LE, int Channels = 2, typename Callback, typename Configure>
+Device<Callback, Format, Channels> make_device(Callback callback, Configure &&configure) {
+    return Device<Callback, Format, Channels>(std::move(callback), std::forward<Configure>(configure));
+}
+
+#if defined SA_HAS_COROUTINES
+/*============================= COROUTINES ==============================*/
+/**
+ * @brief the return type of a producer coroutine, it owns the coroutine frame
+ * The coroutine does not run until the device asks for its first period
+ */
+class Producer
+{
+  public:
+    struct promise_type
+    {
+        Producer get_return_object() {
+            return Producer(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    Producer() = default;
+
+    explicit Producer(std::coroutine_handle<promise_type> handle) : handle_(handle) {
+    }
+
+    Producer(const Producer &)            = delete;
+    Producer &operator=(const Producer &) = delete;
+
+    Producer(Producer &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {
+    }
+
+    Producer &operator=(Producer &&other) noexcept {
+        if(this != &other)
+        {
+            if(handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Producer() {
+        if(handle_)
+            handle_.destroy();
+    }
+
+    /** Whether there is a coroutine that has not finished yet */
+    bool active() const {
+        return handle_ && !handle_.done();
+    }
+
+    void resume() {
+        handle_.resume();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * @brief a Device callback that hands the periods to a producer coroutine
+ * Every time the playback thread asks for frames, the producer is resumed on the playback thread with a span
+ * on the sample buffer, it fills the span and suspends again on the next co_await next_period().
+ * When the producer finishes, the device sees 0 frames and ends playback just like a data_callback would.
+ *
+ * Usage:
+ *   sa::Producer produce(sa::CoroutineSource<SND_PCM_FORMAT_S16_LE, 2> &source) {
+ *       while(true) {
+ *           auto frames = co_await source.next_period();
+ *           ... fill frames ...
+ *       }
+ *   }
+ *   sa::CoroutineDevice<SND_PCM_FORMAT_S16_LE, 2> device{sa::CoroutineSource<SND_PCM_FORMAT_S16_LE, 2>()};
+ *   device.callback().set_producer(produce(device.callback()));
+ *   device.start();
+ */
+template<snd_pcm_format_t Format, int Channels>
+class CoroutineSource
+{
+  public:
+    using Sample = typename FormatTraits<Format>::Sample;
+    using Frames = FrameSpan<Sample, Channels>;
+
+    /**
+     * @brief the awaitable returned by next_period(), it resumes with a writable span once ALSA has room
+     */
+    class PeriodAwaiter
+    {
+      public:
+        explicit PeriodAwaiter(CoroutineSource *source) : source_(source) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<>) noexcept {
+            source_->waiting_ = true;
+        }
+
+        Frames await_resume() const noexcept {
+            return source_->current_;
+        }
+
+      private:
+        CoroutineSource *source_;
+    };
+
+    /** Installs the producer, only call this while the device is stopped */
+    void set_producer(Producer producer) {
+        producer_ = std::move(producer);
+        waiting_  = false;
+    }
+
+    /** Suspends the producer until the next period can be written */
+    PeriodAwaiter next_period() {
+        return PeriodAwaiter(this);
+    }
+
+    /** Reports that fewer frames than the span holds have been written in the current period */
+    void commit(int frames) {
+        written_ = frames < current_.frames() ? frames : current_.frames();
+    }
+
+    /** Called by the Device on the playback thread */
+    int operator()(Frames frames) {
+        /** Run a fresh producer up to its first co_await */
+        if(!waiting_ && producer_.active())
+            producer_.resume();
+        if(!waiting_ || !producer_.active())
+            return 0;
+
+        current_ = frames;
+        written_ = frames.frames();
+        waiting_ = false;
+        producer_.resume();
+        return written_;
+    }
+
+  private:
+    Producer producer_;
+    Frames current_{nullptr, 0};
+    int written_  = 0;
+    bool waiting_ = false;
+};
+
+/**
+ * @brief a Device that is fed by a producer coroutine
+ */
+template<snd_pcm_format_t Format = SND_PCM_FORMAT_S16_LE, int Channels = 2>
+using CoroutineDevice = Device<CoroutineSource<Format, Channels>, Format, Channels>;
+#endif
+}  // namespace sa
+
+#endif  // SIMPLEALSA_HPP
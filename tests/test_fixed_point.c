@@ -0,0 +1,229 @@
+#define SA_IMPLEMENTATION
+#define SA_FIXED_POINT
+
+#include <stdio.h>
+
+#include "./../simpleALSA.h"
+
+/**
+ * Runs the Q15/Q31 gains, the mix and the mix conversion on fixed vectors and compares them with golden outputs
+ * computed independently. The 1ch and 2ch gains go through the SIMD path the build selects, the nch gains through
+ * the scalar helpers. The vectors are 19 stereo frames so the SIMD paths also leave a scalar tail.
+ * Gains: stereo 1.5 and -1.220703125, mono -1.999969482, mix 1.220703125 and -0.376739501.
+ */
+#define STEREO_FRAMES 19
+#define MONO_FRAMES   11
+
+#if defined __ARM_NEON
+    #define SIMD_PATH "NEON"
+#elif defined __SSSE3__
+    #define SIMD_PATH "SSSE3"
+#elif defined __SSE2__
+    #define SIMD_PATH "SSE2"
+#else
+    #define SIMD_PATH "none"
+#endif
+
+static const int16_t gain_s16_in[38] = {
+    32767, -32768, -32768, 32767, 205, -14282, 23621, 16201, 97, -26331,
+    -5224, 15969, 22695, 16441, 20130, 5689, -19729, -3055, 16280, 26386,
+    -23548, 25470, -20, -3920, 18473, -6195, -5457, -5251, -23852, -28715,
+    -12115, -14211, 15916, -12353, -1465, 1014, 17988, 24984,
+};
+
+static const int16_t gain_s16_golden[38] = {
+    32767, 32767, -32768, -32768, 308, 17434, 32767, -19777, 146, 32142,
+    -7836, -19493, 32767, -20070, 30195, -6945, -29593, 3729, 24420, -32209,
+    -32768, -31091, -30, 4785, 27710, 7562, -8185, 6410, -32768, 32767,
+    -18172, 17347, 23874, 15079, -2197, -1238, 26982, -30498,
+};
+
+static const int32_t gain_s32_in[38] = {
+    2147483647, INT32_MIN, INT32_MIN, 2147483647, -1020994113, 1392299148,
+    473821141, 2033202154, -632056101, -1242552968, 360363089, -1881824074,
+    -253049417, 2126389540, -1427815283, 1888441922, 308020819, -766628976,
+    -1645306743, -851405682, 93762735, 2056417468, -1139050427, 11889562,
+    -417076021, 208919720, -327134271, -1804687514, 1224903335, -2139219116,
+    -1728222467, 1462621170, 1950558787, -1437886272, 1866119673, 1346452798,
+    677652383, -1162772244,
+};
+
+static const int32_t gain_s32_golden[38] = {
+    2147483647, 2147483647, INT32_MIN, INT32_MIN, -1531491169, -1699583921,
+    710731712, INT32_MIN, -948084151, 1516788291, 540544634, 2147483647,
+    -379574125, INT32_MIN, -2141722924, INT32_MIN, 462031229, 935826387,
+    INT32_MIN, 1039313577, 140644103, INT32_MIN, -1708575640, -14513625,
+    -625614031, -255028955, -490701406, 2147483647, 1837355003, 2147483647,
+    INT32_MIN, -1785426233, 2147483647, 1755232266, 2147483647, -1643619138,
+    1016478575, 1419399712,
+};
+
+static const uint8_t gain_s24_in[114] = {
+    0xff, 0xff, 0x7f, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80, 0xff, 0xff, 0x7f,
+    0xaf, 0xa4, 0x2e, 0xb6, 0x65, 0xfa, 0x6b, 0xcd, 0x05, 0x01, 0x09, 0x9d,
+    0x0d, 0x64, 0x4b, 0x1d, 0xff, 0xa4, 0x2a, 0xf3, 0x08, 0xb1, 0xd6, 0x7c,
+    0x13, 0x41, 0x21, 0x71, 0xd5, 0xa8, 0x36, 0xac, 0x77, 0xfd, 0x8c, 0xee,
+    0x7d, 0xce, 0x66, 0xbe, 0xaa, 0xdf, 0xac, 0x3f, 0x71, 0xcf, 0xfa, 0x95,
+    0xc6, 0x0e, 0x6f, 0xd0, 0x55, 0x4b, 0x68, 0x4a, 0xf8, 0xd3, 0xf1, 0x82,
+    0x2b, 0xb0, 0xe0, 0x33, 0x4e, 0x62, 0x06, 0x5b, 0x32, 0x77, 0xb2, 0xce,
+    0xa8, 0x08, 0xa5, 0x32, 0xf8, 0x98, 0xe1, 0x4d, 0x05, 0xe5, 0x17, 0xa4,
+    0xf9, 0xd1, 0xca, 0xda, 0xb0, 0x33, 0x16, 0x69, 0x2e, 0x0a, 0x84, 0x9e,
+    0x9a, 0xa5, 0xd8, 0xf7, 0x99, 0x2d,
+};
+
+static const uint8_t gain_s24_golden[114] = {
+    0xff, 0xff, 0x7f, 0xff, 0xff, 0x7f, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80,
+    0x07, 0xf7, 0x45, 0xd7, 0xd6, 0x06, 0x21, 0xb4, 0x08, 0x82, 0xce, 0x78,
+    0x14, 0x16, 0x71, 0x95, 0x16, 0x6f, 0xbf, 0x6c, 0x0d, 0x00, 0x00, 0x80,
+    0x9d, 0xe1, 0x31, 0x74, 0x67, 0x6a, 0xff, 0xff, 0x7f, 0xe5, 0x4c, 0x15,
+    0xff, 0xff, 0x7f, 0x13, 0x78, 0x27, 0xff, 0xff, 0x7f, 0xff, 0xff, 0x7f,
+    0xff, 0xff, 0x7f, 0xc0, 0x09, 0xa4, 0x9c, 0x6f, 0xf4, 0xff, 0xff, 0x7f,
+    0x41, 0x08, 0xd1, 0x8b, 0xff, 0x87, 0x89, 0x88, 0x4b, 0x26, 0x2f, 0x3c,
+    0x00, 0x00, 0x80, 0x07, 0xc5, 0x7d, 0xd2, 0xf4, 0x07, 0xd5, 0x30, 0x70,
+    0xf6, 0x3a, 0xb0, 0x9e, 0xe6, 0xc0, 0xa1, 0x9d, 0x45, 0xd2, 0xff, 0x76,
+    0x67, 0xf8, 0xc4, 0x8e, 0x55, 0xc8,
+};
+
+static const int16_t mono_s16_in[11] = {
+    -32768, 32767, -13512, -16346, 11305, 23393, -17576, -10396, -26392, 19461, -6235,
+};
+
+static const int16_t mono_s16_golden[11] = {
+    32767, -32768, 27024, 32692, -22610, -32768, 32767, 20792, 32767, -32768, 12470,
+};
+
+static const int32_t mono_s32_in[11] = {
+    INT32_MIN, 2147483647, 455766376, -1643107967, 340601382, 1729541735,
+    183057428, 1091886269, -934165838, -70364669, 1160250752,
+};
+
+static const int32_t mono_s32_golden[11] = {
+    2147483647, INT32_MIN, -911518843, 2147483647, -681192370, INT32_MIN,
+    -366109270, INT32_MIN, 1868303168, 140727191, INT32_MIN,
+};
+
+static const int32_t mix_in[38] = {
+    2147483000, -2147483000, 0, 100, -1086331275, -638913014,
+    901643899, -745470824, 1773499633, -280336170, -98302121, 1071501892,
+    -1407488211, 224148578, 1618461171, 1158139568, 1366085929, 29736110,
+    490900047, -1013766692, 1062754021, 1026880954, 2051505259, 1041941448,
+    -843285407, -617827450, -799050681, -1006873484, 434339229, 1519419922,
+    -1022030365, -624671776, 1367299737, 1391504734, -1711233729, -1839612404,
+    -1318730923, 848707946,
+};
+
+static const int32_t mix_source[38] = {
+    2147483647, 2147483647, INT32_MIN, 5, -813171401, -1684553052,
+    -1413216243, 1677300674, 643118547, 2095080720, -994699255, 483469838,
+    347298863, -1311849924, 715074501, -2072389350, 203656267, -1931229656,
+    -833896639, 1473015014, 1260167719, 96672980, 114560637, 1986163058,
+    380058051, -929091008, 177739129, 769798846, -239489249, -798674324,
+    -67399627, -301286198, -296477125, 2007566680, 98695857, 830462870,
+    -195271913, -1403952380,
+};
+
+static const int32_t mix_golden[38] = {
+    2147483647, INT32_MIN, INT32_MIN, 98, -2078972145, -4275336,
+    -823473585, -1377376245, 2147483647, -1069635837, -1312534610, 889359706,
+    -983539404, 718374265, 2147483647, 1938890500, 1614689771, 757306609,
+    -527040186, -1568709635, 2147483647, 990460424, 2147483647, 293675367,
+    -379347356, -267802166, -582083971, -1296887118, 141993954, 1820312089,
+    -1104305300, -511165364, 1005389184, 635175063, -1590755388, INT32_MIN,
+    -1557099957, 1377632266,
+};
+
+static const int16_t convert_s16_golden[38] = {
+    32767, -32768, -32768, 0, -31723, -66, -12566, -21018, 32767, -16322,
+    -20028, 13570, -15008, 10961, 32767, 29585, 24638, 11555, -8042, -23937,
+    32767, 15113, 32767, 4481, -5789, -4087, -8882, -19789, 2166, 27775,
+    -16851, -7800, 15341, 9692, -24274, -32768, -23760, 21021,
+};
+
+static const uint8_t convert_s24_golden[114] = {
+    0xff, 0xff, 0x7f, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+    0x67, 0x15, 0x84, 0xc3, 0xbe, 0xff, 0xca, 0xea, 0xce, 0xe8, 0xe6, 0xad,
+    0xff, 0xff, 0x7f, 0xa7, 0x3e, 0xc0, 0x4f, 0xc4, 0xb1, 0x8d, 0x02, 0x35,
+    0x61, 0x60, 0xc5, 0x85, 0xd1, 0x2a, 0xff, 0xff, 0x7f, 0x1f, 0x91, 0x73,
+    0x35, 0x3e, 0x60, 0x94, 0x23, 0x2d, 0x01, 0x96, 0xe0, 0x63, 0x7f, 0xa2,
+    0xff, 0xff, 0x7f, 0x3a, 0x09, 0x3b, 0xff, 0xff, 0x7f, 0x21, 0x81, 0x11,
+    0x9e, 0x63, 0xe9, 0xa9, 0x09, 0xf0, 0x1a, 0x4e, 0xdd, 0x12, 0xb3, 0xb2,
+    0xa7, 0x76, 0x08, 0xc2, 0x7f, 0x6c, 0xa3, 0x2d, 0xbe, 0x3c, 0x88, 0xe1,
+    0x05, 0xed, 0x3b, 0x00, 0xdc, 0x25, 0xff, 0x2e, 0xa1, 0x00, 0x00, 0x80,
+    0x8a, 0x30, 0xa3, 0x00, 0x1d, 0x52,
+};
+
+static int failures;
+
+static void check(const char *name, const void *result, const void *golden, size_t size) {
+    if(memcmp(result, golden, size) != 0)
+    {
+        printf("%s: FAIL\n", name);
+        failures++;
+        return;
+    }
+    printf("%s: ok\n", name);
+}
+
+int main(void) {
+    const sa_gain stereo_gains[2] = {49152, -40000};
+    const sa_gain mono_gain       = -65535;
+    const sa_gain mix_gains[2]    = {40000, -12345};
+    printf("SIMD path: %s\n", SIMD_PATH);
+
+    int16_t s16[STEREO_FRAMES * 2];
+    memcpy(s16, gain_s16_in, sizeof(s16));
+    sa_gain_s16_2ch(s16, STEREO_FRAMES, 2, stereo_gains);
+    check("gain s16 2ch", s16, gain_s16_golden, sizeof(s16));
+
+    memcpy(s16, gain_s16_in, sizeof(s16));
+    sa_gain_s16_nch(s16, STEREO_FRAMES, 2, stereo_gains);
+    check("gain s16 nch", s16, gain_s16_golden, sizeof(s16));
+
+    int32_t s32[STEREO_FRAMES * 2];
+    memcpy(s32, gain_s32_in, sizeof(s32));
+    sa_gain_s32_2ch(s32, STEREO_FRAMES, 2, stereo_gains);
+    check("gain s32 2ch", s32, gain_s32_golden, sizeof(s32));
+
+    uint8_t s24[STEREO_FRAMES * 2 * 3];
+    memcpy(s24, gain_s24_in, sizeof(s24));
+    sa_gain_s24_3le_2ch(s24, STEREO_FRAMES, 2, stereo_gains);
+    check("gain s24_3le 2ch", s24, gain_s24_golden, sizeof(s24));
+
+    int16_t mono16[MONO_FRAMES];
+    memcpy(mono16, mono_s16_in, sizeof(mono16));
+    sa_gain_s16_1ch(mono16, MONO_FRAMES, 1, &mono_gain);
+    check("gain s16 1ch", mono16, mono_s16_golden, sizeof(mono16));
+
+    int32_t mono32[MONO_FRAMES];
+    memcpy(mono32, mono_s32_in, sizeof(mono32));
+    sa_gain_s32_1ch(mono32, MONO_FRAMES, 1, &mono_gain);
+    check("gain s32 1ch", mono32, mono_s32_golden, sizeof(mono32));
+
+    sa_mix_sample mix[STEREO_FRAMES * 2];
+    memcpy(mix, mix_in, sizeof(mix));
+    sa_mix_add(mix, mix_source, STEREO_FRAMES, 2, mix_gains);
+    check("mix add", mix, mix_golden, sizeof(mix));
+
+    int16_t converted16[STEREO_FRAMES * 2];
+    sa_mix_convert(mix_golden, converted16, STEREO_FRAMES * 2, SND_PCM_FORMAT_S16_LE);
+    check("convert s16", converted16, convert_s16_golden, sizeof(converted16));
+
+    uint8_t converted24[STEREO_FRAMES * 2 * 3];
+    sa_mix_convert(mix_golden, converted24, STEREO_FRAMES * 2, SND_PCM_FORMAT_S24_3LE);
+    check("convert s24_3le", converted24, convert_s24_golden, sizeof(converted24));
+
+    int32_t converted32[STEREO_FRAMES * 2];
+    sa_mix_convert(mix_golden, converted32, STEREO_FRAMES * 2, SND_PCM_FORMAT_S32_LE);
+    check("convert s32", converted32, mix_golden, sizeof(converted32));
+
+    const sa_meter_peak peak_golden[2] = {2147483648u, 2147483648u};
+    const sa_meter_sum sum_golden[2]   = {6527526966ULL, 7104788916ULL};
+    sa_meter_peak peak[2]              = {0};
+    sa_meter_sum sum[2]                = {0};
+    sa_meter_s16_2ch(gain_s16_in, STEREO_FRAMES, 2, peak, sum);
+    check("meter s16 peak", peak, peak_golden, sizeof(peak));
+    check("meter s16 sum", sum, sum_golden, sizeof(sum));
+
+    printf(failures ? "%d fixed point checks failed\n" : "all fixed point checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -2,6 +2,7 @@
 
 #include <sndfile.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "./../simpleALSA.h"
 
@@ -28,8 +29,53 @@ int data_callback(int frames_to_send, void *audio_buffer, sa_device *sa_device,
     return readcount;
 }
 
+#ifdef SA_SIMULATE_DEVICE_LOSS
+/** Unplugs the PCM while it plays, lets the first reopens fail and checks that playback goes on afterwards */
+int device_loss_scenario(sa_device *device, int failed_reopens) {
+    sa_device_stats before, after;
+    sa_get_device_stats(device, &before);
+    sa_start_device(device);
+    usleep(500000);
+    if(sa_simulate_device_loss(device, failed_reopens) != SA_SUCCESS)
+    {
+        printf("Failed to simulate the device loss\n");
+        return 1;
+    }
+
+    /** Every failed reopen costs one reconnect_interval */
+    int timeout_us = (failed_reopens + 2) * device->config->reconnect_interval + 1000000;
+    for(int waited_us = 0; waited_us < timeout_us; waited_us += 10000)
+    {
+        sa_get_device_stats(device, &after);
+        if(after.reconnects > before.reconnects)
+            break;
+        usleep(10000);
+    }
+    unsigned long long position = sa_get_stream_position(device);
+    usleep(500000);
+    bool playing = sa_get_stream_position(device) > position;
+    sa_get_device_stats(device, &after);
+    sa_stop_device(device);
+
+    printf("device_losses %lu, reconnects %lu, playing after the reconnect: %s\n",
+           after.device_losses - before.device_losses, after.reconnects - before.reconnects, playing ? "yes" : "no");
+    if(after.device_losses != before.device_losses + 1 || after.reconnects != before.reconnects + 1 || !playing)
+    {
+        printf("Device loss scenario failed\n");
+        return 1;
+    }
+    printf("Device loss scenario passed\n");
+    return 0;
+}
+#endif
+
 int main(int argc, char const *argv[]) {
+#ifdef SA_SIMULATE_DEVICE_LOSS
+    /** An optional second argument runs the device loss scenario with that many failed reopens */
+    if(argc != 2 && argc != 3)
+#else
     if(argc != 2)
+#endif
     {
         printf("Oops you did not provide enough arguments\n");
         exit(1);
@@ -54,6 +100,23 @@ int main(int argc, char const *argv[]) {
 
     sa_init_device(config, &device);
 
+#ifdef SA_SIMULATE_DEVICE_LOSS
+    if(argc == 3)
+    {
+    #ifdef SA_TRACE
+        /** The reconnect records events while the handle is closed, tracing must survive that */
+        sa_start_trace(device, "./builds/device_loss_trace.json");
+    #endif
+        int result = device_loss_scenario(device, atoi(argv[2]));
+    #ifdef SA_TRACE
+        sa_stop_trace(device);
+    #endif
+        sa_destroy_device(device);
+        sf_close(infile);
+        return result;
+    }
+#endif
+
     while(1)
     {
         printf("Give a command please...\n");
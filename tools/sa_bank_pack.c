@@ -0,0 +1,183 @@
+/** This tool packs audio files into a sample bank that simpleALSA can map with sa_open_bank().
+ *  Every file is decoded once with libsndfile and stored in device format, so loading the bank
+ *  at startup costs no decoding at all.
+ *
+ *  Usage: sa_bank_pack [-f s16|s24_3le|s32|float] output.bank input.wav [input.flac ...]
+ *  The assets are named after their file name without directory and extension.
+ */
+
+#include <libgen.h>
+#include <sndfile.h>
+#include <stdio.h>
+
+#include "../simpleALSA.h"
+
+/** Frames decoded and written in one go */
+#define CHUNK_FRAMES 4096
+
+static uint64_t align_offset(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+/** Decodes one file chunk by chunk into the bank at its offset */
+static int write_asset(FILE *bank, SNDFILE *infile, const sa_bank_entry *entry) {
+    int sample_bytes = snd_pcm_format_physical_width((snd_pcm_format_t) entry->format) / 8;
+    /** Room for 32 bit samples, S24_3LE is decoded to int and packed in place */
+    char *chunk = (char *) malloc((size_t) CHUNK_FRAMES * entry->channels * sizeof(int));
+    if(!chunk || fseek(bank, (long) entry->offset, SEEK_SET) != 0)
+    {
+        free(chunk);
+        return -1;
+    }
+    sf_count_t frames;
+    do
+    {
+        switch(entry->format)
+        {
+        case SND_PCM_FORMAT_S16_LE:
+            frames = sf_readf_short(infile, (short *) chunk, CHUNK_FRAMES);
+            break;
+        case SND_PCM_FORMAT_S24_3LE:
+            frames = sf_readf_int(infile, (int *) chunk, CHUNK_FRAMES);
+            /** libsndfile scales to the full int range, keep the upper 3 bytes - each write stays behind the read */
+            for(sf_count_t i = 0; i < frames * entry->channels; i++)
+            {
+                int sample       = ((int *) chunk)[i];
+                chunk[i * 3]     = (char) (sample >> 8);
+                chunk[i * 3 + 1] = (char) (sample >> 16);
+                chunk[i * 3 + 2] = (char) (sample >> 24);
+            }
+            break;
+        case SND_PCM_FORMAT_S32_LE:
+            frames = sf_readf_int(infile, (int *) chunk, CHUNK_FRAMES);
+            break;
+        case SND_PCM_FORMAT_FLOAT_LE:
+            frames = sf_readf_float(infile, (float *) chunk, CHUNK_FRAMES);
+            break;
+        default:
+            printf("Unsupported bank format %s\n", snd_pcm_format_name((snd_pcm_format_t) entry->format));
+            free(chunk);
+            return -1;
+        }
+        if(frames > 0 && fwrite(chunk, (size_t) entry->channels * sample_bytes, (size_t) frames, bank) !=
+                           (size_t) frames)
+        {
+            free(chunk);
+            return -1;
+        }
+    } while(frames == CHUNK_FRAMES);
+    free(chunk);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+    int first_argument      = 1;
+    if(argc > 2 && strcmp(argv[1], "-f") == 0)
+    {
+        if(strcmp(argv[2], "s16") == 0)
+            format = SND_PCM_FORMAT_S16_LE;
+        else if(strcmp(argv[2], "s24_3le") == 0)
+            format = SND_PCM_FORMAT_S24_3LE;
+        else if(strcmp(argv[2], "s32") == 0)
+            format = SND_PCM_FORMAT_S32_LE;
+        else if(strcmp(argv[2], "float") == 0)
+            format = SND_PCM_FORMAT_FLOAT_LE;
+        else
+        {
+            printf("Unknown format %s, use s16, s24_3le, s32 or float\n", argv[2]);
+            return 1;
+        }
+        first_argument = 3;
+    }
+    if(argc - first_argument < 2)
+    {
+        printf("Usage: %s [-f s16|s24_3le|s32|float] output.bank input.wav [input.flac ...]\n", argv[0]);
+        return 1;
+    }
+    const char *output = argv[first_argument];
+    int count          = argc - first_argument - 1;
+
+    /** The index is laid out first so every asset can be streamed straight to its final offset */
+    sa_bank_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SA_BANK_MAGIC, sizeof(SA_BANK_MAGIC));
+    header.version      = SA_BANK_VERSION;
+    header.entry_count  = (uint32_t) count;
+    header.index_offset = align_offset(sizeof(sa_bank_header), SA_MEMORY_ALIGNMENT);
+
+    sa_bank_entry *entries = (sa_bank_entry *) calloc((size_t) count, sizeof(sa_bank_entry));
+    SNDFILE **infiles      = (SNDFILE **) calloc((size_t) count, sizeof(SNDFILE *));
+    if(!entries || !infiles)
+        return 1;
+    uint64_t offset =
+      align_offset(header.index_offset + (uint64_t) count * sizeof(sa_bank_entry), SA_BANK_ALIGNMENT);
+    for(int i = 0; i < count; i++)
+    {
+        char *path = argv[first_argument + 1 + i];
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        infiles[i] = sf_open(path, SFM_READ, &info);
+        if(!infiles[i])
+        {
+            printf("Failed to open %s: %s\n", path, sf_strerror(NULL));
+            return 1;
+        }
+
+        char name[sizeof(entries[i].name)];
+        snprintf(name, sizeof(name), "%s", basename(path));
+        char *extension = strrchr(name, '.');
+        if(extension)
+            *extension = '\0';
+        for(int j = 0; j < i; j++)
+        {
+            if(strcmp(entries[j].name, name) == 0)
+            {
+                printf("Duplicate asset name %s\n", name);
+                return 1;
+            }
+        }
+
+        memcpy(entries[i].name, name, sizeof(name));
+        entries[i].offset           = offset;
+        entries[i].amount_of_frames = (uint64_t) info.frames;
+        entries[i].sample_rate      = (uint32_t) info.samplerate;
+        entries[i].channels         = (uint32_t) info.channels;
+        entries[i].format           = (int32_t) format;
+        uint64_t bytes = (uint64_t) info.frames * info.channels * snd_pcm_format_physical_width(format) / 8;
+        offset         = align_offset(offset + bytes, SA_BANK_ALIGNMENT);
+    }
+
+    FILE *bank = fopen(output, "wb");
+    if(!bank)
+    {
+        printf("Failed to create %s\n", output);
+        return 1;
+    }
+    int result = 0;
+    if(fwrite(&header, sizeof(header), 1, bank) != 1 || fseek(bank, (long) header.index_offset, SEEK_SET) != 0 ||
+       fwrite(entries, sizeof(sa_bank_entry), (size_t) count, bank) != (size_t) count)
+        result = -1;
+    for(int i = 0; i < count && result == 0; i++)
+    {
+        result = write_asset(bank, infiles[i], &entries[i]);
+        printf("%-32s %8llu frames %6u Hz %u ch\n", entries[i].name,
+               (unsigned long long) entries[i].amount_of_frames, entries[i].sample_rate, entries[i].channels);
+    }
+    /** Pad the last asset so the file size is aligned as well */
+    if(result == 0 && offset > 0 && (fseek(bank, (long) offset - 1, SEEK_SET) != 0 || fputc(0, bank) == EOF))
+        result = -1;
+
+    for(int i = 0; i < count; i++)
+        sf_close(infiles[i]);
+    if(fclose(bank) != 0)
+        result = -1;
+    free(infiles);
+    free(entries);
+    if(result != 0)
+    {
+        printf("Failed to write %s\n", output);
+        return 1;
+    }
+    return 0;
+}